@@ -34,12 +34,15 @@
 # define MAX_PATH FILENAME_MAX
 #endif
 
+#include <algorithm>
 #include <climits>
 #include <cstdarg>
 #include <cstdio>
 #include <cstdlib>
 #include <sys/time.h> // struct timeval
+#include <thread>
 #include <time.h> // gettimeofday
+#include <vector>
 
 #include <sgx_eid.h>     /* sgx_enclave_id_t */
 #include <sgx_error.h>       /* sgx_status_t */
@@ -817,10 +820,16 @@ JNIEXPORT jbyteArray JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEncla
 }
 
 JNIEXPORT jbyteArray JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_Sample(
-  JNIEnv *env, jobject obj, jlong eid, jbyteArray input_rows) {
+  JNIEnv *env, jobject obj, jlong eid, jbyteArray sort_order, jint sample_size,
+  jbyteArray input_rows) {
   (void)obj;
 
   jboolean if_copy;
+
+  size_t sort_order_length = static_cast<size_t>(env->GetArrayLength(sort_order));
+  uint8_t *sort_order_ptr = reinterpret_cast<uint8_t *>(
+    env->GetByteArrayElements(sort_order, &if_copy));
+
   size_t input_rows_length = static_cast<size_t>(env->GetArrayLength(input_rows));
   uint8_t *input_rows_ptr = reinterpret_cast<uint8_t *>(
     env->GetByteArrayElements(input_rows, &if_copy));
@@ -831,6 +840,8 @@ JNIEXPORT jbyteArray JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEncla
   sgx_check("Sample",
             ecall_sample(
               eid,
+              sort_order_ptr, sort_order_length,
+              sample_size,
               input_rows_ptr, input_rows_length,
               &output_rows, &output_rows_length));
 
@@ -838,14 +849,14 @@ JNIEXPORT jbyteArray JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEncla
   env->SetByteArrayRegion(ret, 0, output_rows_length, (jbyte *) output_rows);
   free(output_rows);
 
+  env->ReleaseByteArrayElements(sort_order, reinterpret_cast<jbyte *>(sort_order_ptr), 0);
   env->ReleaseByteArrayElements(input_rows, (jbyte *) input_rows_ptr, 0);
 
   return ret;
 }
 
-JNIEXPORT jbyteArray JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_FindRangeBounds(
-  JNIEnv *env, jobject obj, jlong eid, jbyteArray sort_order, jint num_partitions,
-  jbyteArray input_rows) {
+JNIEXPORT jbyteArray JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_SketchSortKeys(
+  JNIEnv *env, jobject obj, jlong eid, jbyteArray sort_order, jbyteArray input_rows) {
   (void)obj;
 
   jboolean if_copy;
@@ -861,11 +872,10 @@ JNIEXPORT jbyteArray JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEncla
   uint8_t *output_rows;
   size_t output_rows_length;
 
-  sgx_check("Find Range Bounds",
-            ecall_find_range_bounds(
+  sgx_check("Sketch Sort Keys",
+            ecall_sketch_sort_keys(
               eid,
               sort_order_ptr, sort_order_length,
-              num_partitions,
               input_rows_ptr, input_rows_length,
               &output_rows, &output_rows_length));
 
@@ -879,6 +889,43 @@ JNIEXPORT jbyteArray JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEncla
   return ret;
 }
 
+JNIEXPORT jbyteArray JNICALL
+Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_FindRangeBoundsFromSketches(
+  JNIEnv *env, jobject obj, jlong eid, jbyteArray sort_order, jint num_partitions,
+  jbyteArray sketches) {
+  (void)obj;
+
+  jboolean if_copy;
+
+  size_t sort_order_length = static_cast<size_t>(env->GetArrayLength(sort_order));
+  uint8_t *sort_order_ptr = reinterpret_cast<uint8_t *>(
+    env->GetByteArrayElements(sort_order, &if_copy));
+
+  size_t sketches_length = static_cast<size_t>(env->GetArrayLength(sketches));
+  uint8_t *sketches_ptr = reinterpret_cast<uint8_t *>(
+    env->GetByteArrayElements(sketches, &if_copy));
+
+  uint8_t *output_rows;
+  size_t output_rows_length;
+
+  sgx_check("Find Range Bounds From Sketches",
+            ecall_find_range_bounds_from_sketches(
+              eid,
+              sort_order_ptr, sort_order_length,
+              num_partitions,
+              sketches_ptr, sketches_length,
+              &output_rows, &output_rows_length));
+
+  jbyteArray ret = env->NewByteArray(output_rows_length);
+  env->SetByteArrayRegion(ret, 0, output_rows_length, reinterpret_cast<jbyte *>(output_rows));
+  free(output_rows);
+
+  env->ReleaseByteArrayElements(sort_order, reinterpret_cast<jbyte *>(sort_order_ptr), 0);
+  env->ReleaseByteArrayElements(sketches, reinterpret_cast<jbyte *>(sketches_ptr), 0);
+
+  return ret;
+}
+
 JNIEXPORT jobjectArray JNICALL
 Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_PartitionForSort(
   JNIEnv *env, jobject obj, jlong eid, jbyteArray sort_order, jint num_partitions,
@@ -929,6 +976,51 @@ Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_PartitionForSort(
   return result;
 }
 
+JNIEXPORT jobjectArray JNICALL
+Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_HashPartition(
+  JNIEnv *env, jobject obj, jlong eid, jbyteArray partition_expr, jint num_partitions,
+  jbyteArray input_rows) {
+  (void)obj;
+
+  jboolean if_copy;
+
+  size_t partition_expr_length = static_cast<size_t>(env->GetArrayLength(partition_expr));
+  uint8_t *partition_expr_ptr = reinterpret_cast<uint8_t *>(
+    env->GetByteArrayElements(partition_expr, &if_copy));
+
+  size_t input_rows_length = static_cast<size_t>(env->GetArrayLength(input_rows));
+  uint8_t *input_rows_ptr = reinterpret_cast<uint8_t *>(
+    env->GetByteArrayElements(input_rows, &if_copy));
+
+  uint8_t **output_partitions = new uint8_t *[num_partitions];
+  size_t *output_partition_lengths = new size_t[num_partitions];
+
+  sgx_check("Hash Partition",
+            ecall_hash_partition(
+              eid,
+              partition_expr_ptr, partition_expr_length,
+              num_partitions,
+              input_rows_ptr, input_rows_length,
+              output_partitions, output_partition_lengths));
+
+  env->ReleaseByteArrayElements(
+    partition_expr, reinterpret_cast<jbyte *>(partition_expr_ptr), 0);
+  env->ReleaseByteArrayElements(input_rows, reinterpret_cast<jbyte *>(input_rows_ptr), 0);
+
+  jobjectArray result = env->NewObjectArray(num_partitions,  env->FindClass("[B"), nullptr);
+  for (jint i = 0; i < num_partitions; i++) {
+    jbyteArray partition = env->NewByteArray(output_partition_lengths[i]);
+    env->SetByteArrayRegion(partition, 0, output_partition_lengths[i],
+                            reinterpret_cast<jbyte *>(output_partitions[i]));
+    free(output_partitions[i]);
+    env->SetObjectArrayElement(result, i, partition);
+  }
+  delete[] output_partitions;
+  delete[] output_partition_lengths;
+
+  return result;
+}
+
 JNIEXPORT jbyteArray JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_ExternalSort(
   JNIEnv *env, jobject obj, jlong eid, jbyteArray sort_order, jbyteArray input_rows) {
   (void)obj;
@@ -962,6 +1054,190 @@ JNIEXPORT jbyteArray JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEncla
   return ret;
 }
 
+JNIEXPORT jbyteArray JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_ObliviousSort(
+  JNIEnv *env, jobject obj, jlong eid, jbyteArray sort_order, jbyteArray input_rows) {
+  (void)obj;
+
+  jboolean if_copy;
+
+  size_t sort_order_length = static_cast<size_t>(env->GetArrayLength(sort_order));
+  uint8_t *sort_order_ptr = reinterpret_cast<uint8_t *>(
+    env->GetByteArrayElements(sort_order, &if_copy));
+
+  size_t input_rows_length = static_cast<size_t>(env->GetArrayLength(input_rows));
+  uint8_t *input_rows_ptr = reinterpret_cast<uint8_t *>(
+    env->GetByteArrayElements(input_rows, &if_copy));
+
+  uint8_t *output_rows;
+  size_t output_rows_length;
+
+  sgx_check("Oblivious sort",
+            ecall_oblivious_sort(eid,
+                                 sort_order_ptr, sort_order_length,
+                                 input_rows_ptr, input_rows_length,
+                                 &output_rows, &output_rows_length));
+
+  jbyteArray ret = env->NewByteArray(output_rows_length);
+  env->SetByteArrayRegion(ret, 0, output_rows_length, reinterpret_cast<jbyte *>(output_rows));
+  free(output_rows);
+
+  env->ReleaseByteArrayElements(sort_order, reinterpret_cast<jbyte *>(sort_order_ptr), 0);
+  env->ReleaseByteArrayElements(input_rows, reinterpret_cast<jbyte *>(input_rows_ptr), 0);
+
+  return ret;
+}
+
+JNIEXPORT jbyteArray JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_ExternalMerge(
+  JNIEnv *env, jobject obj, jlong eid, jbyteArray sort_order, jbyteArray input_runs) {
+  (void)obj;
+
+  jboolean if_copy;
+
+  size_t sort_order_length = static_cast<size_t>(env->GetArrayLength(sort_order));
+  uint8_t *sort_order_ptr = reinterpret_cast<uint8_t *>(
+    env->GetByteArrayElements(sort_order, &if_copy));
+
+  size_t input_runs_length = static_cast<size_t>(env->GetArrayLength(input_runs));
+  uint8_t *input_runs_ptr = reinterpret_cast<uint8_t *>(
+    env->GetByteArrayElements(input_runs, &if_copy));
+
+  uint8_t *output_rows;
+  size_t output_rows_length;
+
+  sgx_check("External non-oblivious merge",
+            ecall_external_merge(eid,
+                                 sort_order_ptr, sort_order_length,
+                                 input_runs_ptr, input_runs_length,
+                                 &output_rows, &output_rows_length));
+
+  jbyteArray ret = env->NewByteArray(output_rows_length);
+  env->SetByteArrayRegion(ret, 0, output_rows_length, reinterpret_cast<jbyte *>(output_rows));
+  free(output_rows);
+
+  env->ReleaseByteArrayElements(sort_order, reinterpret_cast<jbyte *>(sort_order_ptr), 0);
+  env->ReleaseByteArrayElements(input_runs, reinterpret_cast<jbyte *>(input_runs_ptr), 0);
+
+  return ret;
+}
+
+JNIEXPORT jbyteArray JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_TopK(
+  JNIEnv *env, jobject obj, jlong eid, jbyteArray sort_order, jint num_rows,
+  jbyteArray input_rows) {
+  (void)obj;
+
+  jboolean if_copy;
+
+  size_t sort_order_length = static_cast<size_t>(env->GetArrayLength(sort_order));
+  uint8_t *sort_order_ptr = reinterpret_cast<uint8_t *>(
+    env->GetByteArrayElements(sort_order, &if_copy));
+
+  size_t input_rows_length = static_cast<size_t>(env->GetArrayLength(input_rows));
+  uint8_t *input_rows_ptr = reinterpret_cast<uint8_t *>(
+    env->GetByteArrayElements(input_rows, &if_copy));
+
+  uint8_t *output_rows;
+  size_t output_rows_length;
+
+  sgx_check("Top K",
+            ecall_top_k(eid,
+                        sort_order_ptr, sort_order_length,
+                        num_rows,
+                        input_rows_ptr, input_rows_length,
+                        &output_rows, &output_rows_length));
+
+  jbyteArray ret = env->NewByteArray(output_rows_length);
+  env->SetByteArrayRegion(ret, 0, output_rows_length, reinterpret_cast<jbyte *>(output_rows));
+  free(output_rows);
+
+  env->ReleaseByteArrayElements(sort_order, reinterpret_cast<jbyte *>(sort_order_ptr), 0);
+  env->ReleaseByteArrayElements(input_rows, reinterpret_cast<jbyte *>(input_rows_ptr), 0);
+
+  return ret;
+}
+
+// Enclave.config.xml allows 10 threads to be inside the enclave at once. Leave some of them free
+// for other tasks running on the same executor.
+#define MAX_SORT_THREADS 8
+
+JNIEXPORT jobjectArray JNICALL
+Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_ParallelExternalSort(
+  JNIEnv *env, jobject obj, jlong eid, jbyteArray sort_order, jbyteArray input_rows,
+  jint num_threads) {
+  (void)obj;
+
+  jboolean if_copy;
+
+  size_t sort_order_length = static_cast<size_t>(env->GetArrayLength(sort_order));
+  uint8_t *sort_order_ptr = reinterpret_cast<uint8_t *>(
+    env->GetByteArrayElements(sort_order, &if_copy));
+
+  size_t input_rows_length = static_cast<size_t>(env->GetArrayLength(input_rows));
+  uint8_t *input_rows_ptr = reinterpret_cast<uint8_t *>(
+    env->GetByteArrayElements(input_rows, &if_copy));
+
+  uint32_t n = static_cast<uint32_t>(std::max(1, std::min(num_threads, MAX_SORT_THREADS)));
+
+  // 1. Each thread sorts a contiguous chunk of the input blocks into a sorted run
+  std::vector<uint8_t *> runs(n);
+  std::vector<size_t> run_lengths(n);
+  std::vector<uint8_t *> run_indexes(n);
+  std::vector<size_t> run_index_lengths(n);
+  std::vector<std::thread> threads;
+  for (uint32_t i = 0; i < n; i++) {
+    threads.emplace_back([&, i]() {
+      sgx_check("Parallel sort - sort chunk",
+                ecall_external_sort_chunk(eid,
+                                          sort_order_ptr, sort_order_length,
+                                          i, n,
+                                          input_rows_ptr, input_rows_length,
+                                          &runs[i], &run_lengths[i],
+                                          &run_indexes[i], &run_index_lengths[i]));
+    });
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+  threads.clear();
+
+  // 2. Each thread merges the rows of all runs that fall into one key range
+  std::vector<uint8_t *> output_ranges(n);
+  std::vector<size_t> output_range_lengths(n);
+  for (uint32_t i = 0; i < n; i++) {
+    threads.emplace_back([&, i]() {
+      sgx_check("Parallel sort - merge range",
+                ecall_merge_sorted_range(eid,
+                                         sort_order_ptr, sort_order_length,
+                                         n,
+                                         runs.data(), run_lengths.data(),
+                                         run_indexes.data(), run_index_lengths.data(),
+                                         i, n,
+                                         &output_ranges[i], &output_range_lengths[i]));
+    });
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+
+  for (uint32_t i = 0; i < n; i++) {
+    free(runs[i]);
+    free(run_indexes[i]);
+  }
+
+  env->ReleaseByteArrayElements(sort_order, reinterpret_cast<jbyte *>(sort_order_ptr), 0);
+  env->ReleaseByteArrayElements(input_rows, reinterpret_cast<jbyte *>(input_rows_ptr), 0);
+
+  jobjectArray result = env->NewObjectArray(n, env->FindClass("[B"), nullptr);
+  for (uint32_t i = 0; i < n; i++) {
+    jbyteArray range = env->NewByteArray(output_range_lengths[i]);
+    env->SetByteArrayRegion(range, 0, output_range_lengths[i],
+                            reinterpret_cast<jbyte *>(output_ranges[i]));
+    free(output_ranges[i]);
+    env->SetObjectArrayElement(result, i, range);
+  }
+
+  return result;
+}
+
 JNIEXPORT jbyteArray JNICALL
 Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_ScanCollectLastPrimary(
   JNIEnv *env, jobject obj, jlong eid, jbyteArray join_expr, jbyteArray input_rows) {
@@ -996,40 +1272,314 @@ Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_ScanCollectLastPrimary(
 }
 
 JNIEXPORT jbyteArray JNICALL
-Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_NonObliviousSortMergeJoin(
-  JNIEnv *env, jobject obj, jlong eid, jbyteArray join_expr, jbyteArray input_rows,
-  jbyteArray join_row) {
+Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_ScanCollectFirstPrimary(
+  JNIEnv *env, jobject obj, jlong eid, jbyteArray join_expr, jbyteArray input_rows) {
   (void)obj;
 
   jboolean if_copy;
 
-  uint32_t join_expr_length = (uint32_t) env->GetArrayLength(join_expr);
-  uint8_t *join_expr_ptr = (uint8_t *) env->GetByteArrayElements(join_expr, &if_copy);
+  size_t join_expr_length = static_cast<size_t>(env->GetArrayLength(join_expr));
+  uint8_t *join_expr_ptr = reinterpret_cast<uint8_t *>(
+    env->GetByteArrayElements(join_expr, &if_copy));
 
-  uint32_t input_rows_length = (uint32_t) env->GetArrayLength(input_rows);
-  uint8_t *input_rows_ptr = (uint8_t *) env->GetByteArrayElements(input_rows, &if_copy);
+  size_t input_rows_length = static_cast<size_t>(env->GetArrayLength(input_rows));
+  uint8_t *input_rows_ptr = reinterpret_cast<uint8_t *>(
+    env->GetByteArrayElements(input_rows, &if_copy));
+
+  uint8_t *output_rows;
+  size_t output_rows_length;
+
+  sgx_check("Scan Collect First Primary",
+            ecall_scan_collect_first_primary(
+              eid,
+              join_expr_ptr, join_expr_length,
+              input_rows_ptr, input_rows_length,
+              &output_rows, &output_rows_length));
+
+  jbyteArray ret = env->NewByteArray(output_rows_length);
+  env->SetByteArrayRegion(ret, 0, output_rows_length, reinterpret_cast<jbyte *>(output_rows));
+  free(output_rows);
 
-  uint32_t join_row_length = (uint32_t) env->GetArrayLength(join_row);
-  uint8_t *join_row_ptr = (uint8_t *) env->GetByteArrayElements(join_row, &if_copy);
+  env->ReleaseByteArrayElements(join_expr, reinterpret_cast<jbyte *>(join_expr_ptr), 0);
+  env->ReleaseByteArrayElements(input_rows, reinterpret_cast<jbyte *>(input_rows_ptr), 0);
+
+  return ret;
+}
+
+JNIEXPORT jbyteArray JNICALL
+Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_NonObliviousMergeJoin(
+  JNIEnv *env, jobject obj, jlong eid, jbyteArray join_expr, jbyteArray primary_rows,
+  jbyteArray foreign_rows, jbyteArray prev_primary_row, jbyteArray next_primary_row) {
+  (void)obj;
+
+  jboolean if_copy;
+
+  size_t join_expr_length = static_cast<size_t>(env->GetArrayLength(join_expr));
+  uint8_t *join_expr_ptr = reinterpret_cast<uint8_t *>(
+    env->GetByteArrayElements(join_expr, &if_copy));
+
+  size_t primary_rows_length = static_cast<size_t>(env->GetArrayLength(primary_rows));
+  uint8_t *primary_rows_ptr = reinterpret_cast<uint8_t *>(
+    env->GetByteArrayElements(primary_rows, &if_copy));
+
+  size_t foreign_rows_length = static_cast<size_t>(env->GetArrayLength(foreign_rows));
+  uint8_t *foreign_rows_ptr = reinterpret_cast<uint8_t *>(
+    env->GetByteArrayElements(foreign_rows, &if_copy));
+
+  size_t prev_primary_row_length = static_cast<size_t>(env->GetArrayLength(prev_primary_row));
+  uint8_t *prev_primary_row_ptr = reinterpret_cast<uint8_t *>(
+    env->GetByteArrayElements(prev_primary_row, &if_copy));
+
+  size_t next_primary_row_length = static_cast<size_t>(env->GetArrayLength(next_primary_row));
+  uint8_t *next_primary_row_ptr = reinterpret_cast<uint8_t *>(
+    env->GetByteArrayElements(next_primary_row, &if_copy));
 
   uint8_t *output_rows;
   size_t output_rows_length;
 
-  sgx_check("Non-oblivious SortMergeJoin",
-            ecall_non_oblivious_sort_merge_join(
+  sgx_check("Non-oblivious Merge Join",
+            ecall_non_oblivious_merge_join(
               eid,
               join_expr_ptr, join_expr_length,
+              primary_rows_ptr, primary_rows_length,
+              foreign_rows_ptr, foreign_rows_length,
+              prev_primary_row_ptr, prev_primary_row_length,
+              next_primary_row_ptr, next_primary_row_length,
+              &output_rows, &output_rows_length));
+
+  jbyteArray ret = env->NewByteArray(output_rows_length);
+  env->SetByteArrayRegion(ret, 0, output_rows_length, reinterpret_cast<jbyte *>(output_rows));
+  free(output_rows);
+
+  env->ReleaseByteArrayElements(join_expr, reinterpret_cast<jbyte *>(join_expr_ptr), 0);
+  env->ReleaseByteArrayElements(primary_rows, reinterpret_cast<jbyte *>(primary_rows_ptr), 0);
+  env->ReleaseByteArrayElements(foreign_rows, reinterpret_cast<jbyte *>(foreign_rows_ptr), 0);
+  env->ReleaseByteArrayElements(
+    prev_primary_row, reinterpret_cast<jbyte *>(prev_primary_row_ptr), 0);
+  env->ReleaseByteArrayElements(
+    next_primary_row, reinterpret_cast<jbyte *>(next_primary_row_ptr), 0);
+
+  return ret;
+}
+
+JNIEXPORT jbyteArray JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_HashJoin(
+  JNIEnv *env, jobject obj, jlong eid, jbyteArray join_expr, jbyteArray build_rows,
+  jbyteArray probe_rows) {
+  (void)obj;
+
+  jboolean if_copy;
+
+  size_t join_expr_length = static_cast<size_t>(env->GetArrayLength(join_expr));
+  uint8_t *join_expr_ptr = reinterpret_cast<uint8_t *>(
+    env->GetByteArrayElements(join_expr, &if_copy));
+
+  size_t build_rows_length = static_cast<size_t>(env->GetArrayLength(build_rows));
+  uint8_t *build_rows_ptr = reinterpret_cast<uint8_t *>(
+    env->GetByteArrayElements(build_rows, &if_copy));
+
+  size_t probe_rows_length = static_cast<size_t>(env->GetArrayLength(probe_rows));
+  uint8_t *probe_rows_ptr = reinterpret_cast<uint8_t *>(
+    env->GetByteArrayElements(probe_rows, &if_copy));
+
+  uint8_t *output_rows;
+  size_t output_rows_length;
+
+  sgx_check("Hash Join",
+            ecall_hash_join(
+              eid,
+              join_expr_ptr, join_expr_length,
+              build_rows_ptr, build_rows_length,
+              probe_rows_ptr, probe_rows_length,
+              &output_rows, &output_rows_length));
+
+  jbyteArray ret = env->NewByteArray(output_rows_length);
+  env->SetByteArrayRegion(ret, 0, output_rows_length, reinterpret_cast<jbyte *>(output_rows));
+  free(output_rows);
+
+  env->ReleaseByteArrayElements(join_expr, reinterpret_cast<jbyte *>(join_expr_ptr), 0);
+  env->ReleaseByteArrayElements(build_rows, reinterpret_cast<jbyte *>(build_rows_ptr), 0);
+  env->ReleaseByteArrayElements(probe_rows, reinterpret_cast<jbyte *>(probe_rows_ptr), 0);
+
+  return ret;
+}
+
+JNIEXPORT jlong JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_BroadcastBuild(
+  JNIEnv *env, jobject obj, jlong eid, jbyteArray join_expr, jbyteArray build_rows) {
+  (void)obj;
+
+  jboolean if_copy;
+
+  size_t join_expr_length = static_cast<size_t>(env->GetArrayLength(join_expr));
+  uint8_t *join_expr_ptr = reinterpret_cast<uint8_t *>(
+    env->GetByteArrayElements(join_expr, &if_copy));
+
+  size_t build_rows_length = static_cast<size_t>(env->GetArrayLength(build_rows));
+  uint8_t *build_rows_ptr = reinterpret_cast<uint8_t *>(
+    env->GetByteArrayElements(build_rows, &if_copy));
+
+  uint64_t handle;
+
+  sgx_check("Broadcast Build",
+            ecall_broadcast_build(
+              eid,
+              join_expr_ptr, join_expr_length,
+              build_rows_ptr, build_rows_length,
+              &handle));
+
+  env->ReleaseByteArrayElements(join_expr, reinterpret_cast<jbyte *>(join_expr_ptr), 0);
+  env->ReleaseByteArrayElements(build_rows, reinterpret_cast<jbyte *>(build_rows_ptr), 0);
+
+  return static_cast<jlong>(handle);
+}
+
+JNIEXPORT jbyteArray JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_BroadcastProbe(
+  JNIEnv *env, jobject obj, jlong eid, jlong handle, jbyteArray probe_rows) {
+  (void)obj;
+
+  jboolean if_copy;
+
+  size_t probe_rows_length = static_cast<size_t>(env->GetArrayLength(probe_rows));
+  uint8_t *probe_rows_ptr = reinterpret_cast<uint8_t *>(
+    env->GetByteArrayElements(probe_rows, &if_copy));
+
+  uint8_t *output_rows;
+  size_t output_rows_length;
+
+  sgx_check("Broadcast Probe",
+            ecall_broadcast_probe(
+              eid,
+              static_cast<uint64_t>(handle),
+              probe_rows_ptr, probe_rows_length,
+              &output_rows, &output_rows_length));
+
+  jbyteArray ret = env->NewByteArray(output_rows_length);
+  env->SetByteArrayRegion(ret, 0, output_rows_length, reinterpret_cast<jbyte *>(output_rows));
+  free(output_rows);
+
+  env->ReleaseByteArrayElements(probe_rows, reinterpret_cast<jbyte *>(probe_rows_ptr), 0);
+
+  return ret;
+}
+
+JNIEXPORT void JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_BroadcastRelease(
+  JNIEnv *env, jobject obj, jlong eid, jlong handle) {
+  (void)env;
+  (void)obj;
+
+  sgx_check("Broadcast Release",
+            ecall_broadcast_release(eid, static_cast<uint64_t>(handle)));
+}
+
+JNIEXPORT jbyteArray JNICALL
+Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_BuildBloomFilter(
+  JNIEnv *env, jobject obj, jlong eid, jbyteArray join_expr, jint num_keys,
+  jbyteArray input_rows) {
+  (void)obj;
+
+  jboolean if_copy;
+
+  size_t join_expr_length = static_cast<size_t>(env->GetArrayLength(join_expr));
+  uint8_t *join_expr_ptr = reinterpret_cast<uint8_t *>(
+    env->GetByteArrayElements(join_expr, &if_copy));
+
+  size_t input_rows_length = static_cast<size_t>(env->GetArrayLength(input_rows));
+  uint8_t *input_rows_ptr = reinterpret_cast<uint8_t *>(
+    env->GetByteArrayElements(input_rows, &if_copy));
+
+  uint8_t *output_filter;
+  size_t output_filter_length;
+
+  sgx_check("Build Bloom Filter",
+            ecall_build_bloom_filter(
+              eid,
+              join_expr_ptr, join_expr_length,
+              num_keys,
+              input_rows_ptr, input_rows_length,
+              &output_filter, &output_filter_length));
+
+  jbyteArray ret = env->NewByteArray(output_filter_length);
+  env->SetByteArrayRegion(ret, 0, output_filter_length, reinterpret_cast<jbyte *>(output_filter));
+  free(output_filter);
+
+  env->ReleaseByteArrayElements(join_expr, reinterpret_cast<jbyte *>(join_expr_ptr), 0);
+  env->ReleaseByteArrayElements(input_rows, reinterpret_cast<jbyte *>(input_rows_ptr), 0);
+
+  return ret;
+}
+
+JNIEXPORT jbyteArray JNICALL
+Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_MergeBloomFilters(
+  JNIEnv *env, jobject obj, jlong eid, jbyteArray filter_a, jbyteArray filter_b) {
+  (void)obj;
+
+  jboolean if_copy;
+
+  size_t filter_a_length = static_cast<size_t>(env->GetArrayLength(filter_a));
+  uint8_t *filter_a_ptr = reinterpret_cast<uint8_t *>(
+    env->GetByteArrayElements(filter_a, &if_copy));
+
+  size_t filter_b_length = static_cast<size_t>(env->GetArrayLength(filter_b));
+  uint8_t *filter_b_ptr = reinterpret_cast<uint8_t *>(
+    env->GetByteArrayElements(filter_b, &if_copy));
+
+  uint8_t *output_filter;
+  size_t output_filter_length;
+
+  sgx_check("Merge Bloom Filters",
+            ecall_merge_bloom_filters(
+              eid,
+              filter_a_ptr, filter_a_length,
+              filter_b_ptr, filter_b_length,
+              &output_filter, &output_filter_length));
+
+  jbyteArray ret = env->NewByteArray(output_filter_length);
+  env->SetByteArrayRegion(ret, 0, output_filter_length, reinterpret_cast<jbyte *>(output_filter));
+  free(output_filter);
+
+  env->ReleaseByteArrayElements(filter_a, reinterpret_cast<jbyte *>(filter_a_ptr), 0);
+  env->ReleaseByteArrayElements(filter_b, reinterpret_cast<jbyte *>(filter_b_ptr), 0);
+
+  return ret;
+}
+
+JNIEXPORT jbyteArray JNICALL
+Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_BloomFilterRows(
+  JNIEnv *env, jobject obj, jlong eid, jbyteArray join_expr, jbyteArray filter,
+  jbyteArray input_rows) {
+  (void)obj;
+
+  jboolean if_copy;
+
+  size_t join_expr_length = static_cast<size_t>(env->GetArrayLength(join_expr));
+  uint8_t *join_expr_ptr = reinterpret_cast<uint8_t *>(
+    env->GetByteArrayElements(join_expr, &if_copy));
+
+  size_t filter_length = static_cast<size_t>(env->GetArrayLength(filter));
+  uint8_t *filter_ptr = reinterpret_cast<uint8_t *>(
+    env->GetByteArrayElements(filter, &if_copy));
+
+  size_t input_rows_length = static_cast<size_t>(env->GetArrayLength(input_rows));
+  uint8_t *input_rows_ptr = reinterpret_cast<uint8_t *>(
+    env->GetByteArrayElements(input_rows, &if_copy));
+
+  uint8_t *output_rows;
+  size_t output_rows_length;
+
+  sgx_check("Bloom Filter Rows",
+            ecall_bloom_filter_rows(
+              eid,
+              join_expr_ptr, join_expr_length,
+              filter_ptr, filter_length,
               input_rows_ptr, input_rows_length,
-              join_row_ptr, join_row_length,
               &output_rows, &output_rows_length));
-  
+
   jbyteArray ret = env->NewByteArray(output_rows_length);
-  env->SetByteArrayRegion(ret, 0, output_rows_length, (jbyte *) output_rows);
+  env->SetByteArrayRegion(ret, 0, output_rows_length, reinterpret_cast<jbyte *>(output_rows));
   free(output_rows);
 
-  env->ReleaseByteArrayElements(join_expr, (jbyte *) join_expr_ptr, 0);
-  env->ReleaseByteArrayElements(input_rows, (jbyte *) input_rows_ptr, 0);
-  env->ReleaseByteArrayElements(join_row, (jbyte *) join_row_ptr, 0);
+  env->ReleaseByteArrayElements(join_expr, reinterpret_cast<jbyte *>(join_expr_ptr), 0);
+  env->ReleaseByteArrayElements(filter, reinterpret_cast<jbyte *>(filter_ptr), 0);
+  env->ReleaseByteArrayElements(input_rows, reinterpret_cast<jbyte *>(input_rows_ptr), 0);
 
   return ret;
 }
@@ -1149,6 +1699,104 @@ Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_NonObliviousAggregateStep2
   return ret;
 }
 
+JNIEXPORT jbyteArray JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_HashAggregate(
+  JNIEnv *env, jobject obj, jlong eid, jbyteArray agg_op, jbyteArray input_rows) {
+  (void)obj;
+
+  jboolean if_copy;
+
+  uint32_t agg_op_length = (uint32_t) env->GetArrayLength(agg_op);
+  uint8_t *agg_op_ptr = (uint8_t *) env->GetByteArrayElements(agg_op, &if_copy);
+
+  uint32_t input_rows_length = (uint32_t) env->GetArrayLength(input_rows);
+  uint8_t *input_rows_ptr = (uint8_t *) env->GetByteArrayElements(input_rows, &if_copy);
+
+  uint8_t *output_rows;
+  size_t output_rows_length;
+
+  sgx_check("Hash Aggregate",
+            ecall_hash_aggregate(
+              eid,
+              agg_op_ptr, agg_op_length,
+              input_rows_ptr, input_rows_length,
+              &output_rows, &output_rows_length));
+
+  jbyteArray ret = env->NewByteArray(output_rows_length);
+  env->SetByteArrayRegion(ret, 0, output_rows_length, (jbyte *) output_rows);
+  free(output_rows);
+
+  env->ReleaseByteArrayElements(agg_op, (jbyte *) agg_op_ptr, 0);
+  env->ReleaseByteArrayElements(input_rows, (jbyte *) input_rows_ptr, 0);
+
+  return ret;
+}
+
+JNIEXPORT jbyteArray JNICALL
+Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_PartialAggregate(
+  JNIEnv *env, jobject obj, jlong eid, jbyteArray agg_op, jbyteArray input_rows) {
+  (void)obj;
+
+  jboolean if_copy;
+
+  uint32_t agg_op_length = (uint32_t) env->GetArrayLength(agg_op);
+  uint8_t *agg_op_ptr = (uint8_t *) env->GetByteArrayElements(agg_op, &if_copy);
+
+  uint32_t input_rows_length = (uint32_t) env->GetArrayLength(input_rows);
+  uint8_t *input_rows_ptr = (uint8_t *) env->GetByteArrayElements(input_rows, &if_copy);
+
+  uint8_t *output_rows;
+  size_t output_rows_length;
+
+  sgx_check("Partial Aggregate",
+            ecall_partial_aggregate(
+              eid,
+              agg_op_ptr, agg_op_length,
+              input_rows_ptr, input_rows_length,
+              &output_rows, &output_rows_length));
+
+  jbyteArray ret = env->NewByteArray(output_rows_length);
+  env->SetByteArrayRegion(ret, 0, output_rows_length, (jbyte *) output_rows);
+  free(output_rows);
+
+  env->ReleaseByteArrayElements(agg_op, (jbyte *) agg_op_ptr, 0);
+  env->ReleaseByteArrayElements(input_rows, (jbyte *) input_rows_ptr, 0);
+
+  return ret;
+}
+
+JNIEXPORT jbyteArray JNICALL
+Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_FinalAggregate(
+  JNIEnv *env, jobject obj, jlong eid, jbyteArray agg_op, jbyteArray input_rows) {
+  (void)obj;
+
+  jboolean if_copy;
+
+  uint32_t agg_op_length = (uint32_t) env->GetArrayLength(agg_op);
+  uint8_t *agg_op_ptr = (uint8_t *) env->GetByteArrayElements(agg_op, &if_copy);
+
+  uint32_t input_rows_length = (uint32_t) env->GetArrayLength(input_rows);
+  uint8_t *input_rows_ptr = (uint8_t *) env->GetByteArrayElements(input_rows, &if_copy);
+
+  uint8_t *output_rows;
+  size_t output_rows_length;
+
+  sgx_check("Final Aggregate",
+            ecall_final_aggregate(
+              eid,
+              agg_op_ptr, agg_op_length,
+              input_rows_ptr, input_rows_length,
+              &output_rows, &output_rows_length));
+
+  jbyteArray ret = env->NewByteArray(output_rows_length);
+  env->SetByteArrayRegion(ret, 0, output_rows_length, (jbyte *) output_rows);
+  free(output_rows);
+
+  env->ReleaseByteArrayElements(agg_op, (jbyte *) agg_op_ptr, 0);
+  env->ReleaseByteArrayElements(input_rows, (jbyte *) input_rows_ptr, 0);
+
+  return ret;
+}
+
 /* application entry */
 //SGX_CDECL
 int SGX_CDECL main(int argc, char *argv[])
@@ -24,25 +24,74 @@ extern "C" {
     JNIEnv *, jobject, jlong, jbyteArray);
 
   JNIEXPORT jbyteArray JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_Sample(
-    JNIEnv *, jobject, jlong, jbyteArray);
+    JNIEnv *, jobject, jlong, jbyteArray, jint, jbyteArray);
+
+  JNIEXPORT jbyteArray JNICALL
+  Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_SketchSortKeys(
+    JNIEnv *, jobject, jlong, jbyteArray, jbyteArray);
 
   JNIEXPORT jbyteArray JNICALL
-  Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_FindRangeBounds(
+  Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_FindRangeBoundsFromSketches(
     JNIEnv *, jobject, jlong, jbyteArray, jint, jbyteArray);
 
   JNIEXPORT jobjectArray JNICALL
   Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_PartitionForSort(
     JNIEnv *, jobject, jlong, jbyteArray, jint, jbyteArray, jbyteArray);
 
+  JNIEXPORT jobjectArray JNICALL
+  Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_HashPartition(
+    JNIEnv *, jobject, jlong, jbyteArray, jint, jbyteArray);
+
   JNIEXPORT jbyteArray JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_ExternalSort(
     JNIEnv *, jobject, jlong, jbyteArray, jbyteArray);
 
+  JNIEXPORT jbyteArray JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_ObliviousSort(
+    JNIEnv *, jobject, jlong, jbyteArray, jbyteArray);
+
+  JNIEXPORT jbyteArray JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_ExternalMerge(
+    JNIEnv *, jobject, jlong, jbyteArray, jbyteArray);
+
+  JNIEXPORT jbyteArray JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_TopK(
+    JNIEnv *, jobject, jlong, jbyteArray, jint, jbyteArray);
+
+  JNIEXPORT jobjectArray JNICALL
+  Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_ParallelExternalSort(
+    JNIEnv *, jobject, jlong, jbyteArray, jbyteArray, jint);
+
   JNIEXPORT jbyteArray JNICALL
   Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_ScanCollectLastPrimary(
     JNIEnv *, jobject, jlong, jbyteArray, jbyteArray);
 
   JNIEXPORT jbyteArray JNICALL
-  Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_NonObliviousSortMergeJoin(
+  Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_ScanCollectFirstPrimary(
+    JNIEnv *, jobject, jlong, jbyteArray, jbyteArray);
+
+  JNIEXPORT jbyteArray JNICALL
+  Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_NonObliviousMergeJoin(
+    JNIEnv *, jobject, jlong, jbyteArray, jbyteArray, jbyteArray, jbyteArray, jbyteArray);
+
+  JNIEXPORT jbyteArray JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_HashJoin(
+    JNIEnv *, jobject, jlong, jbyteArray, jbyteArray, jbyteArray);
+
+  JNIEXPORT jlong JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_BroadcastBuild(
+    JNIEnv *, jobject, jlong, jbyteArray, jbyteArray);
+
+  JNIEXPORT jbyteArray JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_BroadcastProbe(
+    JNIEnv *, jobject, jlong, jlong, jbyteArray);
+
+  JNIEXPORT void JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_BroadcastRelease(
+    JNIEnv *, jobject, jlong, jlong);
+
+  JNIEXPORT jbyteArray JNICALL
+  Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_BuildBloomFilter(
+    JNIEnv *, jobject, jlong, jbyteArray, jint, jbyteArray);
+
+  JNIEXPORT jbyteArray JNICALL
+  Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_MergeBloomFilters(
+    JNIEnv *, jobject, jlong, jbyteArray, jbyteArray);
+
+  JNIEXPORT jbyteArray JNICALL
+  Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_BloomFilterRows(
     JNIEnv *, jobject, jlong, jbyteArray, jbyteArray, jbyteArray);
 
   JNIEXPORT jobject JNICALL
@@ -53,6 +102,17 @@ extern "C" {
   Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_NonObliviousAggregateStep2(
     JNIEnv *, jobject, jlong, jbyteArray, jbyteArray, jbyteArray, jbyteArray, jbyteArray);
 
+  JNIEXPORT jbyteArray JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_HashAggregate(
+    JNIEnv *, jobject, jlong, jbyteArray, jbyteArray);
+
+  JNIEXPORT jbyteArray JNICALL
+  Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_PartialAggregate(
+    JNIEnv *, jobject, jlong, jbyteArray, jbyteArray);
+
+  JNIEXPORT jbyteArray JNICALL
+  Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_FinalAggregate(
+    JNIEnv *, jobject, jlong, jbyteArray, jbyteArray);
+
   JNIEXPORT jbyteArray JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_RemoteAttestation0(
     JNIEnv *, jobject);
 
@@ -1,5 +1,11 @@
 #include "Aggregate.h"
 
+#include <cstring>
+#include <memory>
+
+#include <sgx_trts.h>
+
+#include "Crypto.h"
 #include "ExpressionEvaluation.h"
 #include "common.h"
 
@@ -117,3 +123,285 @@ void non_oblivious_aggregate_step2(
   *output_rows = w.output_buffer().release();
   *output_rows_length = w.output_size();
 }
+
+/**
+ * The partial aggregates of the groups seen so far by hash_aggregate, in an open-addressing hash
+ * table keyed by the normalized grouping key. Each partial aggregate is kept as a serialized Row,
+ * optionally along with the values of the grouping expressions for the group.
+ */
+class AggregateHashTable {
+public:
+  AggregateHashTable() : slots(16, EMPTY_SLOT), row_bytes(0) {
+    key_offsets.push_back(0);
+  }
+
+  static const uint32_t EMPTY_SLOT = UINT32_MAX;
+
+  /** Return the group with the given key and hash, or EMPTY_SLOT if there is none. */
+  uint32_t find(const uint8_t *key, uint32_t key_length, uint64_t h) {
+    return slots[find_slot(key, key_length, h)];
+  }
+
+  /**
+   * Add a group, which must not be present, with the given partial aggregate and, if not null, the
+   * given grouping values.
+   */
+  uint32_t insert(const uint8_t *key, uint32_t key_length, uint64_t h,
+                  const tuix::Row *partial_agg, const tuix::Row *group_values) {
+    if (2 * (hashes.size() + 1) > slots.size()) {
+      grow();
+    }
+    uint32_t group = hashes.size();
+    slots[find_slot(key, key_length, h)] = group;
+    hashes.push_back(h);
+    keys.insert(keys.end(), key, key + key_length);
+    key_offsets.push_back(keys.size());
+    partial_aggs.emplace_back();
+    set(group, partial_agg);
+    group_values_list.emplace_back();
+    if (group_values) {
+      copy_row(group_values, group_values_list.back());
+    }
+    return group;
+  }
+
+  const tuix::Row *get(uint32_t group) {
+    return flatbuffers::GetRoot<tuix::Row>(partial_aggs[group].data());
+  }
+
+  /** Return the grouping values passed to insert. */
+  const tuix::Row *get_group_values(uint32_t group) {
+    return flatbuffers::GetRoot<tuix::Row>(group_values_list[group].data());
+  }
+
+  void set(uint32_t group, const tuix::Row *partial_agg) {
+    copy_row(partial_agg, partial_aggs[group]);
+  }
+
+  uint32_t num_groups() {
+    return hashes.size();
+  }
+
+  /** Return the approximate number of bytes of enclave memory used by the table. */
+  size_t memory_used() {
+    return slots.size() * sizeof(uint32_t)
+      + hashes.size() * (sizeof(uint64_t) + sizeof(size_t) + 2 * sizeof(std::vector<uint8_t>))
+      + keys.size() + row_bytes;
+  }
+
+private:
+  void copy_row(const tuix::Row *row, std::vector<uint8_t> &buf) {
+    builder.Clear();
+    builder.Finish(flatbuffers_copy(row, builder));
+    row_bytes -= buf.size();
+    buf.assign(builder.GetBufferPointer(), builder.GetBufferPointer() + builder.GetSize());
+    row_bytes += buf.size();
+  }
+
+  /** Return the slot holding the given key, or the empty slot where it would be inserted. */
+  uint32_t find_slot(const uint8_t *key, uint32_t key_length, uint64_t h) {
+    uint32_t mask = slots.size() - 1;
+    for (uint32_t i = h & mask;; i = (i + 1) & mask) {
+      uint32_t group = slots[i];
+      if (group == EMPTY_SLOT) {
+        return i;
+      }
+      if (hashes[group] == h
+          && key_offsets[group + 1] - key_offsets[group] == key_length
+          && std::memcmp(&keys[key_offsets[group]], key, key_length) == 0) {
+        return i;
+      }
+    }
+  }
+
+  void grow() {
+    std::vector<uint32_t> old_slots(2 * slots.size(), EMPTY_SLOT);
+    old_slots.swap(slots);
+    uint32_t mask = slots.size() - 1;
+    for (uint32_t group = 0; group < hashes.size(); group++) {
+      uint32_t i = hashes[group] & mask;
+      while (slots[i] != EMPTY_SLOT) {
+        i = (i + 1) & mask;
+      }
+      slots[i] = group;
+    }
+  }
+
+  std::vector<uint32_t> slots;
+  std::vector<uint64_t> hashes;
+  std::vector<uint8_t> keys;
+  std::vector<size_t> key_offsets;
+  std::vector<std::vector<uint8_t>> partial_aggs;
+  std::vector<std::vector<uint8_t>> group_values_list;
+  size_t row_bytes;
+  flatbuffers::FlatBufferBuilder builder;
+};
+
+const uint32_t AggregateHashTable::EMPTY_SLOT;
+
+// Number of partitions that hash_aggregate spills rows to once its hash table is full. Each holds
+// up to a block of plaintext rows in enclave memory, which counts against AGGREGATE_MEMORY_BUDGET.
+static const uint32_t NUM_SPILL_PARTITIONS = 8;
+
+// Spill partitions are aggregated recursively. Each level aggregates at least a table's worth of
+// groups, so this is only reached on a corrupt input.
+static const uint32_t MAX_SPILL_DEPTH = 16;
+
+// What hash_aggregate_rows reads and writes. Complete aggregates input rows into results. Partial
+// aggregates input rows into partial rows, and Final merges partial rows into results.
+enum class AggregateMode { Complete, Partial, Final };
+
+static void hash_aggregate_rows(
+  FlatbuffersAggOpEvaluator &agg_op_eval, AggregateMode mode,
+  uint8_t *input_rows, size_t input_rows_length,
+  uint32_t depth, FlatbuffersRowWriter &w) {
+
+  check(depth <= MAX_SPILL_DEPTH, "hash_aggregate: spilled %d times\n", depth);
+
+  // A fresh hash key at each level, so that the groups of a spill partition spread over the next
+  // level's spill partitions
+  sgx_cmac_128bit_key_t hash_key;
+  sgx_read_rand(hash_key, sizeof(hash_key));
+
+  std::unique_ptr<AggregateHashTable> table(new AggregateHashTable());
+  std::vector<std::unique_ptr<FlatbuffersRowWriter>> spills;
+  // The AggregateOp can only lower the budget. A budget too small to also hold the spill buffers,
+  // as used by tests to force spilling, limits the table alone.
+  uint64_t budget = agg_op_eval.get_memory_budget();
+  if (budget == 0 || budget > AGGREGATE_MEMORY_BUDGET) {
+    budget = AGGREGATE_MEMORY_BUDGET;
+  }
+  const uint64_t spill_buffers = NUM_SPILL_PARTITIONS * MAX_BLOCK_SIZE;
+  const size_t table_budget = mode == AggregateMode::Partial || budget <= spill_buffers
+    ? budget
+    : budget - spill_buffers;
+
+  // The group whose partial aggregate is loaded in agg_op_eval. It is only written back to the
+  // table when another group is loaded, so a run of rows from one group is aggregated in place.
+  uint32_t current_group = AggregateHashTable::EMPTY_SLOT;
+  auto save_current_group = [&]() {
+    if (current_group != AggregateHashTable::EMPTY_SLOT) {
+      table->set(current_group, agg_op_eval.get_partial_agg());
+    }
+  };
+
+  auto write_groups = [&]() {
+    for (uint32_t group = 0; group < table->num_groups(); group++) {
+      if (mode == AggregateMode::Partial) {
+        w.write(table->get_group_values(group), table->get(group));
+      } else {
+        agg_op_eval.set(table->get(group));
+        w.write(agg_op_eval.evaluate());
+      }
+    }
+  };
+
+  EncryptedBlocksToRowReader r(input_rows, input_rows_length);
+  std::vector<uint8_t> key;
+  while (r.has_next()) {
+    const tuix::Row *row = r.next();
+    key.clear();
+    if (mode == AggregateMode::Final) {
+      agg_op_eval.append_partial_group_key(row, key);
+    } else {
+      agg_op_eval.append_group_key(row, key);
+    }
+    uint64_t h = siphash(&hash_key, key.data(), key.size());
+
+    uint32_t group = table->find(key.data(), key.size(), h);
+    // Every pass takes at least one group, so that even a tiny budget makes progress
+    bool table_full = table->num_groups() > 0 && table->memory_used() >= table_budget;
+    if (group == AggregateHashTable::EMPTY_SLOT) {
+      if (table_full && mode == AggregateMode::Partial) {
+        // A group may have any number of partial rows, so instead of spilling, write out the
+        // table and start over
+        save_current_group();
+        current_group = AggregateHashTable::EMPTY_SLOT;
+        write_groups();
+        table.reset(new AggregateHashTable());
+      } else if (table_full) {
+        // The table is full, so defer this group to a later pass
+        if (spills.empty()) {
+          for (uint32_t i = 0; i < NUM_SPILL_PARTITIONS; i++) {
+            spills.emplace_back(new FlatbuffersRowWriter());
+          }
+        }
+        spills[(h >> 32) % NUM_SPILL_PARTITIONS]->write(row);
+        continue;
+      }
+      save_current_group();
+      agg_op_eval.reset_group();
+      group = table->insert(
+        key.data(), key.size(), h, agg_op_eval.get_partial_agg(),
+        mode == AggregateMode::Partial ? agg_op_eval.get_group(row) : nullptr);
+      current_group = group;
+    } else if (group != current_group) {
+      save_current_group();
+      agg_op_eval.set(table->get(group));
+      current_group = group;
+    }
+    if (mode == AggregateMode::Final) {
+      agg_op_eval.merge(row);
+    } else {
+      agg_op_eval.aggregate(row);
+    }
+  }
+  save_current_group();
+  memset(hash_key, 0, sizeof(hash_key));
+
+  write_groups();
+  table.reset();
+
+  for (auto &spill : spills) {
+    if (spill->output_num_rows() == 0) {
+      continue;
+    }
+    spill->finish(spill->write_encrypted_blocks());
+    std::unique_ptr<uint8_t, decltype(&ocall_free)> spill_rows = spill->output_buffer();
+    size_t spill_rows_length = spill->output_size();
+    spill.reset();
+    hash_aggregate_rows(agg_op_eval, mode, spill_rows.get(), spill_rows_length, depth + 1, w);
+  }
+}
+
+static void hash_aggregate_with_mode(
+  AggregateMode mode,
+  uint8_t *agg_op, size_t agg_op_length,
+  uint8_t *input_rows, size_t input_rows_length,
+  uint8_t **output_rows, size_t *output_rows_length) {
+
+  FlatbuffersAggOpEvaluator agg_op_eval(agg_op, agg_op_length);
+  FlatbuffersRowWriter w;
+  hash_aggregate_rows(agg_op_eval, mode, input_rows, input_rows_length, 0, w);
+
+  w.finish(w.write_encrypted_blocks());
+  *output_rows = w.output_buffer().release();
+  *output_rows_length = w.output_size();
+}
+
+void hash_aggregate(
+  uint8_t *agg_op, size_t agg_op_length,
+  uint8_t *input_rows, size_t input_rows_length,
+  uint8_t **output_rows, size_t *output_rows_length) {
+  hash_aggregate_with_mode(
+    AggregateMode::Complete, agg_op, agg_op_length, input_rows, input_rows_length,
+    output_rows, output_rows_length);
+}
+
+void partial_aggregate(
+  uint8_t *agg_op, size_t agg_op_length,
+  uint8_t *input_rows, size_t input_rows_length,
+  uint8_t **output_rows, size_t *output_rows_length) {
+  hash_aggregate_with_mode(
+    AggregateMode::Partial, agg_op, agg_op_length, input_rows, input_rows_length,
+    output_rows, output_rows_length);
+}
+
+void final_aggregate(
+  uint8_t *agg_op, size_t agg_op_length,
+  uint8_t *input_rows, size_t input_rows_length,
+  uint8_t **output_rows, size_t *output_rows_length) {
+  hash_aggregate_with_mode(
+    AggregateMode::Final, agg_op, agg_op_length, input_rows, input_rows_length,
+    output_rows, output_rows_length);
+}
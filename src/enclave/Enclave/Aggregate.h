@@ -19,4 +19,40 @@ void non_oblivious_aggregate_step2(
   uint8_t *prev_partition_last_row, size_t prev_partition_last_row_length,
   uint8_t **output_rows, size_t *output_rows_length);
 
+/**
+ * Aggregate the input rows, which need not be sorted, in an in-enclave hash table keyed by the
+ * grouping expressions, and write one row per group in no particular order. All rows of a group
+ * must be in the input, for example after hash partitioning on the grouping expressions.
+ *
+ * Once the hash table reaches AGGREGATE_MEMORY_BUDGET, rows of groups not already in it are
+ * spilled, encrypted, to untrusted memory in several hash partitions, and each partition is then
+ * aggregated in turn the same way.
+ */
+void hash_aggregate(
+  uint8_t *agg_op, size_t agg_op_length,
+  uint8_t *input_rows, size_t input_rows_length,
+  uint8_t **output_rows, size_t *output_rows_length);
+
+/**
+ * Aggregate the input rows like hash_aggregate, but instead of a result, write a partial row for
+ * each group: the values of the grouping expressions followed by the partial aggregate. The input
+ * may hold any subset of the rows of a group, so this can run on each partition before a shuffle,
+ * leaving only about one row per group per partition to shuffle. If the hash table fills up, it is
+ * written out and emptied, so a group may have several partial rows.
+ */
+void partial_aggregate(
+  uint8_t *agg_op, size_t agg_op_length,
+  uint8_t *input_rows, size_t input_rows_length,
+  uint8_t **output_rows, size_t *output_rows_length);
+
+/**
+ * Merge the partial rows written by partial_aggregate into one result row per group, like
+ * hash_aggregate. All partial rows of a group must be in the input, for example after hash
+ * partitioning on the grouping values. Only supported if every aggregate can be computed natively.
+ */
+void final_aggregate(
+  uint8_t *agg_op, size_t agg_op_length,
+  uint8_t *input_rows, size_t input_rows_length,
+  uint8_t **output_rows, size_t *output_rows_length);
+
 #endif // AGGREGATE_H
@@ -330,3 +330,109 @@ void MAC::mac(uint8_t *mac_ptr, uint32_t len) {
   (void)len;
   // cipher->aad((unsigned char *) mac_ptr, len);
 }
+
+
+void derive_key(const char *label, sgx_cmac_128bit_key_t *derived_key) {
+  sgx_status_t ret = sgx_rijndael128_cmac_msg(
+    key, reinterpret_cast<const uint8_t *>(label), strlen(label), derived_key);
+  check(ret == SGX_SUCCESS, "derive_key: CMAC failed with %d\n", ret);
+}
+
+static inline uint64_t rotl64(uint64_t x, int b) {
+  return (x << b) | (x >> (64 - b));
+}
+
+static inline uint64_t load64_le(const uint8_t *p) {
+  uint64_t x = 0;
+  for (int i = 7; i >= 0; i--) {
+    x = (x << 8) | p[i];
+  }
+  return x;
+}
+
+#define SIPROUND                                                        \
+  do {                                                                  \
+    v0 += v1; v1 = rotl64(v1, 13); v1 ^= v0; v0 = rotl64(v0, 32);       \
+    v2 += v3; v3 = rotl64(v3, 16); v3 ^= v2;                            \
+    v0 += v3; v3 = rotl64(v3, 21); v3 ^= v0;                            \
+    v2 += v1; v1 = rotl64(v1, 17); v1 ^= v2; v2 = rotl64(v2, 32);       \
+  } while (0)
+
+uint64_t siphash(const sgx_cmac_128bit_key_t *hash_key, const uint8_t *data, size_t len) {
+  uint64_t k0 = load64_le(*hash_key);
+  uint64_t k1 = load64_le(*hash_key + 8);
+  uint64_t v0 = k0 ^ 0x736f6d6570736575ULL;
+  uint64_t v1 = k1 ^ 0x646f72616e646f6dULL;
+  uint64_t v2 = k0 ^ 0x6c7967656e657261ULL;
+  uint64_t v3 = k1 ^ 0x7465646279746573ULL;
+
+  const uint8_t *end = data + (len & ~static_cast<size_t>(7));
+  for (; data != end; data += 8) {
+    uint64_t m = load64_le(data);
+    v3 ^= m;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= m;
+  }
+
+  // The last word holds the remaining bytes and the low byte of the length
+  uint64_t b = static_cast<uint64_t>(len) << 56;
+  for (size_t i = 0; i < (len & 7); i++) {
+    b |= static_cast<uint64_t>(data[i]) << (8 * i);
+  }
+  v3 ^= b;
+  SIPROUND;
+  SIPROUND;
+  v0 ^= b;
+
+  v2 ^= 0xff;
+  SIPROUND;
+  SIPROUND;
+  SIPROUND;
+  SIPROUND;
+  return v0 ^ v1 ^ v2 ^ v3;
+}
+
+#undef SIPROUND
+
+RandomNumberGenerator::RandomNumberGenerator() {
+  uint8_t seed[SGX_AESGCM_KEY_SIZE + SGX_AESGCM_IV_SIZE];
+  sgx_read_rand(seed, sizeof(seed));
+  rng_ks = new KeySchedule(seed, SGX_AESGCM_KEY_SIZE);
+  cipher = new AesGcm(rng_ks, seed + SGX_AESGCM_KEY_SIZE, SGX_AESGCM_IV_SIZE);
+  memset(seed, 0, sizeof(seed));
+  refill();
+}
+
+RandomNumberGenerator::~RandomNumberGenerator() {
+  delete cipher;
+  delete rng_ks;
+}
+
+void RandomNumberGenerator::refill() {
+  // Encrypting zeros yields the keystream. RNG_BUFFER_SIZE is a multiple of the block size, so
+  // the cipher is never left with a partial block.
+  static const uint8_t zeros[RNG_BUFFER_SIZE] = {0};
+  cipher->encrypt(zeros, RNG_BUFFER_SIZE, buffer, RNG_BUFFER_SIZE);
+  buffer_pos = 0;
+}
+
+uint64_t RandomNumberGenerator::next() {
+  if (buffer_pos + sizeof(uint64_t) > RNG_BUFFER_SIZE) {
+    refill();
+  }
+  uint64_t value;
+  memcpy(&value, buffer + buffer_pos, sizeof(uint64_t));
+  buffer_pos += sizeof(uint64_t);
+  return value;
+}
+
+uint64_t RandomNumberGenerator::uniform(uint64_t bound) {
+  // Reject the values below 2^64 mod bound so that the remaining range is a multiple of bound
+  uint64_t threshold = -bound % bound;
+  uint64_t value;
+  do {
+    value = next();
+  } while (value < threshold);
+  return value % bound;
+}
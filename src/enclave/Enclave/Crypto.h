@@ -93,6 +93,42 @@ class StreamDecipher {
   uint32_t total_cipher_size;
 };
 
+// Number of random bytes that RandomNumberGenerator produces at a time
+#define RNG_BUFFER_SIZE 4096
+
+// A cryptographically secure pseudorandom number generator for enclave code that needs many random
+// values. It is seeded once from sgx_read_rand with a fresh key and IV, then produces an AES-CTR
+// keystream in batches of RNG_BUFFER_SIZE bytes, instead of calling sgx_read_rand per value.
+class RandomNumberGenerator {
+
+ public:
+  RandomNumberGenerator();
+
+  ~RandomNumberGenerator();
+
+  uint64_t next();
+
+  // Return a uniformly distributed integer in [0, bound). bound must be positive.
+  uint64_t uniform(uint64_t bound);
+
+ private:
+  void refill();
+
+  KeySchedule *rng_ks;
+  AesGcm *cipher;
+  uint8_t buffer[RNG_BUFFER_SIZE];
+  uint32_t buffer_pos;
+};
+
+// Derive a key for the given purpose from the global key using AES-CMAC, so that keys used for
+// other purposes reveal nothing about the key used for encryption. Every enclave holding the same
+// global key derives the same key.
+void derive_key(const char *label, sgx_cmac_128bit_key_t *derived_key);
+
+// SipHash-2-4 of the given bytes under the given key. A fast keyed hash for assigning rows to
+// partitions: without the key, the host cannot predict which inputs collide.
+uint64_t siphash(const sgx_cmac_128bit_key_t *hash_key, const uint8_t *data, size_t len);
+
 class MAC {
  public:
   MAC() {
@@ -7,7 +7,9 @@
 #include "Crypto.h"
 #include "Filter.h"
 #include "Join.h"
+#include "Partition.h"
 #include "Project.h"
+#include "Sketch.h"
 #include "Sort.h"
 #include "isv_enclave.h"
 
@@ -47,20 +49,32 @@ void ecall_filter(uint8_t *condition, size_t condition_length,
          output_rows, output_rows_length);
 }
 
-void ecall_sample(uint8_t *input_rows, size_t input_rows_length,
+void ecall_sample(uint8_t *sort_order, size_t sort_order_length,
+                  uint32_t sample_size,
+                  uint8_t *input_rows, size_t input_rows_length,
                   uint8_t **output_rows, size_t *output_rows_length) {
-  sample(input_rows, input_rows_length,
+  sample(sort_order, sort_order_length,
+         sample_size,
+         input_rows, input_rows_length,
          output_rows, output_rows_length);
 }
 
-void ecall_find_range_bounds(uint8_t *sort_order, size_t sort_order_length,
-                             uint32_t num_partitions,
-                             uint8_t *input_rows, size_t input_rows_length,
-                             uint8_t **output_rows, size_t *output_rows_length) {
-  find_range_bounds(sort_order, sort_order_length,
-                    num_partitions,
-                    input_rows, input_rows_length,
-                    output_rows, output_rows_length);
+void ecall_sketch_sort_keys(uint8_t *sort_order, size_t sort_order_length,
+                            uint8_t *input_rows, size_t input_rows_length,
+                            uint8_t **output_rows, size_t *output_rows_length) {
+  sketch_sort_keys(sort_order, sort_order_length,
+                   input_rows, input_rows_length,
+                   output_rows, output_rows_length);
+}
+
+void ecall_find_range_bounds_from_sketches(uint8_t *sort_order, size_t sort_order_length,
+                                           uint32_t num_partitions,
+                                           uint8_t *sketches, size_t sketches_length,
+                                           uint8_t **output_rows, size_t *output_rows_length) {
+  find_range_bounds_from_sketches(sort_order, sort_order_length,
+                                  num_partitions,
+                                  sketches, sketches_length,
+                                  output_rows, output_rows_length);
 }
 
 void ecall_partition_for_sort(uint8_t *sort_order, size_t sort_order_length,
@@ -75,6 +89,16 @@ void ecall_partition_for_sort(uint8_t *sort_order, size_t sort_order_length,
                      output_partitions, output_partition_lengths);
 }
 
+void ecall_hash_partition(uint8_t *partition_expr, size_t partition_expr_length,
+                          uint32_t num_partitions,
+                          uint8_t *input_rows, size_t input_rows_length,
+                          uint8_t **output_partitions, size_t *output_partition_lengths) {
+  hash_partition(partition_expr, partition_expr_length,
+                 num_partitions,
+                 input_rows, input_rows_length,
+                 output_partitions, output_partition_lengths);
+}
+
 void ecall_external_sort(uint8_t *sort_order, size_t sort_order_length,
                          uint8_t *input_rows, size_t input_rows_length,
                          uint8_t **output_rows, size_t *output_rows_length) {
@@ -83,6 +107,58 @@ void ecall_external_sort(uint8_t *sort_order, size_t sort_order_length,
                 output_rows, output_rows_length);
 }
 
+void ecall_external_merge(uint8_t *sort_order, size_t sort_order_length,
+                          uint8_t *input_runs, size_t input_runs_length,
+                          uint8_t **output_rows, size_t *output_rows_length) {
+  external_merge(sort_order, sort_order_length,
+                 input_runs, input_runs_length,
+                 output_rows, output_rows_length);
+}
+
+void ecall_external_sort_chunk(uint8_t *sort_order, size_t sort_order_length,
+                               uint32_t chunk_idx, uint32_t num_chunks,
+                               uint8_t *input_rows, size_t input_rows_length,
+                               uint8_t **output_run, size_t *output_run_length,
+                               uint8_t **output_index, size_t *output_index_length) {
+  external_sort_chunk(sort_order, sort_order_length,
+                      chunk_idx, num_chunks,
+                      input_rows, input_rows_length,
+                      output_run, output_run_length,
+                      output_index, output_index_length);
+}
+
+void ecall_merge_sorted_range(uint8_t *sort_order, size_t sort_order_length,
+                              uint32_t num_runs,
+                              uint8_t **runs, size_t *run_lengths,
+                              uint8_t **run_indexes, size_t *run_index_lengths,
+                              uint32_t range_idx, uint32_t num_ranges,
+                              uint8_t **output_rows, size_t *output_rows_length) {
+  merge_sorted_range(sort_order, sort_order_length,
+                     num_runs,
+                     runs, run_lengths,
+                     run_indexes, run_index_lengths,
+                     range_idx, num_ranges,
+                     output_rows, output_rows_length);
+}
+
+void ecall_oblivious_sort(uint8_t *sort_order, size_t sort_order_length,
+                          uint8_t *input_rows, size_t input_rows_length,
+                          uint8_t **output_rows, size_t *output_rows_length) {
+  oblivious_sort(sort_order, sort_order_length,
+                 input_rows, input_rows_length,
+                 output_rows, output_rows_length);
+}
+
+void ecall_top_k(uint8_t *sort_order, size_t sort_order_length,
+                 uint32_t num_rows,
+                 uint8_t *input_rows, size_t input_rows_length,
+                 uint8_t **output_rows, size_t *output_rows_length) {
+  top_k(sort_order, sort_order_length,
+        num_rows,
+        input_rows, input_rows_length,
+        output_rows, output_rows_length);
+}
+
 void ecall_scan_collect_last_primary(uint8_t *join_expr, size_t join_expr_length,
                                      uint8_t *input_rows, size_t input_rows_length,
                                      uint8_t **output_rows, size_t *output_rows_length) {
@@ -91,14 +167,83 @@ void ecall_scan_collect_last_primary(uint8_t *join_expr, size_t join_expr_length
                             output_rows, output_rows_length);
 }
 
-void ecall_non_oblivious_sort_merge_join(uint8_t *join_expr, size_t join_expr_length,
-                                         uint8_t *input_rows, size_t input_rows_length,
-                                         uint8_t *join_row, size_t join_row_length,
-                                         uint8_t **output_rows, size_t *output_rows_length) {
-  non_oblivious_sort_merge_join(join_expr, join_expr_length,
-                                input_rows, input_rows_length,
-                                join_row, join_row_length,
-                                output_rows, output_rows_length);
+void ecall_scan_collect_first_primary(uint8_t *join_expr, size_t join_expr_length,
+                                      uint8_t *input_rows, size_t input_rows_length,
+                                      uint8_t **output_rows, size_t *output_rows_length) {
+  scan_collect_first_primary(join_expr, join_expr_length,
+                             input_rows, input_rows_length,
+                             output_rows, output_rows_length);
+}
+
+void ecall_non_oblivious_merge_join(uint8_t *join_expr, size_t join_expr_length,
+                                    uint8_t *primary_rows, size_t primary_rows_length,
+                                    uint8_t *foreign_rows, size_t foreign_rows_length,
+                                    uint8_t *prev_primary_row, size_t prev_primary_row_length,
+                                    uint8_t *next_primary_row, size_t next_primary_row_length,
+                                    uint8_t **output_rows, size_t *output_rows_length) {
+  non_oblivious_merge_join(join_expr, join_expr_length,
+                           primary_rows, primary_rows_length,
+                           foreign_rows, foreign_rows_length,
+                           prev_primary_row, prev_primary_row_length,
+                           next_primary_row, next_primary_row_length,
+                           output_rows, output_rows_length);
+}
+
+void ecall_hash_join(uint8_t *join_expr, size_t join_expr_length,
+                     uint8_t *build_rows, size_t build_rows_length,
+                     uint8_t *probe_rows, size_t probe_rows_length,
+                     uint8_t **output_rows, size_t *output_rows_length) {
+  hash_join(join_expr, join_expr_length,
+            build_rows, build_rows_length,
+            probe_rows, probe_rows_length,
+            output_rows, output_rows_length);
+}
+
+void ecall_broadcast_build(uint8_t *join_expr, size_t join_expr_length,
+                           uint8_t *build_rows, size_t build_rows_length,
+                           uint64_t *handle) {
+  *handle = broadcast_build(join_expr, join_expr_length,
+                            build_rows, build_rows_length);
+}
+
+void ecall_broadcast_probe(uint64_t handle,
+                           uint8_t *probe_rows, size_t probe_rows_length,
+                           uint8_t **output_rows, size_t *output_rows_length) {
+  broadcast_probe(handle,
+                  probe_rows, probe_rows_length,
+                  output_rows, output_rows_length);
+}
+
+void ecall_broadcast_release(uint64_t handle) {
+  broadcast_release(handle);
+}
+
+void ecall_build_bloom_filter(uint8_t *join_expr, size_t join_expr_length,
+                              uint32_t num_keys,
+                              uint8_t *input_rows, size_t input_rows_length,
+                              uint8_t **output_filter, size_t *output_filter_length) {
+  build_bloom_filter(join_expr, join_expr_length,
+                     num_keys,
+                     input_rows, input_rows_length,
+                     output_filter, output_filter_length);
+}
+
+void ecall_merge_bloom_filters(uint8_t *filter_a, size_t filter_a_length,
+                               uint8_t *filter_b, size_t filter_b_length,
+                               uint8_t **output_filter, size_t *output_filter_length) {
+  merge_bloom_filters(filter_a, filter_a_length,
+                      filter_b, filter_b_length,
+                      output_filter, output_filter_length);
+}
+
+void ecall_bloom_filter_rows(uint8_t *join_expr, size_t join_expr_length,
+                             uint8_t *filter, size_t filter_length,
+                             uint8_t *input_rows, size_t input_rows_length,
+                             uint8_t **output_rows, size_t *output_rows_length) {
+  bloom_filter_rows(join_expr, join_expr_length,
+                    filter, filter_length,
+                    input_rows, input_rows_length,
+                    output_rows, output_rows_length);
 }
 
 void ecall_non_oblivious_aggregate_step1(
@@ -131,6 +276,30 @@ void ecall_non_oblivious_aggregate_step2(
     output_rows, output_rows_length);
 }
 
+void ecall_hash_aggregate(uint8_t *agg_op, size_t agg_op_length,
+                          uint8_t *input_rows, size_t input_rows_length,
+                          uint8_t **output_rows, size_t *output_rows_length) {
+  hash_aggregate(agg_op, agg_op_length,
+                 input_rows, input_rows_length,
+                 output_rows, output_rows_length);
+}
+
+void ecall_partial_aggregate(uint8_t *agg_op, size_t agg_op_length,
+                             uint8_t *input_rows, size_t input_rows_length,
+                             uint8_t **output_rows, size_t *output_rows_length) {
+  partial_aggregate(agg_op, agg_op_length,
+                    input_rows, input_rows_length,
+                    output_rows, output_rows_length);
+}
+
+void ecall_final_aggregate(uint8_t *agg_op, size_t agg_op_length,
+                           uint8_t *input_rows, size_t input_rows_length,
+                           uint8_t **output_rows, size_t *output_rows_length) {
+  final_aggregate(agg_op, agg_op_length,
+                  input_rows, input_rows_length,
+                  output_rows, output_rows_length);
+}
+
 sgx_status_t ecall_enclave_init_ra(int b_pse, sgx_ra_context_t *p_context) {
   return enclave_init_ra(b_pse, p_context);
 }
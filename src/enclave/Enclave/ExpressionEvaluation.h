@@ -1,6 +1,9 @@
 // -*- c-basic-offset: 2; fill-column: 100 -*-
 
+#include <cstring>
 #include <functional>
+#include <string>
+#include <type_traits>
 #include <typeinfo>
 
 #include "Flatbuffers.h"
@@ -21,159 +24,447 @@ int printf(const char *fmt, ...);
 using namespace edu::berkeley::cs::rise::opaque;
 
 /**
- * Evaluate a binary arithmetic operation on two tuix::Fields. The operation (template parameter
- * Operation) must be a binary function object parameterized on its input type.
+ * Compare two strings lexicographically by their bytes. Return a negative number, zero, or a
+ * positive number if left is less than, equal to, or greater than right.
+ */
+inline int compare_strings(const uint8_t *left, uint32_t left_length,
+                           const uint8_t *right, uint32_t right_length) {
+  uint32_t min_length = std::min(left_length, right_length);
+  if (min_length > 0) {
+    int result = memcmp(left, right, min_length);
+    if (result != 0) {
+      return result;
+    }
+  }
+  if (left_length < right_length) {
+    return -1;
+  } else if (left_length > right_length) {
+    return 1;
+  } else {
+    return 0;
+  }
+}
+
+/** Return true if needle occurs in haystack. */
+inline bool string_contains(const uint8_t *haystack, uint32_t haystack_length,
+                            const uint8_t *needle, uint32_t needle_length) {
+  // TODO: handle Contains(str, "")
+  const uint8_t *last = haystack + haystack_length;
+  return std::find_end(haystack, last, needle, needle + needle_length) != last;
+}
+
+/**
+ * Compute the byte range [start, end) of the SQL substring of a string of the given length.
  *
- * The left and right Fields are the inputs to the binary operation. They may be temporary pointers
- * invalidated by further writes to builder; this function will not read them after invalidating.
+ * Note that the pos argument of SQL substring is 1-indexed. This logic mirrors that of Spark's
+ * common/unsafe/src/main/java/org/apache/spark/unsafe/types/ByteArray.java.
+ */
+inline void substring_bounds(uint32_t str_length, int32_t pos, int32_t len,
+                             int32_t *start_out, int32_t *end_out) {
+  // TODO: oblivious string lengths
+  int32_t start = 0;
+  int32_t end;
+  if (pos > 0) {
+    start = pos - 1;
+  } else if (pos < 0) {
+    start = str_length + pos;
+  }
+  if ((static_cast<int32_t>(str_length) - start) < len) {
+    end = str_length;
+  } else {
+    end = start + len;
+  }
+  start = std::max(start, 0);
+  if (start > end) {
+    start = end;
+  }
+  *start_out = start;
+  *end_out = end;
+}
+
+/**
+ * Division that does not trap: integer division by zero returns zero. Null inputs are stored as
+ * zero, so batch evaluation may divide by zero in rows whose result is null anyway.
+ */
+template<typename T>
+struct safe_divides {
+  T operator()(const T &left, const T &right) const {
+    return (std::is_integral<T>::value && right == 0) ? 0 : left / right;
+  }
+};
+
+/**
+ * Evaluate a binary arithmetic operation on two UnboxedFields, writing the result to result. The
+ * operation (template parameter Operation) must be a binary function object parameterized on its
+ * input type. The operation is not performed if either input is null.
  */
-template<typename TuixExpr, template<typename T> class Operation>
-flatbuffers::Offset<tuix::Field> eval_binary_arithmetic_op(
-  flatbuffers::FlatBufferBuilder &builder,
-  const tuix::Field *left,
-  const tuix::Field *right) {
+template<template<typename T> class Operation>
+void eval_unboxed_arithmetic_op(
+  tuix::ExprUnion expr_type, const UnboxedField &left, const UnboxedField &right,
+  UnboxedField &result) {
 
-  check(left->value_type() == right->value_type(),
+  check(left.type == right.type,
         "%s can't operate on values of different types (%s and %s)\n",
-        typeid(TuixExpr).name(),
-        tuix::EnumNameFieldUnion(left->value_type()),
-        tuix::EnumNameFieldUnion(right->value_type()));
-  bool result_is_null = left->is_null() || right->is_null();
-  switch (left->value_type()) {
+        tuix::EnumNameExprUnion(expr_type),
+        tuix::EnumNameFieldUnion(left.type),
+        tuix::EnumNameFieldUnion(right.type));
+  result.type = left.type;
+  result.is_null = left.is_null || right.is_null;
+  result.long_value = 0;
+  result.string_data = nullptr;
+  result.string_length = 0;
+  switch (left.type) {
   case tuix::FieldUnion_IntegerField:
-  {
-    auto result = Operation<int32_t>()(
-      static_cast<const tuix::IntegerField *>(left->value())->value(),
-      static_cast<const tuix::IntegerField *>(right->value())->value());
-    // Writing the result invalidates the left and right temporary pointers
-    return tuix::CreateField(
-      builder,
-      tuix::FieldUnion_IntegerField,
-      tuix::CreateIntegerField(builder, result).Union(),
-      result_is_null);
-  }
+    if (!result.is_null) {
+      result.int_value = Operation<int32_t>()(left.int_value, right.int_value);
+    }
+    break;
   case tuix::FieldUnion_LongField:
-  {
-    auto result = Operation<int64_t>()(
-      static_cast<const tuix::LongField *>(left->value())->value(),
-      static_cast<const tuix::LongField *>(right->value())->value());
-    // Writing the result invalidates the left and right temporary pointers
-    return tuix::CreateField(
-      builder,
-      tuix::FieldUnion_LongField,
-      tuix::CreateLongField(builder, result).Union(),
-      result_is_null);
-  }
+    if (!result.is_null) {
+      result.long_value = Operation<int64_t>()(left.long_value, right.long_value);
+    }
+    break;
   case tuix::FieldUnion_FloatField:
-  {
-    auto result = Operation<float>()(
-      static_cast<const tuix::FloatField *>(left->value())->value(),
-      static_cast<const tuix::FloatField *>(right->value())->value());
-    // Writing the result invalidates the left and right temporary pointers
-    return tuix::CreateField(
-      builder,
-      tuix::FieldUnion_FloatField,
-      tuix::CreateFloatField(builder, result).Union(),
-      result_is_null);
-  }
+    if (!result.is_null) {
+      result.float_value = Operation<float>()(left.float_value, right.float_value);
+    }
+    break;
   case tuix::FieldUnion_DoubleField:
-  {
-    auto result = Operation<double>()(
-      static_cast<const tuix::DoubleField *>(left->value())->value(),
-      static_cast<const tuix::DoubleField *>(right->value())->value());
-    // Writing the result invalidates the left and right temporary pointers
-    return tuix::CreateField(
-      builder,
-      tuix::FieldUnion_DoubleField,
-      tuix::CreateDoubleField(builder, result).Union(),
-      result_is_null);
-  }
+    if (!result.is_null) {
+      result.double_value = Operation<double>()(left.double_value, right.double_value);
+    }
+    break;
   default:
     printf("Can't evaluate %s on %s\n",
-           typeid(TuixExpr).name(),
-           tuix::EnumNameFieldUnion(left->value_type()));
+           tuix::EnumNameExprUnion(expr_type),
+           tuix::EnumNameFieldUnion(left.type));
     std::exit(1);
-    return flatbuffers::Offset<tuix::Field>();
   }
 }
 
 /**
- * Evaluate a binary number comparison operation on two tuix::Fields. The operation (template
- * parameter Operation) must be a binary function object parameterized on its input type.
- *
- * The left and right Fields are the inputs to the binary operation. They may be temporary pointers
- * invalidated by further writes to builder; this function will not read them after invalidating.
+ * Evaluate a binary comparison operation on two UnboxedFields, writing the BooleanField result to
+ * result. The operation (template parameter Operation) must be a binary function object
+ * parameterized on its input type.
  */
-template<typename TuixExpr, template<typename T> class Operation>
-flatbuffers::Offset<tuix::Field> eval_binary_comparison(
-  flatbuffers::FlatBufferBuilder &builder,
-  const tuix::Field *left,
-  const tuix::Field *right) {
+template<template<typename T> class Operation>
+void eval_unboxed_comparison(
+  tuix::ExprUnion expr_type, const UnboxedField &left, const UnboxedField &right,
+  UnboxedField &result) {
 
-  check(left->value_type() == right->value_type(),
+  check(left.type == right.type,
         "%s can't operate on values of different types (%s and %s)\n",
-        typeid(TuixExpr).name(),
-        tuix::EnumNameFieldUnion(left->value_type()),
-        tuix::EnumNameFieldUnion(right->value_type()));
-  bool result_is_null = left->is_null() || right->is_null();
-  bool result = false;
-  if (!result_is_null) {
-    switch (left->value_type()) {
+        tuix::EnumNameExprUnion(expr_type),
+        tuix::EnumNameFieldUnion(left.type),
+        tuix::EnumNameFieldUnion(right.type));
+  result.type = tuix::FieldUnion_BooleanField;
+  result.is_null = left.is_null || right.is_null;
+  result.long_value = 0;
+  result.string_data = nullptr;
+  result.string_length = 0;
+  if (!result.is_null) {
+    switch (left.type) {
+    case tuix::FieldUnion_BooleanField:
+      result.boolean_value = Operation<int>()(left.boolean_value, right.boolean_value);
+      break;
     case tuix::FieldUnion_IntegerField:
-    {
-      result = Operation<int32_t>()(
-        static_cast<const tuix::IntegerField *>(left->value())->value(),
-        static_cast<const tuix::IntegerField *>(right->value())->value());
+    case tuix::FieldUnion_DateField:
+      result.boolean_value = Operation<int32_t>()(left.int_value, right.int_value);
       break;
-    }
     case tuix::FieldUnion_LongField:
-    {
-      result = Operation<int64_t>()(
-        static_cast<const tuix::LongField *>(left->value())->value(),
-        static_cast<const tuix::LongField *>(right->value())->value());
+      result.boolean_value = Operation<int64_t>()(left.long_value, right.long_value);
       break;
-    }
     case tuix::FieldUnion_FloatField:
-    {
-      result = Operation<float>()(
-        static_cast<const tuix::FloatField *>(left->value())->value(),
-        static_cast<const tuix::FloatField *>(right->value())->value());
+      result.boolean_value = Operation<float>()(left.float_value, right.float_value);
+      break;
+    case tuix::FieldUnion_DoubleField:
+      result.boolean_value = Operation<double>()(left.double_value, right.double_value);
+      break;
+    case tuix::FieldUnion_StringField:
+      result.boolean_value = Operation<int>()(
+        compare_strings(left.string_data, left.string_length,
+                        right.string_data, right.string_length), 0);
       break;
+    default:
+      printf("Can't evaluate %s on %s\n",
+             tuix::EnumNameExprUnion(expr_type),
+             tuix::EnumNameFieldUnion(left.type));
+      std::exit(1);
     }
+  }
+}
+
+/**
+ * A column of values of a single type, produced by evaluating an expression over a block of rows.
+ * Only the value vectors for the column's type are populated. Booleans are stored one per byte so
+ * that logic on them vectorizes. As with UnboxedField, string values point into memory owned by
+ * someone else.
+ */
+struct UnboxedColumn {
+  UnboxedColumn() : type(tuix::FieldUnion_NONE) {}
+
+  uint32_t size() const {
+    return is_null.size();
+  }
+
+  void resize(tuix::FieldUnion type, uint32_t n) {
+    this->type = type;
+    is_null.resize(n);
+    switch (type) {
+    case tuix::FieldUnion_BooleanField:
+      boolean_values.resize(n);
+      break;
+    case tuix::FieldUnion_IntegerField:
+    case tuix::FieldUnion_DateField:
+      int_values.resize(n);
+      break;
+    case tuix::FieldUnion_LongField:
+      long_values.resize(n);
+      break;
+    case tuix::FieldUnion_FloatField:
+      float_values.resize(n);
+      break;
     case tuix::FieldUnion_DoubleField:
-    {
-      result = Operation<double>()(
-        static_cast<const tuix::DoubleField *>(left->value())->value(),
-        static_cast<const tuix::DoubleField *>(right->value())->value());
+      double_values.resize(n);
+      break;
+    case tuix::FieldUnion_StringField:
+      string_data.resize(n);
+      string_lengths.resize(n);
       break;
+    default:
+      printf("UnboxedColumn: Unknown field type %d\n", type);
+      std::exit(1);
     }
+  }
+
+  UnboxedField get(uint32_t i) const {
+    UnboxedField result;
+    result.type = type;
+    result.is_null = is_null[i];
+    result.long_value = 0;
+    result.string_data = nullptr;
+    result.string_length = 0;
+    switch (type) {
+    case tuix::FieldUnion_BooleanField:
+      result.boolean_value = boolean_values[i];
+      break;
+    case tuix::FieldUnion_IntegerField:
+    case tuix::FieldUnion_DateField:
+      result.int_value = int_values[i];
+      break;
+    case tuix::FieldUnion_LongField:
+      result.long_value = long_values[i];
+      break;
+    case tuix::FieldUnion_FloatField:
+      result.float_value = float_values[i];
+      break;
+    case tuix::FieldUnion_DoubleField:
+      result.double_value = double_values[i];
+      break;
     case tuix::FieldUnion_StringField:
-    {
-      auto field1 = static_cast<const tuix::StringField *>(left->value());
-      auto field2 = static_cast<const tuix::StringField *>(right->value());
-      std::string str1(reinterpret_cast<const char *>(field1->value()->data()), field1->length());
-      std::string str2(reinterpret_cast<const char *>(field2->value()->data()), field2->length());
-      result = Operation<std::string>()(str1, str2);
+      result.string_data = string_data[i];
+      result.string_length = string_lengths[i];
+      break;
+    default:
       break;
     }
+    return result;
+  }
+
+  /** Store value at index i. The value must have the column's type. */
+  void set(uint32_t i, const UnboxedField &value) {
+    is_null[i] = value.is_null;
+    switch (type) {
+    case tuix::FieldUnion_BooleanField:
+      boolean_values[i] = value.boolean_value;
+      break;
+    case tuix::FieldUnion_IntegerField:
+    case tuix::FieldUnion_DateField:
+      int_values[i] = value.int_value;
+      break;
+    case tuix::FieldUnion_LongField:
+      long_values[i] = value.long_value;
+      break;
+    case tuix::FieldUnion_FloatField:
+      float_values[i] = value.float_value;
+      break;
+    case tuix::FieldUnion_DoubleField:
+      double_values[i] = value.double_value;
+      break;
+    case tuix::FieldUnion_StringField:
+      string_data[i] = value.string_data;
+      string_lengths[i] = value.string_length;
+      break;
     default:
-      printf("Can't evaluate %s on %s\n",
-             typeid(TuixExpr).name(),
-             tuix::EnumNameFieldUnion(left->value_type()));
-      std::exit(1);
+      break;
     }
   }
-  // Writing the result invalidates the left and right temporary pointers
-  return tuix::CreateField(
-    builder,
-    tuix::FieldUnion_BooleanField,
-    tuix::CreateBooleanField(builder, result).Union(),
-    result_is_null);
+
+  tuix::FieldUnion type;
+  std::vector<uint8_t> is_null;
+  std::vector<uint8_t> boolean_values;
+  std::vector<int32_t> int_values; // Also used for DateField
+  std::vector<int64_t> long_values;
+  std::vector<float> float_values;
+  std::vector<double> double_values;
+  std::vector<const uint8_t *> string_data;
+  std::vector<uint32_t> string_lengths;
+};
+
+/**
+ * Apply a binary function object elementwise to the first n values of left and right. This is the
+ * inner loop of batch evaluation and is written so that the compiler can vectorize it.
+ */
+template<typename T, typename Result, typename Operation>
+void apply_elementwise(const std::vector<T> &left, const std::vector<T> &right,
+                       std::vector<Result> &result, uint32_t n) {
+  Operation op;
+  const T *l = left.data();
+  const T *r = right.data();
+  Result *out = result.data();
+  for (uint32_t i = 0; i < n; i++) {
+    out[i] = op(l[i], r[i]);
+  }
+}
+
+/** Set result's null flags to the union of the null flags of left and right. */
+inline void merge_column_nulls(const UnboxedColumn &left, const UnboxedColumn &right,
+                               UnboxedColumn &result, uint32_t n) {
+  const uint8_t *l = left.is_null.data();
+  const uint8_t *r = right.is_null.data();
+  uint8_t *out = result.is_null.data();
+  for (uint32_t i = 0; i < n; i++) {
+    out[i] = l[i] | r[i];
+  }
+}
+
+/** Batch version of eval_unboxed_arithmetic_op over the first n values of two columns. */
+template<template<typename T> class Operation>
+void eval_column_arithmetic_op(
+  tuix::ExprUnion expr_type, const UnboxedColumn &left, const UnboxedColumn &right,
+  UnboxedColumn &result, uint32_t n) {
+
+  check(left.type == right.type,
+        "%s can't operate on values of different types (%s and %s)\n",
+        tuix::EnumNameExprUnion(expr_type),
+        tuix::EnumNameFieldUnion(left.type),
+        tuix::EnumNameFieldUnion(right.type));
+  switch (left.type) {
+  case tuix::FieldUnion_IntegerField:
+    result.resize(left.type, n);
+    apply_elementwise<int32_t, int32_t, Operation<int32_t>>(
+      left.int_values, right.int_values, result.int_values, n);
+    break;
+  case tuix::FieldUnion_LongField:
+    result.resize(left.type, n);
+    apply_elementwise<int64_t, int64_t, Operation<int64_t>>(
+      left.long_values, right.long_values, result.long_values, n);
+    break;
+  case tuix::FieldUnion_FloatField:
+    result.resize(left.type, n);
+    apply_elementwise<float, float, Operation<float>>(
+      left.float_values, right.float_values, result.float_values, n);
+    break;
+  case tuix::FieldUnion_DoubleField:
+    result.resize(left.type, n);
+    apply_elementwise<double, double, Operation<double>>(
+      left.double_values, right.double_values, result.double_values, n);
+    break;
+  default:
+    printf("Can't evaluate %s on %s\n",
+           tuix::EnumNameExprUnion(expr_type),
+           tuix::EnumNameFieldUnion(left.type));
+    std::exit(1);
+  }
+  merge_column_nulls(left, right, result, n);
+}
+
+/** Batch version of eval_unboxed_comparison over the first n values of two columns. */
+template<template<typename T> class Operation>
+void eval_column_comparison(
+  tuix::ExprUnion expr_type, const UnboxedColumn &left, const UnboxedColumn &right,
+  UnboxedColumn &result, uint32_t n) {
+
+  check(left.type == right.type,
+        "%s can't operate on values of different types (%s and %s)\n",
+        tuix::EnumNameExprUnion(expr_type),
+        tuix::EnumNameFieldUnion(left.type),
+        tuix::EnumNameFieldUnion(right.type));
+  result.resize(tuix::FieldUnion_BooleanField, n);
+  switch (left.type) {
+  case tuix::FieldUnion_BooleanField:
+    apply_elementwise<uint8_t, uint8_t, Operation<int>>(
+      left.boolean_values, right.boolean_values, result.boolean_values, n);
+    break;
+  case tuix::FieldUnion_IntegerField:
+  case tuix::FieldUnion_DateField:
+    apply_elementwise<int32_t, uint8_t, Operation<int32_t>>(
+      left.int_values, right.int_values, result.boolean_values, n);
+    break;
+  case tuix::FieldUnion_LongField:
+    apply_elementwise<int64_t, uint8_t, Operation<int64_t>>(
+      left.long_values, right.long_values, result.boolean_values, n);
+    break;
+  case tuix::FieldUnion_FloatField:
+    apply_elementwise<float, uint8_t, Operation<float>>(
+      left.float_values, right.float_values, result.boolean_values, n);
+    break;
+  case tuix::FieldUnion_DoubleField:
+    apply_elementwise<double, uint8_t, Operation<double>>(
+      left.double_values, right.double_values, result.boolean_values, n);
+    break;
+  case tuix::FieldUnion_StringField:
+  {
+    Operation<int> op;
+    for (uint32_t i = 0; i < n; i++) {
+      result.boolean_values[i] = op(
+        compare_strings(left.string_data[i], left.string_lengths[i],
+                        right.string_data[i], right.string_lengths[i]), 0);
+    }
+    break;
+  }
+  default:
+    printf("Can't evaluate %s on %s\n",
+           tuix::EnumNameExprUnion(expr_type),
+           tuix::EnumNameFieldUnion(left.type));
+    std::exit(1);
+  }
+  merge_column_nulls(left, right, result, n);
+}
+
+/** Elementwise result[i] = take_left[i] ? left[i] : right[i] over the first n values. */
+template<typename T>
+void select_elementwise(const std::vector<uint8_t> &take_left, const std::vector<T> &left,
+                        const std::vector<T> &right, std::vector<T> &result, uint32_t n) {
+  const uint8_t *c = take_left.data();
+  const T *l = left.data();
+  const T *r = right.data();
+  T *out = result.data();
+  for (uint32_t i = 0; i < n; i++) {
+    out[i] = c[i] ? l[i] : r[i];
+  }
 }
 
+/**
+ * Evaluates a tuix::Expr on Rows.
+ *
+ * The expression tree is compiled once, in the constructor, into a flat sequence of instructions
+ * over a file of UnboxedField registers, one register per subexpression. Literals are unboxed into
+ * their registers at compile time. Evaluating a row runs the instruction sequence in a single loop,
+ * without walking the FlatBuffers expression tree or writing intermediate results to a
+ * FlatBufferBuilder. Only the final result is boxed, and only if the caller asks for a tuix::Field.
+ *
+ * The same instructions can also be run over a whole block of rows at a time (eval_batch), in which
+ * case each register holds an UnboxedColumn and each instruction is a loop over the block.
+ */
 class FlatbuffersExpressionEvaluator {
 public:
-  FlatbuffersExpressionEvaluator(const tuix::Expr *expr) : builder(), expr(expr) {}
+  FlatbuffersExpressionEvaluator(const tuix::Expr *expr) : builder() {
+    result_register = compile(expr);
+    string_registers.resize(registers.size());
+    columns.resize(registers.size());
+    string_columns.resize(registers.size());
+  }
 
   /**
    * Evaluate the stored expression on the given row. Return a Field containing the result.
@@ -181,425 +472,802 @@ public:
    * eval is called. Therefore it is only valid until the next call to eval.
    */
   const tuix::Field *eval(const tuix::Row *row) {
+    const UnboxedField &result = eval_unboxed(row);
     builder.Clear();
-    flatbuffers::Offset<tuix::Field> result_offset = eval_helper(row, expr);
-    return flatbuffers::GetTemporaryPointer<tuix::Field>(builder, result_offset);
+    return flatbuffers::GetTemporaryPointer<tuix::Field>(builder, flatbuffers_box(result, builder));
+  }
+
+  /**
+   * Evaluate the stored expression on the given row without boxing the result.
+   * Warning: The result is only valid until the next call to eval or eval_unboxed, and as long as
+   * row is valid, because string results may point into row.
+   */
+  const UnboxedField &eval_unboxed(const tuix::Row *row) {
+    for (const Instruction &instruction : program) {
+      execute(instruction, row);
+    }
+    return registers[result_register];
+  }
+
+  /**
+   * Evaluate the stored expression on every row of the given block at once, running each
+   * instruction over the whole block before moving on to the next. Return the resulting column, or
+   * nullptr if the block is empty or a column referenced by the expression does not have the same
+   * type in every row; in that case the caller should fall back to eval. The result is only valid
+   * until the next call to eval_batch, and as long as rows is valid.
+   */
+  const UnboxedColumn *eval_batch(const tuix::Rows *rows) {
+    uint32_t n = rows->rows()->size();
+    if (n == 0) {
+      return nullptr;
+    }
+    for (uint32_t r : literal_registers) {
+      UnboxedColumn &column = columns[r];
+      if (column.size() < n) {
+        column.resize(registers[r].type, n);
+        for (uint32_t i = 0; i < n; i++) {
+          column.set(i, registers[r]);
+        }
+      }
+    }
+    for (const Instruction &instruction : program) {
+      if (!execute_batch(instruction, rows, n)) {
+        return nullptr;
+      }
+    }
+    return &columns[result_register];
+  }
+
+  /**
+   * Evaluate the stored predicate on every row of the given block and write the indices of the rows
+   * for which it is true (and not null) to selection, in order. Return false under the same
+   * conditions as eval_batch.
+   */
+  bool eval_selection(const tuix::Rows *rows, std::vector<uint32_t> &selection) {
+    const UnboxedColumn *predicate = eval_batch(rows);
+    if (predicate == nullptr) {
+      return false;
+    }
+    check(predicate->type == tuix::FieldUnion_BooleanField,
+          "Predicate returned %s instead of BooleanField\n",
+          tuix::EnumNameFieldUnion(predicate->type));
+
+    uint32_t n = rows->rows()->size();
+    selection.resize(n);
+    uint32_t num_selected = 0;
+    for (uint32_t i = 0; i < n; i++) {
+      selection[num_selected] = i;
+      num_selected += predicate->boolean_values[i] & !predicate->is_null[i];
+    }
+    selection.resize(num_selected);
+    return true;
   }
 
 private:
   /**
-   * Evaluate the given expression on the given row. Return the offset (within builder) of the Field
-   * containing the result. This offset is only valid until the next call to eval.
+   * A single step of a compiled expression. The opcode is the type of the expression node it was
+   * compiled from. For Col, args[0] is the column number, and for Cast, args[1] is the target
+   * ColType. All other arguments are registers holding the values of the node's children.
+   */
+  struct Instruction {
+    tuix::ExprUnion op;
+    uint32_t dst;
+    uint32_t args[3];
+  };
+
+  uint32_t new_register() {
+    registers.push_back(UnboxedField());
+    return registers.size() - 1;
+  }
+
+  uint32_t emit(tuix::ExprUnion op, uint32_t arg0, uint32_t arg1 = 0, uint32_t arg2 = 0) {
+    Instruction instruction;
+    instruction.op = op;
+    instruction.dst = new_register();
+    instruction.args[0] = arg0;
+    instruction.args[1] = arg1;
+    instruction.args[2] = arg2;
+    program.push_back(instruction);
+    return instruction.dst;
+  }
+
+  template<typename TuixExpr>
+  uint32_t compile_binary(const tuix::Expr *expr) {
+    auto e = static_cast<const TuixExpr *>(expr->expr());
+    uint32_t left = compile(e->left());
+    uint32_t right = compile(e->right());
+    return emit(expr->expr_type(), left, right);
+  }
+
+  /**
+   * Append instructions that evaluate the given expression to the program. Return the register
+   * that will hold the result.
    */
-  flatbuffers::Offset<tuix::Field> eval_helper(const tuix::Row *row, const tuix::Expr *expr) {
+  uint32_t compile(const tuix::Expr *expr) {
     switch (expr->expr_type()) {
     case tuix::ExprUnion_Col:
-    {
-      uint32_t col_num = static_cast<const tuix::Col *>(expr->expr())->col_num();
-      return flatbuffers_copy<tuix::Field>(
-        row->field_values()->Get(col_num), builder);
-    }
+      return emit(tuix::ExprUnion_Col, static_cast<const tuix::Col *>(expr->expr())->col_num());
 
     case tuix::ExprUnion_Literal:
     {
-      return flatbuffers_copy<tuix::Field>(
-        static_cast<const tuix::Literal *>(expr->expr())->value(), builder);
+      uint32_t dst = new_register();
+      registers[dst] = unbox(static_cast<const tuix::Literal *>(expr->expr())->value());
+      literal_registers.push_back(dst);
+      return dst;
     }
 
     case tuix::ExprUnion_Cast:
     {
       auto cast = static_cast<const tuix::Cast *>(expr->expr());
-      // Note: This temporary pointer will be invalidated when we next write to builder
-      const tuix::Field *value =
-        flatbuffers::GetTemporaryPointer(builder, eval_helper(row, cast->value()));
-      bool result_is_null = value->is_null();
-      switch (value->value_type()) {
+      uint32_t value = compile(cast->value());
+      return emit(tuix::ExprUnion_Cast, value, cast->target_type());
+    }
+
+    case tuix::ExprUnion_Add:
+      return compile_binary<tuix::Add>(expr);
+    case tuix::ExprUnion_Subtract:
+      return compile_binary<tuix::Subtract>(expr);
+    case tuix::ExprUnion_Multiply:
+      return compile_binary<tuix::Multiply>(expr);
+    case tuix::ExprUnion_Divide:
+      return compile_binary<tuix::Divide>(expr);
+    case tuix::ExprUnion_And:
+      return compile_binary<tuix::And>(expr);
+    case tuix::ExprUnion_Or:
+      return compile_binary<tuix::Or>(expr);
+    case tuix::ExprUnion_LessThan:
+      return compile_binary<tuix::LessThan>(expr);
+    case tuix::ExprUnion_LessThanOrEqual:
+      return compile_binary<tuix::LessThanOrEqual>(expr);
+    case tuix::ExprUnion_GreaterThan:
+      return compile_binary<tuix::GreaterThan>(expr);
+    case tuix::ExprUnion_GreaterThanOrEqual:
+      return compile_binary<tuix::GreaterThanOrEqual>(expr);
+    case tuix::ExprUnion_EqualTo:
+      return compile_binary<tuix::EqualTo>(expr);
+    case tuix::ExprUnion_Contains:
+      return compile_binary<tuix::Contains>(expr);
+
+    case tuix::ExprUnion_Not:
+    {
+      uint32_t child = compile(static_cast<const tuix::Not *>(expr->expr())->child());
+      return emit(tuix::ExprUnion_Not, child);
+    }
+
+    case tuix::ExprUnion_Substring:
+    {
+      auto ss = static_cast<const tuix::Substring *>(expr->expr());
+      uint32_t str = compile(ss->str());
+      uint32_t pos = compile(ss->pos());
+      uint32_t len = compile(ss->len());
+      return emit(tuix::ExprUnion_Substring, str, pos, len);
+    }
+
+    case tuix::ExprUnion_If:
+    {
+      auto e = static_cast<const tuix::If *>(expr->expr());
+      uint32_t predicate = compile(e->predicate());
+      uint32_t true_value = compile(e->true_value());
+      uint32_t false_value = compile(e->false_value());
+      return emit(tuix::ExprUnion_If, predicate, true_value, false_value);
+    }
+
+    case tuix::ExprUnion_IsNull:
+    {
+      uint32_t child = compile(static_cast<const tuix::IsNull *>(expr->expr())->child());
+      return emit(tuix::ExprUnion_IsNull, child);
+    }
+
+    default:
+      printf("Can't evaluate expression of type %s\n",
+             tuix::EnumNameExprUnion(expr->expr_type()));
+      std::exit(1);
+      return 0;
+    }
+  }
+
+  void execute(const Instruction &instruction, const tuix::Row *row) {
+    UnboxedField &result = registers[instruction.dst];
+    switch (instruction.op) {
+    case tuix::ExprUnion_Col:
+      result = unbox(row->field_values()->Get(instruction.args[0]));
+      break;
+
+    case tuix::ExprUnion_Cast:
+    {
+      const UnboxedField &value = registers[instruction.args[0]];
+      tuix::ColType target_type = static_cast<tuix::ColType>(instruction.args[1]);
+      switch (value.type) {
       case tuix::FieldUnion_IntegerField:
-      {
-        return flatbuffers_cast<tuix::IntegerField, int32_t>(cast, value, builder, result_is_null);
-      }
+        eval_cast(value.int_value, value, target_type, instruction.dst);
+        break;
       case tuix::FieldUnion_LongField:
-      {
-        return flatbuffers_cast<tuix::LongField, int64_t>(cast, value, builder, result_is_null);
-      }
+        eval_cast(value.long_value, value, target_type, instruction.dst);
+        break;
       case tuix::FieldUnion_FloatField:
-      {
-        return flatbuffers_cast<tuix::FloatField, float>(cast, value, builder, result_is_null);
-      }
+        eval_cast(value.float_value, value, target_type, instruction.dst);
+        break;
       case tuix::FieldUnion_DoubleField:
-      {
-        return flatbuffers_cast<tuix::DoubleField, double>(cast, value, builder, result_is_null);
-      }
+        eval_cast(value.double_value, value, target_type, instruction.dst);
+        break;
       case tuix::FieldUnion_DateField:
-      {
-        return flatbuffers_cast<tuix::DateField, Date>(cast, value, builder, result_is_null);
-      }
+        eval_cast(Date(value.int_value), value, target_type, instruction.dst);
+        break;
       default:
-      {
         printf("Can't evaluate cast on %s\n",
-               tuix::EnumNameFieldUnion(value->value_type()));
+               tuix::EnumNameFieldUnion(value.type));
         std::exit(1);
-        return flatbuffers::Offset<tuix::Field>();
-      }
       }
+      break;
     }
 
     // Arithmetic
     case tuix::ExprUnion_Add:
+      eval_unboxed_arithmetic_op<std::plus>(
+        instruction.op, registers[instruction.args[0]], registers[instruction.args[1]], result);
+      break;
+    case tuix::ExprUnion_Subtract:
+      eval_unboxed_arithmetic_op<std::minus>(
+        instruction.op, registers[instruction.args[0]], registers[instruction.args[1]], result);
+      break;
+    case tuix::ExprUnion_Multiply:
+      eval_unboxed_arithmetic_op<std::multiplies>(
+        instruction.op, registers[instruction.args[0]], registers[instruction.args[1]], result);
+      break;
+    case tuix::ExprUnion_Divide:
+      eval_unboxed_arithmetic_op<safe_divides>(
+        instruction.op, registers[instruction.args[0]], registers[instruction.args[1]], result);
+      break;
+
+    // Predicates
+    case tuix::ExprUnion_And:
     {
-      auto add = static_cast<const tuix::Add *>(expr->expr());
-      return eval_binary_arithmetic_op<tuix::Add, std::plus>(
-        builder,
-        flatbuffers::GetTemporaryPointer(builder, eval_helper(row, add->left())),
-        flatbuffers::GetTemporaryPointer(builder, eval_helper(row, add->right())));
+      const UnboxedField &left = registers[instruction.args[0]];
+      const UnboxedField &right = registers[instruction.args[1]];
+      check(left.type == tuix::FieldUnion_BooleanField
+            && right.type == tuix::FieldUnion_BooleanField,
+            "And can't operate on %s and %s\n",
+            tuix::EnumNameFieldUnion(left.type),
+            tuix::EnumNameFieldUnion(right.type));
+      bool is_false = (!left.is_null && !left.boolean_value)
+        || (!right.is_null && !right.boolean_value);
+      bool any_null = left.is_null || right.is_null;
+      set_boolean(result, !is_false && !any_null, !is_false && any_null);
+      break;
     }
 
-    case tuix::ExprUnion_Subtract:
+    case tuix::ExprUnion_Or:
     {
-      auto subtract = static_cast<const tuix::Subtract *>(expr->expr());
-      return eval_binary_arithmetic_op<tuix::Subtract, std::minus>(
-        builder,
-        flatbuffers::GetTemporaryPointer(builder, eval_helper(row, subtract->left())),
-        flatbuffers::GetTemporaryPointer(builder, eval_helper(row, subtract->right())));
+      const UnboxedField &left = registers[instruction.args[0]];
+      const UnboxedField &right = registers[instruction.args[1]];
+      check(left.type == tuix::FieldUnion_BooleanField
+            && right.type == tuix::FieldUnion_BooleanField,
+            "Or can't operate on %s and %s\n",
+            tuix::EnumNameFieldUnion(left.type),
+            tuix::EnumNameFieldUnion(right.type));
+      bool is_true = (!left.is_null && left.boolean_value)
+        || (!right.is_null && right.boolean_value);
+      set_boolean(result, is_true, !is_true && (left.is_null || right.is_null));
+      break;
     }
 
-    case tuix::ExprUnion_Multiply:
+    case tuix::ExprUnion_Not:
     {
-      auto multiply = static_cast<const tuix::Multiply *>(expr->expr());
-      return eval_binary_arithmetic_op<tuix::Multiply, std::multiplies>(
-        builder,
-        flatbuffers::GetTemporaryPointer(builder, eval_helper(row, multiply->left())),
-        flatbuffers::GetTemporaryPointer(builder, eval_helper(row, multiply->right())));
+      const UnboxedField &child = registers[instruction.args[0]];
+      check(child.type == tuix::FieldUnion_BooleanField,
+            "Not can't operate on %s\n",
+            tuix::EnumNameFieldUnion(child.type));
+      set_boolean(result, !child.boolean_value, child.is_null);
+      break;
     }
 
-    case tuix::ExprUnion_Divide:
+    case tuix::ExprUnion_LessThan:
+      eval_unboxed_comparison<std::less>(
+        instruction.op, registers[instruction.args[0]], registers[instruction.args[1]], result);
+      break;
+    case tuix::ExprUnion_LessThanOrEqual:
+      eval_unboxed_comparison<std::less_equal>(
+        instruction.op, registers[instruction.args[0]], registers[instruction.args[1]], result);
+      break;
+    case tuix::ExprUnion_GreaterThan:
+      eval_unboxed_comparison<std::greater>(
+        instruction.op, registers[instruction.args[0]], registers[instruction.args[1]], result);
+      break;
+    case tuix::ExprUnion_GreaterThanOrEqual:
+      eval_unboxed_comparison<std::greater_equal>(
+        instruction.op, registers[instruction.args[0]], registers[instruction.args[1]], result);
+      break;
+    case tuix::ExprUnion_EqualTo:
+      eval_unboxed_comparison<std::equal_to>(
+        instruction.op, registers[instruction.args[0]], registers[instruction.args[1]], result);
+      break;
+
+    // String expressions
+    case tuix::ExprUnion_Substring:
     {
-      auto divide = static_cast<const tuix::Divide *>(expr->expr());
-      return eval_binary_arithmetic_op<tuix::Divide, std::divides>(
-        builder,
-        flatbuffers::GetTemporaryPointer(builder, eval_helper(row, divide->left())),
-        flatbuffers::GetTemporaryPointer(builder, eval_helper(row, divide->right())));
+      const UnboxedField &str = registers[instruction.args[0]];
+      const UnboxedField &pos = registers[instruction.args[1]];
+      const UnboxedField &len = registers[instruction.args[2]];
+      check(str.type == tuix::FieldUnion_StringField &&
+            pos.type == tuix::FieldUnion_IntegerField &&
+            len.type == tuix::FieldUnion_IntegerField,
+            "tuix::Substring requires str String, pos Integer, len Integer, not "
+            "str %s, pos %s, len %s)\n",
+            tuix::EnumNameFieldUnion(str.type),
+            tuix::EnumNameFieldUnion(pos.type),
+            tuix::EnumNameFieldUnion(len.type));
+      result.type = tuix::FieldUnion_StringField;
+      result.is_null = str.is_null || pos.is_null || len.is_null;
+      result.string_data = nullptr;
+      result.string_length = 0;
+      if (!result.is_null) {
+        int32_t start, end;
+        substring_bounds(str.string_length, pos.int_value, len.int_value, &start, &end);
+        // The substring shares its bytes with str
+        result.string_data = str.string_data + start;
+        result.string_length = static_cast<uint32_t>(end - start);
+      }
+      break;
     }
 
-    // Predicates
-    case tuix::ExprUnion_And:
+    case tuix::ExprUnion_Contains:
     {
-      auto a = static_cast<const tuix::And *>(expr->expr());
-      auto left = flatbuffers::GetTemporaryPointer(builder, eval_helper(row, a->left()));
-      auto right = flatbuffers::GetTemporaryPointer(builder, eval_helper(row, a->right()));
-
-      check(left->value_type() == tuix::FieldUnion_BooleanField
-            && right->value_type() == tuix::FieldUnion_BooleanField,
-            "And can't operate on %s and %s\n",
-            tuix::EnumNameFieldUnion(left->value_type()),
-            tuix::EnumNameFieldUnion(right->value_type()));
-
-      bool result = false, result_is_null = false;
-      bool left_value = static_cast<const tuix::BooleanField *>(left->value())->value();
-      if (!left->is_null() && !left_value) {
-        result = false;
-      } else {
-        bool right_value = static_cast<const tuix::BooleanField *>(right->value())->value();
-        if (!right->is_null() && !right_value) {
-          result = false;
-        } else {
-          if (!left->is_null() && !right->is_null()) {
-            result = true;
-          } else {
-            result_is_null = true;
-          }
-        }
+      const UnboxedField &left = registers[instruction.args[0]];
+      const UnboxedField &right = registers[instruction.args[1]];
+      check(left.type == tuix::FieldUnion_StringField &&
+            right.type == tuix::FieldUnion_StringField,
+            "tuix::Contains requires left String, right String, not "
+            "left %s, right %s\n",
+            tuix::EnumNameFieldUnion(left.type),
+            tuix::EnumNameFieldUnion(right.type));
+      bool contains = false, result_is_null = left.is_null || right.is_null;
+      if (!result_is_null) {
+        contains = string_contains(left.string_data, left.string_length,
+                                   right.string_data, right.string_length);
       }
-
-      // Writing the result invalidates the left and right temporary pointers
-      return tuix::CreateField(
-        builder,
-        tuix::FieldUnion_BooleanField,
-        tuix::CreateBooleanField(builder, result).Union(),
-        result_is_null);
+      set_boolean(result, contains, result_is_null);
+      break;
     }
 
-    case tuix::ExprUnion_Or:
+    // Conditional expressions
+    case tuix::ExprUnion_If:
     {
-      auto o = static_cast<const tuix::Or *>(expr->expr());
-      auto left = flatbuffers::GetTemporaryPointer(builder, eval_helper(row, o->left()));
-      auto right = flatbuffers::GetTemporaryPointer(builder, eval_helper(row, o->right()));
-
-      check(left->value_type() == tuix::FieldUnion_BooleanField
-            && right->value_type() == tuix::FieldUnion_BooleanField,
-            "Or can't operate on %s and %s\n",
-            tuix::EnumNameFieldUnion(left->value_type()),
-            tuix::EnumNameFieldUnion(right->value_type()));
-
-      bool result = false, result_is_null = false;
-      bool left_value = static_cast<const tuix::BooleanField *>(left->value())->value();
-      if (!left->is_null() && left_value) {
-        result = true;
+      const UnboxedField &predicate = registers[instruction.args[0]];
+      const UnboxedField &true_value = registers[instruction.args[1]];
+      const UnboxedField &false_value = registers[instruction.args[2]];
+      check(predicate.type == tuix::FieldUnion_BooleanField,
+            "tuix::If requires predicate to return Boolean, not %s\n",
+            tuix::EnumNameFieldUnion(predicate.type));
+      check(true_value.type == false_value.type,
+            "tuix::If requires true and false types to be the same, but %s != %s\n",
+            tuix::EnumNameFieldUnion(true_value.type),
+            tuix::EnumNameFieldUnion(false_value.type));
+      if (!predicate.is_null) {
+        result = predicate.boolean_value ? true_value : false_value;
       } else {
-        bool right_value = static_cast<const tuix::BooleanField *>(right->value())->value();
-        if (!right->is_null() && right_value) {
-          result = true;
-        } else {
-          if (!left->is_null() && !right->is_null()) {
-            result = false;
-          } else {
-            result_is_null = true;
-          }
-        }
+        result = true_value;
+        result.is_null = true;
       }
-
-      // Writing the result invalidates the left and right temporary pointers
-      return tuix::CreateField(
-        builder,
-        tuix::FieldUnion_BooleanField,
-        tuix::CreateBooleanField(builder, result).Union(),
-        result_is_null);
+      break;
     }
 
-    case tuix::ExprUnion_Not:
-    {
-      auto n = static_cast<const tuix::Not *>(expr->expr());
-      auto child = flatbuffers::GetTemporaryPointer(builder, eval_helper(row, n->child()));
-
-      check(child->value_type() == tuix::FieldUnion_BooleanField,
-            "Not can't operate on %s\n",
-            tuix::EnumNameFieldUnion(child->value_type()));
-
-      bool child_value = static_cast<const tuix::BooleanField *>(child->value())->value();
-      bool result = !child_value, result_is_null = child->is_null();
+    // Null expressions
+    case tuix::ExprUnion_IsNull:
+      set_boolean(result, registers[instruction.args[0]].is_null, false);
+      break;
 
-      // Writing the result invalidates the child temporary pointer
-      return tuix::CreateField(
-        builder,
-        tuix::FieldUnion_BooleanField,
-        tuix::CreateBooleanField(builder, result).Union(),
-        result_is_null);
+    default:
+      printf("Can't evaluate expression of type %s\n",
+             tuix::EnumNameExprUnion(instruction.op));
+      std::exit(1);
     }
+  }
 
-    case tuix::ExprUnion_LessThan:
+  /**
+   * Run the given instruction over the first n rows, writing its result column. Return false if the
+   * instruction reads a column whose type is not the same in every row.
+   */
+  bool execute_batch(const Instruction &instruction, const tuix::Rows *rows, uint32_t n) {
+    UnboxedColumn &result = columns[instruction.dst];
+    switch (instruction.op) {
+    case tuix::ExprUnion_Col:
     {
-      auto lt = static_cast<const tuix::LessThan *>(expr->expr());
-      return eval_binary_comparison<tuix::LessThan, std::less>(
-        builder,
-        flatbuffers::GetTemporaryPointer(builder, eval_helper(row, lt->left())),
-        flatbuffers::GetTemporaryPointer(builder, eval_helper(row, lt->right())));
+      uint32_t col_num = instruction.args[0];
+      tuix::FieldUnion type = rows->rows()->Get(0)->field_values()->Get(col_num)->value_type();
+      result.resize(type, n);
+      for (uint32_t i = 0; i < n; i++) {
+        const tuix::Field *field = rows->rows()->Get(i)->field_values()->Get(col_num);
+        if (field->value_type() != type) {
+          return false;
+        }
+        result.set(i, unbox(field));
+      }
+      break;
     }
 
-    case tuix::ExprUnion_LessThanOrEqual:
+    case tuix::ExprUnion_Cast:
     {
-      auto le = static_cast<const tuix::LessThanOrEqual *>(expr->expr());
-      return eval_binary_comparison<tuix::LessThanOrEqual, std::less_equal>(
-        builder,
-        flatbuffers::GetTemporaryPointer(builder, eval_helper(row, le->left())),
-        flatbuffers::GetTemporaryPointer(builder, eval_helper(row, le->right())));
+      const UnboxedColumn &value = columns[instruction.args[0]];
+      tuix::ColType target_type = static_cast<tuix::ColType>(instruction.args[1]);
+      switch (value.type) {
+      case tuix::FieldUnion_IntegerField:
+        eval_column_cast<int32_t>(value.int_values, value, target_type, instruction.dst, n);
+        break;
+      case tuix::FieldUnion_LongField:
+        eval_column_cast<int64_t>(value.long_values, value, target_type, instruction.dst, n);
+        break;
+      case tuix::FieldUnion_FloatField:
+        eval_column_cast<float>(value.float_values, value, target_type, instruction.dst, n);
+        break;
+      case tuix::FieldUnion_DoubleField:
+        eval_column_cast<double>(value.double_values, value, target_type, instruction.dst, n);
+        break;
+      case tuix::FieldUnion_DateField:
+        eval_column_cast<Date>(value.int_values, value, target_type, instruction.dst, n);
+        break;
+      default:
+        printf("Can't evaluate cast on %s\n",
+               tuix::EnumNameFieldUnion(value.type));
+        std::exit(1);
+      }
+      break;
     }
 
-    case tuix::ExprUnion_GreaterThan:
+    // Arithmetic
+    case tuix::ExprUnion_Add:
+      eval_column_arithmetic_op<std::plus>(
+        instruction.op, columns[instruction.args[0]], columns[instruction.args[1]], result, n);
+      break;
+    case tuix::ExprUnion_Subtract:
+      eval_column_arithmetic_op<std::minus>(
+        instruction.op, columns[instruction.args[0]], columns[instruction.args[1]], result, n);
+      break;
+    case tuix::ExprUnion_Multiply:
+      eval_column_arithmetic_op<std::multiplies>(
+        instruction.op, columns[instruction.args[0]], columns[instruction.args[1]], result, n);
+      break;
+    case tuix::ExprUnion_Divide:
+      eval_column_arithmetic_op<safe_divides>(
+        instruction.op, columns[instruction.args[0]], columns[instruction.args[1]], result, n);
+      break;
+
+    // Predicates
+    case tuix::ExprUnion_And:
     {
-      auto gt = static_cast<const tuix::GreaterThan *>(expr->expr());
-      return eval_binary_comparison<tuix::GreaterThan, std::greater>(
-        builder,
-        flatbuffers::GetTemporaryPointer(builder, eval_helper(row, gt->left())),
-        flatbuffers::GetTemporaryPointer(builder, eval_helper(row, gt->right())));
+      const UnboxedColumn &left = columns[instruction.args[0]];
+      const UnboxedColumn &right = columns[instruction.args[1]];
+      check(left.type == tuix::FieldUnion_BooleanField
+            && right.type == tuix::FieldUnion_BooleanField,
+            "And can't operate on %s and %s\n",
+            tuix::EnumNameFieldUnion(left.type),
+            tuix::EnumNameFieldUnion(right.type));
+      result.resize(tuix::FieldUnion_BooleanField, n);
+      for (uint32_t i = 0; i < n; i++) {
+        bool is_false = (!left.is_null[i] && !left.boolean_values[i])
+          || (!right.is_null[i] && !right.boolean_values[i]);
+        bool any_null = left.is_null[i] || right.is_null[i];
+        result.boolean_values[i] = !is_false && !any_null;
+        result.is_null[i] = !is_false && any_null;
+      }
+      break;
     }
 
-    case tuix::ExprUnion_GreaterThanOrEqual:
+    case tuix::ExprUnion_Or:
     {
-      auto ge = static_cast<const tuix::GreaterThanOrEqual *>(expr->expr());
-      return eval_binary_comparison<tuix::GreaterThanOrEqual, std::greater_equal>(
-        builder,
-        flatbuffers::GetTemporaryPointer(builder, eval_helper(row, ge->left())),
-        flatbuffers::GetTemporaryPointer(builder, eval_helper(row, ge->right())));
+      const UnboxedColumn &left = columns[instruction.args[0]];
+      const UnboxedColumn &right = columns[instruction.args[1]];
+      check(left.type == tuix::FieldUnion_BooleanField
+            && right.type == tuix::FieldUnion_BooleanField,
+            "Or can't operate on %s and %s\n",
+            tuix::EnumNameFieldUnion(left.type),
+            tuix::EnumNameFieldUnion(right.type));
+      result.resize(tuix::FieldUnion_BooleanField, n);
+      for (uint32_t i = 0; i < n; i++) {
+        bool is_true = (!left.is_null[i] && left.boolean_values[i])
+          || (!right.is_null[i] && right.boolean_values[i]);
+        bool any_null = left.is_null[i] || right.is_null[i];
+        result.boolean_values[i] = is_true;
+        result.is_null[i] = !is_true && any_null;
+      }
+      break;
     }
 
-    case tuix::ExprUnion_EqualTo:
+    case tuix::ExprUnion_Not:
     {
-      auto eq = static_cast<const tuix::EqualTo *>(expr->expr());
-      return eval_binary_comparison<tuix::EqualTo, std::equal_to>(
-        builder,
-        flatbuffers::GetTemporaryPointer(builder, eval_helper(row, eq->left())),
-        flatbuffers::GetTemporaryPointer(builder, eval_helper(row, eq->right())));
+      const UnboxedColumn &child = columns[instruction.args[0]];
+      check(child.type == tuix::FieldUnion_BooleanField,
+            "Not can't operate on %s\n",
+            tuix::EnumNameFieldUnion(child.type));
+      result.resize(tuix::FieldUnion_BooleanField, n);
+      for (uint32_t i = 0; i < n; i++) {
+        result.boolean_values[i] = !child.boolean_values[i];
+        result.is_null[i] = child.is_null[i];
+      }
+      break;
     }
 
+    case tuix::ExprUnion_LessThan:
+      eval_column_comparison<std::less>(
+        instruction.op, columns[instruction.args[0]], columns[instruction.args[1]], result, n);
+      break;
+    case tuix::ExprUnion_LessThanOrEqual:
+      eval_column_comparison<std::less_equal>(
+        instruction.op, columns[instruction.args[0]], columns[instruction.args[1]], result, n);
+      break;
+    case tuix::ExprUnion_GreaterThan:
+      eval_column_comparison<std::greater>(
+        instruction.op, columns[instruction.args[0]], columns[instruction.args[1]], result, n);
+      break;
+    case tuix::ExprUnion_GreaterThanOrEqual:
+      eval_column_comparison<std::greater_equal>(
+        instruction.op, columns[instruction.args[0]], columns[instruction.args[1]], result, n);
+      break;
+    case tuix::ExprUnion_EqualTo:
+      eval_column_comparison<std::equal_to>(
+        instruction.op, columns[instruction.args[0]], columns[instruction.args[1]], result, n);
+      break;
+
     // String expressions
     case tuix::ExprUnion_Substring:
     {
-      auto ss = static_cast<const tuix::Substring *>(expr->expr());
-      // Note: These temporary pointers will be invalidated when we next write to builder
-      const tuix::Field *str =
-        flatbuffers::GetTemporaryPointer(builder, eval_helper(row, ss->str()));
-      const tuix::Field *pos =
-        flatbuffers::GetTemporaryPointer(builder, eval_helper(row, ss->pos()));
-      const tuix::Field *len =
-        flatbuffers::GetTemporaryPointer(builder, eval_helper(row, ss->len()));
-      check(str->value_type() == tuix::FieldUnion_StringField &&
-            pos->value_type() == tuix::FieldUnion_IntegerField &&
-            len->value_type() == tuix::FieldUnion_IntegerField,
+      const UnboxedColumn &str = columns[instruction.args[0]];
+      const UnboxedColumn &pos = columns[instruction.args[1]];
+      const UnboxedColumn &len = columns[instruction.args[2]];
+      check(str.type == tuix::FieldUnion_StringField &&
+            pos.type == tuix::FieldUnion_IntegerField &&
+            len.type == tuix::FieldUnion_IntegerField,
             "tuix::Substring requires str String, pos Integer, len Integer, not "
             "str %s, pos %s, len %s)\n",
-            tuix::EnumNameFieldUnion(str->value_type()),
-            tuix::EnumNameFieldUnion(pos->value_type()),
-            tuix::EnumNameFieldUnion(len->value_type()));
-      bool result_is_null = str->is_null() || pos->is_null() || len->is_null();
-      if (!result_is_null) {
-        auto str_field = static_cast<const tuix::StringField *>(str->value());
-        auto pos_val = static_cast<const tuix::IntegerField *>(pos->value())->value();
-        auto len_val = static_cast<const tuix::IntegerField *>(len->value())->value();
-
-        // Note that the pos argument of SQL substring is 1-indexed. This logic mirrors that of
-        // Spark's common/unsafe/src/main/java/org/apache/spark/unsafe/types/ByteArray.java.
-        // TODO: oblivious string lengths
-        int32_t start = 0;
-        int32_t end;
-        if (pos_val > 0) {
-          start = pos_val - 1;
-        } else if (pos_val < 0) {
-          start = str_field->length() + pos_val;
-        }
-        if ((static_cast<int32_t>(str_field->length()) - start) < len_val) {
-          end = str_field->length();
+            tuix::EnumNameFieldUnion(str.type),
+            tuix::EnumNameFieldUnion(pos.type),
+            tuix::EnumNameFieldUnion(len.type));
+      result.resize(tuix::FieldUnion_StringField, n);
+      for (uint32_t i = 0; i < n; i++) {
+        result.is_null[i] = str.is_null[i] || pos.is_null[i] || len.is_null[i];
+        if (!result.is_null[i]) {
+          int32_t start, end;
+          substring_bounds(str.string_lengths[i], pos.int_values[i], len.int_values[i],
+                           &start, &end);
+          result.string_data[i] = str.string_data[i] + start;
+          result.string_lengths[i] = static_cast<uint32_t>(end - start);
         } else {
-          end = start + len_val;
+          result.string_data[i] = nullptr;
+          result.string_lengths[i] = 0;
         }
-        start = std::max(start, 0);
-        if (start > end) {
-          start = end;
-        }
-        std::vector<uint8_t> substring(
-          flatbuffers::VectorIterator<uint8_t, uint8_t>(str_field->value()->Data(),
-                                                        static_cast<uint32_t>(start)),
-          flatbuffers::VectorIterator<uint8_t, uint8_t>(str_field->value()->Data(),
-                                                        static_cast<uint32_t>(end)));
-        // Writing the result invalidates the str, pos, len temporary pointers
-        return tuix::CreateField(
-          builder,
-          tuix::FieldUnion_StringField,
-          tuix::CreateStringFieldDirect(
-            builder, &substring, static_cast<uint32_t>(end - start)).Union(),
-          result_is_null);
-      } else {
-        // Writing the result invalidates the str, pos, len temporary pointers
-        // TODO: oblivious string lengths
-        return tuix::CreateField(
-          builder,
-          tuix::FieldUnion_StringField,
-          tuix::CreateStringFieldDirect(builder, nullptr, 0).Union(),
-          result_is_null);
       }
+      break;
     }
 
     case tuix::ExprUnion_Contains:
     {
-      auto c = static_cast<const tuix::Contains *>(expr->expr());
-
-      // TODO: handle Contains(str, "")
-
-      // Note: These temporary pointers will be invalidated when we next write to builder
-      const tuix::Field *left =
-        flatbuffers::GetTemporaryPointer(builder, eval_helper(row, c->left()));
-      const tuix::Field *right =
-        flatbuffers::GetTemporaryPointer(builder, eval_helper(row, c->right()));
-
-      check(left->value_type() == tuix::FieldUnion_StringField &&
-            right->value_type() == tuix::FieldUnion_StringField &&
-            "tuix::Contains requires left String, right String, not"
+      const UnboxedColumn &left = columns[instruction.args[0]];
+      const UnboxedColumn &right = columns[instruction.args[1]];
+      check(left.type == tuix::FieldUnion_StringField &&
+            right.type == tuix::FieldUnion_StringField,
+            "tuix::Contains requires left String, right String, not "
             "left %s, right %s\n",
-            tuix::EnumNameFieldUnion(left->value_type()),
-            tuix::EnumNameFieldUnion(right->value_type()));
-      bool result_is_null = left->is_null() || right->is_null();
-      if (!result_is_null) {
-        auto left_field = static_cast<const tuix::StringField *>(left->value());
-        auto right_field = static_cast<const tuix::StringField *>(right->value());
-        auto last = flatbuffers::VectorIterator<uint8_t, uint8_t>(left_field->value()->Data(), left_field->length());
-        auto it = std::find_end(
-          flatbuffers::VectorIterator<uint8_t, uint8_t>(left_field->value()->Data(), 0),
-          last,
-          flatbuffers::VectorIterator<uint8_t, uint8_t>(right_field->value()->Data(), 0),
-          flatbuffers::VectorIterator<uint8_t, uint8_t>(right_field->value()->Data(), right_field->length()));
-        bool result = (it != last);
-        return tuix::CreateField(
-          builder,
-          tuix::FieldUnion_BooleanField,
-          tuix::CreateBooleanField(builder, result).Union(),
-          false);
-      } else {
-        return tuix::CreateField(
-          builder,
-          tuix::FieldUnion_BooleanField,
-          tuix::CreateBooleanField(builder, false).Union(),
-          true);
+            tuix::EnumNameFieldUnion(left.type),
+            tuix::EnumNameFieldUnion(right.type));
+      result.resize(tuix::FieldUnion_BooleanField, n);
+      for (uint32_t i = 0; i < n; i++) {
+        result.is_null[i] = left.is_null[i] || right.is_null[i];
+        result.boolean_values[i] = !result.is_null[i]
+          && string_contains(left.string_data[i], left.string_lengths[i],
+                             right.string_data[i], right.string_lengths[i]);
       }
+      break;
     }
 
     // Conditional expressions
     case tuix::ExprUnion_If:
     {
-      auto e = static_cast<const tuix::If *>(expr->expr());
-      // Note: These temporary pointers will be invalidated when we next write to builder
-      const tuix::Field *predicate =
-        flatbuffers::GetTemporaryPointer(builder, eval_helper(row, e->predicate()));
-      const tuix::Field *true_value =
-        flatbuffers::GetTemporaryPointer(builder, eval_helper(row, e->true_value()));
-      const tuix::Field *false_value =
-        flatbuffers::GetTemporaryPointer(builder, eval_helper(row, e->false_value()));
-      check(predicate->value_type() == tuix::FieldUnion_BooleanField,
+      const UnboxedColumn &predicate = columns[instruction.args[0]];
+      const UnboxedColumn &true_value = columns[instruction.args[1]];
+      const UnboxedColumn &false_value = columns[instruction.args[2]];
+      check(predicate.type == tuix::FieldUnion_BooleanField,
             "tuix::If requires predicate to return Boolean, not %s\n",
-            tuix::EnumNameFieldUnion(predicate->value_type()));
-      check(true_value->value_type() == false_value->value_type(),
+            tuix::EnumNameFieldUnion(predicate.type));
+      check(true_value.type == false_value.type,
             "tuix::If requires true and false types to be the same, but %s != %s\n",
-            tuix::EnumNameFieldUnion(true_value->value_type()),
-            tuix::EnumNameFieldUnion(false_value->value_type()));
-      if (!predicate->is_null()) {
-        bool pred_val = static_cast<const tuix::BooleanField *>(predicate->value())->value();
-        if (pred_val) {
-          return GetOffset<tuix::Field>(builder, true_value);
-        } else {
-          return GetOffset<tuix::Field>(builder, false_value);
-        }
-      } else {
-        // Writing the result invalidates the predicate, true_value, false_value temporary pointers
-        // TODO: this is therefore unsafe
-        return flatbuffers_copy<tuix::Field>(true_value, builder, true);
+            tuix::EnumNameFieldUnion(true_value.type),
+            tuix::EnumNameFieldUnion(false_value.type));
+      // A null predicate selects the true value's type with a null result
+      take_true.resize(n);
+      for (uint32_t i = 0; i < n; i++) {
+        take_true[i] = predicate.is_null[i] | predicate.boolean_values[i];
+      }
+      result.resize(true_value.type, n);
+      switch (true_value.type) {
+      case tuix::FieldUnion_BooleanField:
+        select_elementwise(take_true, true_value.boolean_values, false_value.boolean_values,
+                           result.boolean_values, n);
+        break;
+      case tuix::FieldUnion_IntegerField:
+      case tuix::FieldUnion_DateField:
+        select_elementwise(take_true, true_value.int_values, false_value.int_values,
+                           result.int_values, n);
+        break;
+      case tuix::FieldUnion_LongField:
+        select_elementwise(take_true, true_value.long_values, false_value.long_values,
+                           result.long_values, n);
+        break;
+      case tuix::FieldUnion_FloatField:
+        select_elementwise(take_true, true_value.float_values, false_value.float_values,
+                           result.float_values, n);
+        break;
+      case tuix::FieldUnion_DoubleField:
+        select_elementwise(take_true, true_value.double_values, false_value.double_values,
+                           result.double_values, n);
+        break;
+      case tuix::FieldUnion_StringField:
+        select_elementwise(take_true, true_value.string_data, false_value.string_data,
+                           result.string_data, n);
+        select_elementwise(take_true, true_value.string_lengths, false_value.string_lengths,
+                           result.string_lengths, n);
+        break;
+      default:
+        break;
+      }
+      select_elementwise(take_true, true_value.is_null, false_value.is_null, result.is_null, n);
+      for (uint32_t i = 0; i < n; i++) {
+        result.is_null[i] |= predicate.is_null[i];
       }
+      break;
     }
 
     // Null expressions
     case tuix::ExprUnion_IsNull:
     {
-      auto e = static_cast<const tuix::IsNull *>(expr->expr());
-      // Note: This temporary pointer will be invalidated when we next write to builder
-      const tuix::Field *child =
-        flatbuffers::GetTemporaryPointer(builder, eval_helper(row, e->child()));
-      bool result = child->is_null();
-      return tuix::CreateField(
-        builder,
-        tuix::FieldUnion_BooleanField,
-        tuix::CreateBooleanField(builder, result).Union(),
-        false);
+      const UnboxedColumn &child = columns[instruction.args[0]];
+      result.resize(tuix::FieldUnion_BooleanField, n);
+      for (uint32_t i = 0; i < n; i++) {
+        result.boolean_values[i] = child.is_null[i];
+        result.is_null[i] = false;
+      }
+      break;
     }
 
     default:
       printf("Can't evaluate expression of type %s\n",
-             tuix::EnumNameExprUnion(expr->expr_type()));
+             tuix::EnumNameExprUnion(instruction.op));
+      std::exit(1);
+    }
+    return true;
+  }
+
+  /**
+   * Batch version of eval_cast. values holds the first n values of the column value, stored as
+   * StorageType and interpreted as InputType.
+   */
+  template<typename InputType, typename StorageType>
+  void eval_column_cast(const std::vector<StorageType> &values, const UnboxedColumn &value,
+                        tuix::ColType target_type, uint32_t dst, uint32_t n) {
+    UnboxedColumn &result = columns[dst];
+    switch (target_type) {
+    case tuix::ColType_IntegerType:
+      result.resize(tuix::FieldUnion_IntegerField, n);
+      for (uint32_t i = 0; i < n; i++) {
+        result.int_values[i] = static_cast<int32_t>(InputType(values[i]));
+      }
+      break;
+    case tuix::ColType_LongType:
+      result.resize(tuix::FieldUnion_LongField, n);
+      for (uint32_t i = 0; i < n; i++) {
+        result.long_values[i] = static_cast<int64_t>(InputType(values[i]));
+      }
+      break;
+    case tuix::ColType_FloatType:
+      result.resize(tuix::FieldUnion_FloatField, n);
+      for (uint32_t i = 0; i < n; i++) {
+        result.float_values[i] = static_cast<float>(InputType(values[i]));
+      }
+      break;
+    case tuix::ColType_DoubleType:
+      result.resize(tuix::FieldUnion_DoubleField, n);
+      for (uint32_t i = 0; i < n; i++) {
+        result.double_values[i] = static_cast<double>(InputType(values[i]));
+      }
+      break;
+    case tuix::ColType_StringType:
+    {
+      using std::to_string;
+      std::vector<std::string> &strs = string_columns[dst];
+      strs.resize(n);
+      result.resize(tuix::FieldUnion_StringField, n);
+      for (uint32_t i = 0; i < n; i++) {
+        strs[i] = to_string(InputType(values[i]));
+        result.string_data[i] = reinterpret_cast<const uint8_t *>(strs[i].data());
+        result.string_lengths[i] = strs[i].size();
+      }
+      break;
+    }
+    default:
+      printf("Can't cast %s to %s\n",
+             tuix::EnumNameFieldUnion(value.type), tuix::EnumNameColType(target_type));
+      std::exit(1);
+    }
+    std::copy(value.is_null.begin(), value.is_null.begin() + n, result.is_null.begin());
+  }
+
+  static void set_boolean(UnboxedField &result, bool value, bool is_null) {
+    result.type = tuix::FieldUnion_BooleanField;
+    result.is_null = is_null;
+    result.long_value = 0;
+    result.boolean_value = value;
+    result.string_data = nullptr;
+    result.string_length = 0;
+  }
+
+  /**
+   * Cast value_eval, the value of the UnboxedField value, to target_type and store the result in
+   * the given register. Strings produced by the cast are owned by the register.
+   */
+  template<typename InputType>
+  void eval_cast(InputType value_eval, const UnboxedField &value, tuix::ColType target_type,
+                 uint32_t dst) {
+    UnboxedField &result = registers[dst];
+    result.is_null = value.is_null;
+    result.long_value = 0;
+    result.string_data = nullptr;
+    result.string_length = 0;
+    switch (target_type) {
+    case tuix::ColType_IntegerType:
+      result.type = tuix::FieldUnion_IntegerField;
+      result.int_value = static_cast<int32_t>(value_eval);
+      break;
+    case tuix::ColType_LongType:
+      result.type = tuix::FieldUnion_LongField;
+      result.long_value = static_cast<int64_t>(value_eval);
+      break;
+    case tuix::ColType_FloatType:
+      result.type = tuix::FieldUnion_FloatField;
+      result.float_value = static_cast<float>(value_eval);
+      break;
+    case tuix::ColType_DoubleType:
+      result.type = tuix::FieldUnion_DoubleField;
+      result.double_value = static_cast<double>(value_eval);
+      break;
+    case tuix::ColType_StringType:
+    {
+      using std::to_string;
+      std::string &str = string_registers[dst];
+      str = to_string(value_eval);
+      result.type = tuix::FieldUnion_StringField;
+      result.string_data = reinterpret_cast<const uint8_t *>(str.data());
+      result.string_length = str.size();
+      break;
+    }
+    default:
+      printf("Can't cast %s to %s\n",
+             tuix::EnumNameFieldUnion(value.type), tuix::EnumNameColType(target_type));
       std::exit(1);
-      return flatbuffers::Offset<tuix::Field>();
     }
   }
 
   flatbuffers::FlatBufferBuilder builder;
-  const tuix::Expr *expr;
+  std::vector<Instruction> program;
+  std::vector<UnboxedField> registers;
+  // Backing storage for string values computed by casts, indexed by register
+  std::vector<std::string> string_registers;
+  std::vector<uint32_t> literal_registers;
+  uint32_t result_register;
+
+  // Registers for batch evaluation, indexed like registers
+  std::vector<UnboxedColumn> columns;
+  std::vector<std::vector<std::string>> string_columns;
+  std::vector<uint8_t> take_true;
 };
 
+/**
+ * Evaluates a tuix::SortExpr on Rows. Each row's sort key can be computed once into a normalized
+ * byte string (see append_normalized_key) so that rows can then be ordered by comparing keys
+ * rather than by re-evaluating the sort expressions on every comparison.
+ */
 class FlatbuffersSortOrderEvaluator {
 public:
   FlatbuffersSortOrderEvaluator(const tuix::SortExpr *sort_expr)
-    : sort_expr(sort_expr), builder() {
-    for (auto sort_order_it = sort_expr->sort_order()->begin();
-         sort_order_it != sort_expr->sort_order()->end(); ++sort_order_it) {
-      sort_order_evaluators.emplace_back(
-        std::unique_ptr<FlatbuffersExpressionEvaluator>(
-          new FlatbuffersExpressionEvaluator(sort_order_it->child())));
-    }
+    : sort_expr(sort_expr) {
+    init();
   }
 
   FlatbuffersSortOrderEvaluator(uint8_t *buf, size_t len) {
@@ -607,76 +1275,118 @@ public:
     check(v.VerifyBuffer<tuix::SortExpr>(nullptr),
           "Corrupt SortExpr %p of length %d\n", buf, len);
     sort_expr = flatbuffers::GetRoot<tuix::SortExpr>(buf);
+    init();
+  }
+
+  /** Append the normalized sort key of the given row to key. */
+  void append_key(const tuix::Row *row, std::vector<uint8_t> &key) {
+    for (uint32_t i = 0; i < sort_order_evaluators.size(); i++) {
+      append_normalized_key(sort_order_evaluators[i]->eval_unboxed(row), descending[i], key);
+    }
+  }
+
+  /**
+   * Evaluate the sort expressions on the given row, producing the fields of its key row. Only valid
+   * until the next call, and as long as row is valid.
+   */
+  const std::vector<UnboxedField> &eval_key_fields(const tuix::Row *row) {
+    key_fields.resize(sort_order_evaluators.size());
+    for (uint32_t i = 0; i < sort_order_evaluators.size(); i++) {
+      key_fields[i] = sort_order_evaluators[i]->eval_unboxed(row);
+    }
+    return key_fields;
+  }
+
+  /**
+   * Append the normalized sort key of the given key row to key. A key row holds the values of the
+   * sort expressions, as produced by eval_key_fields, and may have trailing fields that are not
+   * part of the key.
+   */
+  void append_key_row_key(const tuix::Row *key_row, std::vector<uint8_t> &key) {
+    check(key_row->field_values()->size() >= descending.size(),
+          "Key row has %d fields but the sort order has %d\n",
+          key_row->field_values()->size(), descending.size());
+    for (uint32_t i = 0; i < descending.size(); i++) {
+      append_normalized_key(unbox(key_row->field_values()->Get(i)), descending[i], key);
+    }
+  }
+
+  uint32_t num_key_fields() {
+    return descending.size();
+  }
+
+  bool less_than(const tuix::Row *row1, const tuix::Row *row2) {
+    key1.clear();
+    append_key(row1, key1);
+    key2.clear();
+    append_key(row2, key2);
+    return compare_strings(key1.data(), key1.size(), key2.data(), key2.size()) < 0;
+  }
 
+private:
+  void init() {
     for (auto sort_order_it = sort_expr->sort_order()->begin();
          sort_order_it != sort_expr->sort_order()->end(); ++sort_order_it) {
       sort_order_evaluators.emplace_back(
         std::unique_ptr<FlatbuffersExpressionEvaluator>(
           new FlatbuffersExpressionEvaluator(sort_order_it->child())));
+      descending.push_back(sort_order_it->direction() == tuix::SortDirection_Descending);
     }
   }
 
-  bool less_than(const tuix::Row *row1, const tuix::Row *row2) {
-    builder.Clear();
-    const tuix::Row *a = nullptr, *b = nullptr;
-    for (uint32_t i = 0; i < sort_order_evaluators.size(); i++) {
-      switch (sort_expr->sort_order()->Get(i)->direction()) {
-      case tuix::SortDirection_Ascending:
-        a = row1;
-        b = row2;
-        break;
-      case tuix::SortDirection_Descending:
-        a = row2;
-        b = row1;
-        break;
-      }
+  const tuix::SortExpr *sort_expr;
+  std::vector<std::unique_ptr<FlatbuffersExpressionEvaluator>> sort_order_evaluators;
+  std::vector<bool> descending;
+  std::vector<uint8_t> key1, key2;
+  std::vector<UnboxedField> key_fields;
+};
 
-      const tuix::Field *a_eval_tmp = sort_order_evaluators[i]->eval(a);
-      const tuix::Field *a_eval = flatbuffers::GetTemporaryPointer<tuix::Field>(
-        builder, flatbuffers_copy(a_eval_tmp, builder));
-      const tuix::Field *b_eval_tmp = sort_order_evaluators[i]->eval(b);
-      const tuix::Field *b_eval = flatbuffers::GetTemporaryPointer<tuix::Field>(
-        builder, flatbuffers_copy(b_eval_tmp, builder));
+/**
+ * A row together with its normalized sort key, ordered by the key. The first 8 bytes of the key
+ * are cached as a big-endian integer so that most comparisons are a single integer comparison.
+ */
+struct SortPointer {
+  SortPointer() : row(nullptr), key_prefix(0), key(nullptr), key_length(0) {}
 
-      bool a_less_than_b =
-        static_cast<const tuix::BooleanField *>(
-          flatbuffers::GetTemporaryPointer<tuix::Field>(
-            builder,
-            eval_binary_comparison<tuix::LessThan, std::less>(
-              builder, a_eval, b_eval))
-          ->value())->value();
-      bool b_less_than_a =
-        static_cast<const tuix::BooleanField *>(
-          flatbuffers::GetTemporaryPointer<tuix::Field>(
-            builder,
-            eval_binary_comparison<tuix::LessThan, std::less>(
-              builder, b_eval, a_eval))
-          ->value())->value();
+  SortPointer(const tuix::Row *row, const uint8_t *key, uint32_t key_length)
+    : row(row), key_prefix(0), key(key), key_length(key_length) {
+    for (uint32_t i = 0; i < 8; i++) {
+      key_prefix = (key_prefix << 8) | (i < key_length ? key[i] : 0);
+    }
+  }
 
-      if (a_less_than_b) {
-        return true;
-      } else if (b_less_than_a) {
-        return false;
-      }
+  /** Return a negative number, zero, or a positive number as this key is less than, equal to, or
+   * greater than other's. */
+  int compare(const SortPointer &other) const {
+    if (key_prefix != other.key_prefix) {
+      return key_prefix < other.key_prefix ? -1 : 1;
     }
-    return false;
+    return compare_strings(key, key_length, other.key, other.key_length);
   }
 
-private:
-  const tuix::SortExpr *sort_expr;
-  flatbuffers::FlatBufferBuilder builder;
-  std::vector<std::unique_ptr<FlatbuffersExpressionEvaluator>> sort_order_evaluators;
+  bool operator<(const SortPointer &other) const {
+    return compare(other) < 0;
+  }
+
+  const tuix::Row *row;
+  uint64_t key_prefix;
+  const uint8_t *key;
+  uint32_t key_length;
 };
 
 class FlatbuffersJoinExprEvaluator {
 public:
-  FlatbuffersJoinExprEvaluator(uint8_t *buf, size_t len)
-    : builder() {
+  FlatbuffersJoinExprEvaluator(uint8_t *buf, size_t len) {
     flatbuffers::Verifier v(buf, len);
     check(v.VerifyBuffer<tuix::JoinExpr>(nullptr),
           "Corrupt JoinExpr %p of length %d\n", buf, len);
 
     const tuix::JoinExpr* join_expr = flatbuffers::GetRoot<tuix::JoinExpr>(buf);
+    join_type = join_expr->join_type();
+    left_null_row = join_expr->left_null_row();
+    right_null_row = join_expr->right_null_row();
+    output_columns = join_expr->output_columns();
+    memory_budget = join_expr->memory_budget();
 
     check(join_expr->left_keys()->size() == join_expr->right_keys()->size(),
           "Mismatched join key lengths\n");
@@ -694,6 +1404,30 @@ public:
     }
   }
 
+  tuix::JoinType get_join_type() {
+    return join_type;
+  }
+
+  /** Return a row of nulls with the types of the primary table, or nullptr if there is none. */
+  const tuix::Row *get_left_null_row() {
+    return left_null_row;
+  }
+
+  /** Return a row of nulls with the types of the foreign table, or nullptr if there is none. */
+  const tuix::Row *get_right_null_row() {
+    return right_null_row;
+  }
+
+  /** Return the indices of the output columns, or nullptr if all columns are output. */
+  const flatbuffers::Vector<uint32_t> *get_output_columns() {
+    return output_columns;
+  }
+
+  /** Return the memory budget requested by the JoinExpr, or 0 for the default. */
+  uint64_t get_memory_budget() {
+    return memory_budget;
+  }
+
   /**
    * Return true if the given row is from the primary table, indicated by its first field, which
    * must be an IntegerField.
@@ -703,44 +1437,59 @@ public:
       row->field_values()->Get(0)->value())->value() == 0;
   }
 
-  /** Return true if the two rows are from the same join group. */
-  bool is_same_group(const tuix::Row *row1, const tuix::Row *row2) {
-    auto &row1_evaluators = is_primary(row1) ? left_key_evaluators : right_key_evaluators;
-    auto &row2_evaluators = is_primary(row2) ? left_key_evaluators : right_key_evaluators;
+  /**
+   * Append the normalized values of the join keys of the given row (the left keys for a row from
+   * the primary table, otherwise the right keys) to key, so that two rows are in the same join
+   * group exactly when their keys are equal. Return false if any join key is null, in which case
+   * the row does not join with any row.
+   */
+  bool append_join_key(const tuix::Row *row, std::vector<uint8_t> &key) {
+    return append_join_key(row, is_primary(row), key);
+  }
 
-    builder.Clear();
-    for (uint32_t i = 0; i < row1_evaluators.size(); i++) {
-      const tuix::Field *row1_eval_tmp = row1_evaluators[i]->eval(row1);
-      const tuix::Field *row1_eval = flatbuffers::GetTemporaryPointer<tuix::Field>(
-        builder, flatbuffers_copy(row1_eval_tmp, builder));
-      const tuix::Field *row2_eval_tmp = row2_evaluators[i]->eval(row2);
-      const tuix::Field *row2_eval = flatbuffers::GetTemporaryPointer<tuix::Field>(
-        builder, flatbuffers_copy(row2_eval_tmp, builder));
-
-      bool row1_equals_row2 =
-        static_cast<const tuix::BooleanField *>(
-          flatbuffers::GetTemporaryPointer<tuix::Field>(
-            builder,
-            eval_binary_comparison<tuix::EqualTo, std::equal_to>(
-              builder, row1_eval, row2_eval))
-          ->value())->value();
-
-      if (!row1_equals_row2) {
-        return false;
-      }
+  /**
+   * Like append_join_key, but for a row known to be from the primary table if primary is true and
+   * from the foreign table otherwise, regardless of its tag. Keys of rows from the same table are
+   * ordered like their join key values in ascending order.
+   */
+  bool append_join_key(const tuix::Row *row, bool primary, std::vector<uint8_t> &key) {
+    auto &evaluators = primary ? left_key_evaluators : right_key_evaluators;
+    bool has_null = false;
+    for (auto &evaluator : evaluators) {
+      const UnboxedField &value = evaluator->eval_unboxed(row);
+      has_null |= value.is_null;
+      append_normalized_key(value, false, key);
     }
-    return true;
+    return !has_null;
+  }
+
+  /**
+   * Return true if the two rows are from the same join group, comparing their keys as
+   * append_join_key does. A row with a null join key is in no join group.
+   */
+  bool is_same_group(const tuix::Row *row1, const tuix::Row *row2) {
+    key1.clear();
+    key2.clear();
+    return append_join_key(row1, key1) && append_join_key(row2, key2) && key1 == key2;
   }
 
 private:
-  flatbuffers::FlatBufferBuilder builder;
+  tuix::JoinType join_type;
+  const tuix::Row *left_null_row;
+  const tuix::Row *right_null_row;
+  const flatbuffers::Vector<uint32_t> *output_columns;
+  uint64_t memory_budget;
   std::vector<std::unique_ptr<FlatbuffersExpressionEvaluator>> left_key_evaluators;
   std::vector<std::unique_ptr<FlatbuffersExpressionEvaluator>> right_key_evaluators;
+  // Scratch space for is_same_group
+  std::vector<uint8_t> key1;
+  std::vector<uint8_t> key2;
 };
 
 class AggregateExpressionEvaluator {
 public:
-  AggregateExpressionEvaluator(const tuix::AggregateExpr *expr) : builder() {
+  AggregateExpressionEvaluator(const tuix::AggregateExpr *expr)
+    : builder(), kind(expr->kind()) {
     for (auto initial_value_expr : *expr->initial_values()) {
       initial_value_evaluators.emplace_back(
         std::unique_ptr<FlatbuffersExpressionEvaluator>(
@@ -752,6 +1501,141 @@ public:
           new FlatbuffersExpressionEvaluator(update_expr)));
     }
     evaluate_evaluator.reset(new FlatbuffersExpressionEvaluator(expr->evaluate_expr()));
+    if (expr->input_exprs() != nullptr) {
+      for (auto input_expr : *expr->input_exprs()) {
+        input_evaluators.emplace_back(
+          std::unique_ptr<FlatbuffersExpressionEvaluator>(
+            new FlatbuffersExpressionEvaluator(input_expr)));
+      }
+    }
+    if (input_evaluators.empty()) {
+      kind = tuix::AggregateKind_Generic;
+    }
+  }
+
+  /** Return the kind of aggregate, or Generic if it can only be computed by the expressions. */
+  tuix::AggregateKind get_kind() {
+    return kind;
+  }
+
+  uint32_t num_fields() {
+    return initial_value_evaluators.size();
+  }
+
+  /**
+   * Fold the given row into the partial aggregate state[0, num_fields()) natively. Only valid if
+   * get_kind() is not Generic. Use store to write a field of the state, so that the caller can keep
+   * its own copy of string values.
+   */
+  template<typename Store>
+  void native_update(const UnboxedField *state, const tuix::Row *row, Store store) {
+    UnboxedField tmp;
+    switch (kind) {
+    case tuix::AggregateKind_Average:
+    {
+      const UnboxedField &value = input_evaluators[0]->eval_unboxed(row);
+      if (!value.is_null) {
+        eval_unboxed_arithmetic_op<std::plus>(tuix::ExprUnion_Add, state[0], value, tmp);
+        store(0, tmp);
+        tmp = state[1];
+        tmp.long_value++;
+        store(1, tmp);
+      }
+      break;
+    }
+    case tuix::AggregateKind_Count:
+    {
+      bool has_null = false;
+      for (auto &evaluator : input_evaluators) {
+        has_null |= evaluator->eval_unboxed(row).is_null;
+      }
+      if (!has_null) {
+        tmp = state[0];
+        tmp.long_value++;
+        store(0, tmp);
+      }
+      break;
+    }
+    case tuix::AggregateKind_First:
+      if (!state[1].boolean_value) {
+        store(0, input_evaluators[0]->eval_unboxed(row));
+        tmp = state[1];
+        tmp.boolean_value = true;
+        store(1, tmp);
+      }
+      break;
+    case tuix::AggregateKind_Last:
+    {
+      store(0, input_evaluators[0]->eval_unboxed(row));
+      tmp = state[1];
+      tmp.boolean_value = true;
+      store(1, tmp);
+      break;
+    }
+    case tuix::AggregateKind_Max:
+    case tuix::AggregateKind_Min:
+    case tuix::AggregateKind_Sum:
+      fold_value(state, input_evaluators[0]->eval_unboxed(row), store);
+      break;
+    default:
+      check(false, "Can't natively aggregate %s\n", tuix::EnumNameAggregateKind(kind));
+    }
+  }
+
+  /**
+   * Merge the partial aggregate other[0, num_fields()), computed from other rows of the same group,
+   * into state[0, num_fields()). Only valid if get_kind() is not Generic.
+   */
+  template<typename Store>
+  void native_merge(const UnboxedField *state, const UnboxedField *other, Store store) {
+    UnboxedField tmp;
+    switch (kind) {
+    case tuix::AggregateKind_Average:
+      if (other[1].long_value > 0) {
+        eval_unboxed_arithmetic_op<std::plus>(tuix::ExprUnion_Add, state[0], other[0], tmp);
+        store(0, tmp);
+        eval_unboxed_arithmetic_op<std::plus>(tuix::ExprUnion_Add, state[1], other[1], tmp);
+        store(1, tmp);
+      }
+      break;
+    case tuix::AggregateKind_Count:
+      eval_unboxed_arithmetic_op<std::plus>(tuix::ExprUnion_Add, state[0], other[0], tmp);
+      store(0, tmp);
+      break;
+    case tuix::AggregateKind_First:
+      if (!state[1].boolean_value && other[1].boolean_value) {
+        store(0, other[0]);
+        store(1, other[1]);
+      }
+      break;
+    case tuix::AggregateKind_Last:
+      if (other[1].boolean_value) {
+        store(0, other[0]);
+        store(1, other[1]);
+      }
+      break;
+    case tuix::AggregateKind_Max:
+    case tuix::AggregateKind_Min:
+    case tuix::AggregateKind_Sum:
+      fold_value(state, other[0], store);
+      break;
+    default:
+      check(false, "Can't natively merge %s\n", tuix::EnumNameAggregateKind(kind));
+    }
+  }
+
+  /** Return the result of the aggregate for the given partial aggregate state, natively. */
+  UnboxedField native_evaluate(const UnboxedField *state) {
+    if (kind != tuix::AggregateKind_Average) {
+      return state[0];
+    }
+    UnboxedField result;
+    result.type = tuix::FieldUnion_DoubleField;
+    result.is_null = state[1].long_value == 0;
+    result.double_value = result.is_null ? 0.0 : state[0].double_value / state[1].long_value;
+    result.string_data = nullptr;
+    result.string_length = 0;
+    return result;
   }
 
   std::vector<const tuix::Field *> initial_values(const tuix::Row *unused) {
@@ -779,17 +1663,58 @@ private:
   std::vector<std::unique_ptr<FlatbuffersExpressionEvaluator>> initial_value_evaluators;
   std::vector<std::unique_ptr<FlatbuffersExpressionEvaluator>> update_evaluators;
   std::unique_ptr<FlatbuffersExpressionEvaluator> evaluate_evaluator;
+  std::vector<std::unique_ptr<FlatbuffersExpressionEvaluator>> input_evaluators;
+  tuix::AggregateKind kind;
+
+  /** Fold a single value into the state of a Max, Min or Sum. Null values are skipped. */
+  template<typename Store>
+  void fold_value(const UnboxedField *state, const UnboxedField &value, Store store) {
+    if (value.is_null) {
+      return;
+    }
+    // The state starts out null, and stays null until the first non-null value
+    if (state[0].is_null) {
+      store(0, value);
+      return;
+    }
+    UnboxedField tmp;
+    switch (kind) {
+    case tuix::AggregateKind_Max:
+      eval_unboxed_comparison<std::greater>(tuix::ExprUnion_GreaterThan, value, state[0], tmp);
+      if (tmp.boolean_value) {
+        store(0, value);
+      }
+      break;
+    case tuix::AggregateKind_Min:
+      eval_unboxed_comparison<std::less>(tuix::ExprUnion_LessThan, value, state[0], tmp);
+      if (tmp.boolean_value) {
+        store(0, value);
+      }
+      break;
+    default:
+      eval_unboxed_arithmetic_op<std::plus>(tuix::ExprUnion_Add, state[0], value, tmp);
+      store(0, tmp);
+    }
+  }
 };
 
+/**
+ * Evaluates a tuix::AggregateOp one group at a time. If every aggregate is of a kind that
+ * AggregateExpressionEvaluator can compute natively, the partial aggregate is kept unboxed and
+ * each input row is folded into it directly. Otherwise the partial aggregate is kept as a Row, and
+ * each input row is concatenated to it and passed through the update expressions.
+ */
 class FlatbuffersAggOpEvaluator {
 public:
   FlatbuffersAggOpEvaluator(uint8_t *buf, size_t len)
-    : a(nullptr), builder(), builder2() {
+    : a(nullptr), builder(), builder2(), memory_budget(0), native(false), initial_builder(),
+      initial_row(nullptr) {
     flatbuffers::Verifier v(buf, len);
     check(v.VerifyBuffer<tuix::AggregateOp>(nullptr),
           "Corrupt AggregateOp %p of length %d\n", buf, len);
 
     const tuix::AggregateOp* agg_op = flatbuffers::GetRoot<tuix::AggregateOp>(buf);
+    memory_budget = agg_op->memory_budget();
 
     for (auto e : *agg_op->grouping_expressions()) {
       grouping_evaluators.emplace_back(
@@ -802,10 +1727,42 @@ public:
           new AggregateExpressionEvaluator(e)));
     }
 
+    native = !aggregate_evaluators.empty();
+    for (auto&& e : aggregate_evaluators) {
+      native &= e->get_kind() != tuix::AggregateKind_Generic;
+    }
+    if (native) {
+      // Evaluate the initial values once
+      std::vector<flatbuffers::Offset<tuix::Field>> init_fields;
+      for (auto&& e : aggregate_evaluators) {
+        state_offsets.push_back(init_fields.size());
+        for (auto f : e->initial_values(nullptr)) {
+          init_fields.push_back(flatbuffers_copy<tuix::Field>(f, initial_builder));
+        }
+      }
+      initial_row = flatbuffers::GetTemporaryPointer<tuix::Row>(
+        initial_builder, tuix::CreateRowDirect(initial_builder, &init_fields));
+      state.resize(init_fields.size());
+      state_strings.resize(init_fields.size());
+    }
+
     reset_group();
   }
 
   void reset_group() {
+    // The native and generic paths keep partial aggregates with the same fields but different
+    // contents: a native Sum starts out null rather than zero, and a native Count skips null
+    // inputs. Partial aggregates from one path must never be set on or merged by the other.
+    if (native) {
+      load(initial_row);
+      for (uint32_t i = 0; i < aggregate_evaluators.size(); i++) {
+        if (aggregate_evaluators[i]->get_kind() == tuix::AggregateKind_Sum) {
+          state[state_offsets[i]].is_null = true;
+        }
+      }
+      return;
+    }
+
     builder2.Clear();
     // Write initial values to a
     std::vector<flatbuffers::Offset<tuix::Field>> init_fields;
@@ -819,6 +1776,15 @@ public:
   }
 
   void set(const tuix::Row *agg_row) {
+    if (native) {
+      if (agg_row) {
+        load(agg_row);
+      } else {
+        reset_group();
+      }
+      return;
+    }
+
     builder2.Clear();
     if (agg_row) {
       a = flatbuffers::GetTemporaryPointer<tuix::Row>(
@@ -829,6 +1795,16 @@ public:
   }
 
   void aggregate(const tuix::Row *row) {
+    if (native) {
+      for (uint32_t i = 0; i < aggregate_evaluators.size(); i++) {
+        uint32_t offset = state_offsets[i];
+        aggregate_evaluators[i]->native_update(
+          &state[offset], row,
+          [this, offset](uint32_t j, const UnboxedField &value) { store(offset + j, value); });
+      }
+      return;
+    }
+
     builder.Clear();
     flatbuffers::Offset<tuix::Row> concat;
 
@@ -856,47 +1832,131 @@ public:
   }
 
   const tuix::Row *get_partial_agg() {
+    if (native) {
+      builder2.Clear();
+      std::vector<flatbuffers::Offset<tuix::Field>> fields;
+      for (const UnboxedField &value : state) {
+        fields.push_back(flatbuffers_box(value, builder2));
+      }
+      a = flatbuffers::GetTemporaryPointer<tuix::Row>(
+        builder2, tuix::CreateRowDirect(builder2, &fields));
+    }
     return a;
   }
 
   const tuix::Row *evaluate() {
     builder.Clear();
     std::vector<flatbuffers::Offset<tuix::Field>> output_fields;
-    for (auto&& e : aggregate_evaluators) {
-      output_fields.push_back(flatbuffers_copy<tuix::Field>(e->evaluate(a), builder));
+    for (uint32_t i = 0; i < aggregate_evaluators.size(); i++) {
+      auto &e = aggregate_evaluators[i];
+      output_fields.push_back(
+        native
+        ? flatbuffers_box(e->native_evaluate(&state[state_offsets[i]]), builder)
+        : flatbuffers_copy<tuix::Field>(e->evaluate(a), builder));
     }
     return flatbuffers::GetTemporaryPointer<tuix::Row>(
       builder,
       tuix::CreateRowDirect(builder, &output_fields));
   }
 
-  /** Return true if the two rows are from the same join group. */
-  bool is_same_group(const tuix::Row *row1, const tuix::Row *row2) {
+  /** Return the memory budget requested by the AggregateOp, or 0 for the default. */
+  uint64_t get_memory_budget() {
+    return memory_budget;
+  }
+
+  /**
+   * Append the normalized values of the grouping expressions for the given row to key, so that two
+   * rows are in the same group exactly when their keys are equal.
+   */
+  void append_group_key(const tuix::Row *row, std::vector<uint8_t> &key) {
+    for (auto &evaluator : grouping_evaluators) {
+      append_normalized_key(evaluator->eval_unboxed(row), false, key);
+    }
+  }
+
+  /**
+   * Return the values of the grouping expressions for the given input row. The returned pointer is
+   * only valid until the next call to this evaluator.
+   */
+  const tuix::Row *get_group(const tuix::Row *row) {
     builder.Clear();
-    for (auto it = grouping_evaluators.begin(); it != grouping_evaluators.end(); ++it) {
-      const tuix::Field *row1_eval_tmp = (*it)->eval(row1);
-      const tuix::Field *row1_eval = flatbuffers::GetTemporaryPointer<tuix::Field>(
-        builder, flatbuffers_copy(row1_eval_tmp, builder));
-      const tuix::Field *row2_eval_tmp = (*it)->eval(row2);
-      const tuix::Field *row2_eval = flatbuffers::GetTemporaryPointer<tuix::Field>(
-        builder, flatbuffers_copy(row2_eval_tmp, builder));
-
-      bool row1_equals_row2 =
-        static_cast<const tuix::BooleanField *>(
-          flatbuffers::GetTemporaryPointer<tuix::Field>(
-            builder,
-            eval_binary_comparison<tuix::EqualTo, std::equal_to>(
-              builder, row1_eval, row2_eval))
-          ->value())->value();
-
-      if (!row1_equals_row2) {
-        return false;
-      }
+    std::vector<flatbuffers::Offset<tuix::Field>> group_fields;
+    for (auto &evaluator : grouping_evaluators) {
+      group_fields.push_back(flatbuffers_copy<tuix::Field>(evaluator->eval(row), builder));
     }
-    return true;
+    return flatbuffers::GetTemporaryPointer<tuix::Row>(
+      builder, tuix::CreateRowDirect(builder, &group_fields));
+  }
+
+  /**
+   * Like append_group_key, but for a partial row: the values of the grouping expressions followed
+   * by a partial aggregate, as written by partial_aggregate.
+   */
+  void append_partial_group_key(const tuix::Row *partial_row, std::vector<uint8_t> &key) {
+    for (uint32_t i = 0; i < grouping_evaluators.size(); i++) {
+      append_normalized_key(unbox(partial_row->field_values()->Get(i)), false, key);
+    }
+  }
+
+  /**
+   * Merge the partial aggregate of the given partial row into the current group. Only supported if
+   * every aggregate can be computed natively.
+   */
+  void merge(const tuix::Row *partial_row) {
+    check(native, "Can't merge partial aggregates of generic aggregate expressions\n");
+    uint32_t num_grouping_fields = grouping_evaluators.size();
+    check(partial_row->field_values()->size() == num_grouping_fields + state.size(),
+          "Partial row has %d fields, expected %d\n",
+          partial_row->field_values()->size(), num_grouping_fields + state.size());
+    other_state.clear();
+    for (uint32_t i = 0; i < state.size(); i++) {
+      other_state.push_back(unbox(partial_row->field_values()->Get(num_grouping_fields + i)));
+    }
+    for (uint32_t i = 0; i < aggregate_evaluators.size(); i++) {
+      uint32_t offset = state_offsets[i];
+      aggregate_evaluators[i]->native_merge(
+        &state[offset], &other_state[offset],
+        [this, offset](uint32_t j, const UnboxedField &value) { store(offset + j, value); });
+    }
+  }
+
+  /**
+   * Return true if the two rows are in the same group, comparing their keys as append_group_key
+   * does, so that rows whose grouping expressions are all null or equal group together.
+   */
+  bool is_same_group(const tuix::Row *row1, const tuix::Row *row2) {
+    key1.clear();
+    key2.clear();
+    append_group_key(row1, key1);
+    append_group_key(row2, key2);
+    return key1 == key2;
   }
 
 private:
+  /** Unbox the fields of the given partial aggregate into state. */
+  void load(const tuix::Row *agg_row) {
+    check(agg_row->field_values()->size() == state.size(),
+          "Partial aggregate has %d fields, expected %d\n",
+          agg_row->field_values()->size(), state.size());
+    for (uint32_t i = 0; i < state.size(); i++) {
+      store(i, unbox(agg_row->field_values()->Get(i)));
+    }
+  }
+
+  /** Set a field of state, copying string values so that they outlive the row they came from. */
+  void store(uint32_t i, const UnboxedField &value) {
+    state[i] = value;
+    if (value.is_null) {
+      // A null string may still point into its row, which is boxed later
+      state[i].string_data = nullptr;
+      state[i].string_length = 0;
+    } else if (value.type == tuix::FieldUnion_StringField
+               && value.string_data != state_strings[i].data()) {
+      state_strings[i].assign(value.string_data, value.string_data + value.string_length);
+      state[i].string_data = state_strings[i].data();
+    }
+  }
+
   // Pointer into builder2
   const tuix::Row *a;
 
@@ -904,6 +1964,20 @@ private:
   flatbuffers::FlatBufferBuilder builder2;
   std::vector<std::unique_ptr<FlatbuffersExpressionEvaluator>> grouping_evaluators;
   std::vector<std::unique_ptr<AggregateExpressionEvaluator>> aggregate_evaluators;
+  uint64_t memory_budget;
+
+  // For native aggregation: the unboxed partial aggregate, the storage for its string values, and
+  // the index of the first field of each aggregate
+  bool native;
+  std::vector<UnboxedField> state;
+  std::vector<std::vector<uint8_t>> state_strings;
+  std::vector<uint32_t> state_offsets;
+  // Scratch space for merge and is_same_group
+  std::vector<UnboxedField> other_state;
+  std::vector<uint8_t> key1;
+  std::vector<uint8_t> key2;
+  flatbuffers::FlatBufferBuilder initial_builder;
+  const tuix::Row *initial_row;
 };
 
 #endif
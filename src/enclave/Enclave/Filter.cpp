@@ -16,21 +16,35 @@ void filter(uint8_t *condition, size_t condition_length,
   const tuix::FilterExpr* condition_expr = flatbuffers::GetRoot<tuix::FilterExpr>(condition);
   FlatbuffersExpressionEvaluator condition_eval(condition_expr->condition());
 
-  EncryptedBlocksToRowReader r(input_rows, input_rows_length);
+  EncryptedBlocksToEncryptedBlockReader r(input_rows, input_rows_length);
+  EncryptedBlockToRowReader block_reader;
   FlatbuffersRowWriter w;
+  std::vector<uint32_t> selection;
+
+  for (auto it = r.begin(); it != r.end(); ++it) {
+    block_reader.reset(*it);
+    const tuix::Rows *rows = block_reader.get_rows();
+
+    // Evaluate the condition on the whole block at once, then copy out the selected rows
+    if (condition_eval.eval_selection(rows, selection)) {
+      for (uint32_t i : selection) {
+        w.write(rows->rows()->Get(i));
+      }
+      continue;
+    }
 
-  while (r.has_next()) {
-    const tuix::Row *row = r.next();
-    const tuix::Field *condition_result = condition_eval.eval(row);
-    check(condition_result->value_type() == tuix::FieldUnion_BooleanField,
-          "Filter expression returned %s instead of BooleanField\n",
-          tuix::EnumNameFieldUnion(condition_result->value_type()));
-    check(!condition_result->is_null(),
-          "Filter expression returned null\n");
-
-    bool keep_row = static_cast<const tuix::BooleanField *>(condition_result->value())->value();
-    if (keep_row) {
-      w.write(row);
+    // The block's columns are not uniformly typed, so evaluate it one row at a time
+    while (block_reader.has_next()) {
+      const tuix::Row *row = block_reader.next();
+      const UnboxedField &condition_result = condition_eval.eval_unboxed(row);
+      check(condition_result.type == tuix::FieldUnion_BooleanField,
+            "Filter expression returned %s instead of BooleanField\n",
+            tuix::EnumNameFieldUnion(condition_result.type));
+
+      bool keep_row = !condition_result.is_null && condition_result.boolean_value;
+      if (keep_row) {
+        w.write(row);
+      }
     }
   }
 
@@ -2,6 +2,9 @@
 
 #include "Flatbuffers.h"
 
+#include <cstring>
+#include <limits>
+
 std::string to_string(const Date &date) {
   uint64_t seconds_per_day = 60 * 60 * 24L;
   uint64_t secs = date.days_since_epoch * seconds_per_day;
@@ -76,7 +79,7 @@ flatbuffers::Offset<tuix::Row> flatbuffers_copy(
     field_values[i] = flatbuffers_copy<tuix::Field>(
       row->field_values()->Get(i), builder, force_null);
   }
-  return tuix::CreateRowDirect(builder, &field_values);
+  return tuix::CreateRowDirect(builder, &field_values, row->is_dummy());
 }
 
 template<>
@@ -152,3 +155,181 @@ flatbuffers::Offset<tuix::Field> flatbuffers_copy(
     return flatbuffers::Offset<tuix::Field>();
   }
 }
+
+UnboxedField unbox(const tuix::Field *field) {
+  UnboxedField result;
+  result.type = field->value_type();
+  result.is_null = field->is_null();
+  result.long_value = 0;
+  result.string_data = nullptr;
+  result.string_length = 0;
+  switch (field->value_type()) {
+  case tuix::FieldUnion_BooleanField:
+    result.boolean_value = static_cast<const tuix::BooleanField *>(field->value())->value();
+    break;
+  case tuix::FieldUnion_IntegerField:
+    result.int_value = static_cast<const tuix::IntegerField *>(field->value())->value();
+    break;
+  case tuix::FieldUnion_LongField:
+    result.long_value = static_cast<const tuix::LongField *>(field->value())->value();
+    break;
+  case tuix::FieldUnion_FloatField:
+    result.float_value = static_cast<const tuix::FloatField *>(field->value())->value();
+    break;
+  case tuix::FieldUnion_DoubleField:
+    result.double_value = static_cast<const tuix::DoubleField *>(field->value())->value();
+    break;
+  case tuix::FieldUnion_StringField:
+  {
+    auto string_field = static_cast<const tuix::StringField *>(field->value());
+    result.string_data = string_field->value()->data();
+    result.string_length = string_field->length();
+    break;
+  }
+  case tuix::FieldUnion_DateField:
+    result.int_value = static_cast<const tuix::DateField *>(field->value())->value();
+    break;
+  default:
+    printf("unbox tuix::Field: Unknown field type %d\n",
+           field->value_type());
+    std::exit(1);
+  }
+  return result;
+}
+
+flatbuffers::Offset<tuix::Field> flatbuffers_box(
+  const UnboxedField &value, flatbuffers::FlatBufferBuilder& builder) {
+
+  switch (value.type) {
+  case tuix::FieldUnion_BooleanField:
+    return tuix::CreateField(
+      builder,
+      tuix::FieldUnion_BooleanField,
+      tuix::CreateBooleanField(builder, value.boolean_value).Union(),
+      value.is_null);
+  case tuix::FieldUnion_IntegerField:
+    return tuix::CreateField(
+      builder,
+      tuix::FieldUnion_IntegerField,
+      tuix::CreateIntegerField(builder, value.int_value).Union(),
+      value.is_null);
+  case tuix::FieldUnion_LongField:
+    return tuix::CreateField(
+      builder,
+      tuix::FieldUnion_LongField,
+      tuix::CreateLongField(builder, value.long_value).Union(),
+      value.is_null);
+  case tuix::FieldUnion_FloatField:
+    return tuix::CreateField(
+      builder,
+      tuix::FieldUnion_FloatField,
+      tuix::CreateFloatField(builder, value.float_value).Union(),
+      value.is_null);
+  case tuix::FieldUnion_DoubleField:
+    return tuix::CreateField(
+      builder,
+      tuix::FieldUnion_DoubleField,
+      tuix::CreateDoubleField(builder, value.double_value).Union(),
+      value.is_null);
+  case tuix::FieldUnion_StringField:
+    return tuix::CreateField(
+      builder,
+      tuix::FieldUnion_StringField,
+      tuix::CreateStringField(
+        builder,
+        builder.CreateVector(value.string_data, value.string_length),
+        value.string_length).Union(),
+      value.is_null);
+  case tuix::FieldUnion_DateField:
+    return tuix::CreateField(
+      builder,
+      tuix::FieldUnion_DateField,
+      tuix::CreateDateField(builder, value.int_value).Union(),
+      value.is_null);
+  default:
+    printf("flatbuffers_box: Unknown field type %d\n",
+           value.type);
+    std::exit(1);
+    return flatbuffers::Offset<tuix::Field>();
+  }
+}
+
+template<typename T>
+static void append_big_endian(T value, std::vector<uint8_t> &key) {
+  for (int shift = (sizeof(T) - 1) * 8; shift >= 0; shift -= 8) {
+    key.push_back(static_cast<uint8_t>(value >> shift));
+  }
+}
+
+void append_normalized_key(const UnboxedField &value, bool descending, std::vector<uint8_t> &key) {
+  size_t start = key.size();
+  if (value.is_null) {
+    key.push_back(0);
+  } else {
+    key.push_back(1);
+    switch (value.type) {
+    case tuix::FieldUnion_BooleanField:
+      key.push_back(value.boolean_value ? 1 : 0);
+      break;
+    case tuix::FieldUnion_IntegerField:
+    case tuix::FieldUnion_DateField:
+      // Flip the sign bit so that negative numbers sort before positive ones
+      append_big_endian<uint32_t>(static_cast<uint32_t>(value.int_value) ^ 0x80000000u, key);
+      break;
+    case tuix::FieldUnion_LongField:
+      append_big_endian<uint64_t>(
+        static_cast<uint64_t>(value.long_value) ^ 0x8000000000000000ull, key);
+      break;
+    case tuix::FieldUnion_FloatField:
+    {
+      float f = value.float_value;
+      if (f == 0.0f) {
+        f = 0.0f;
+      } else if (f != f) {
+        f = std::numeric_limits<float>::quiet_NaN();
+      }
+      uint32_t bits;
+      memcpy(&bits, &f, sizeof(bits));
+      // Negative floats sort in the reverse order of their bits, positive floats in the same order
+      bits = (bits & 0x80000000u) ? ~bits : bits ^ 0x80000000u;
+      append_big_endian<uint32_t>(bits, key);
+      break;
+    }
+    case tuix::FieldUnion_DoubleField:
+    {
+      double d = value.double_value;
+      if (d == 0.0) {
+        d = 0.0;
+      } else if (d != d) {
+        d = std::numeric_limits<double>::quiet_NaN();
+      }
+      uint64_t bits;
+      memcpy(&bits, &d, sizeof(bits));
+      bits = (bits & 0x8000000000000000ull) ? ~bits : bits ^ 0x8000000000000000ull;
+      append_big_endian<uint64_t>(bits, key);
+      break;
+    }
+    case tuix::FieldUnion_StringField:
+      // Escape 0x00 as 0x00 0xFF and terminate with 0x00 0x00, so that a string sorts before any
+      // longer string it is a prefix of, regardless of what follows it in the key
+      for (uint32_t i = 0; i < value.string_length; i++) {
+        key.push_back(value.string_data[i]);
+        if (value.string_data[i] == 0) {
+          key.push_back(0xFF);
+        }
+      }
+      key.push_back(0);
+      key.push_back(0);
+      break;
+    default:
+      printf("append_normalized_key: Unknown field type %d\n",
+             value.type);
+      std::exit(1);
+    }
+  }
+  if (descending) {
+    for (size_t i = start; i < key.size(); i++) {
+      key[i] = ~key[i];
+    }
+  }
+}
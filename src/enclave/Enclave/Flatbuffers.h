@@ -42,71 +42,48 @@ template<>
 flatbuffers::Offset<tuix::Field> flatbuffers_copy(
   const tuix::Field *field, flatbuffers::FlatBufferBuilder& builder, bool force_null);
 
-template<typename InputTuixField, typename InputType>
-flatbuffers::Offset<tuix::Field> flatbuffers_cast(
-  const tuix::Cast *cast, const tuix::Field *value, flatbuffers::FlatBufferBuilder& builder,
-  bool result_is_null) {
-  InputType value_eval = static_cast<const InputTuixField *>(value->value())->value();
-  switch (cast->target_type()) {
-  case tuix::ColType_IntegerType:
-  {
-    return tuix::CreateField(
-      builder,
-      tuix::FieldUnion_IntegerField,
-      tuix::CreateIntegerField(builder, static_cast<int32_t>(value_eval)).Union(),
-      result_is_null);
-  }
-  case tuix::ColType_LongType:
-  {
-    return tuix::CreateField(
-      builder,
-      tuix::FieldUnion_LongField,
-      tuix::CreateLongField(builder, static_cast<int64_t>(value_eval)).Union(),
-      result_is_null);
-  }
-  case tuix::ColType_FloatType:
-  {
-    return tuix::CreateField(
-      builder,
-      tuix::FieldUnion_FloatField,
-      tuix::CreateFloatField(builder, static_cast<float>(value_eval)).Union(),
-      result_is_null);
-  }
-  case tuix::ColType_DoubleType:
-  {
-    return tuix::CreateField(
-      builder,
-      tuix::FieldUnion_DoubleField,
-      tuix::CreateDoubleField(builder, static_cast<double>(value_eval)).Union(),
-      result_is_null);
-  }
-  case tuix::ColType_StringType:
-  {
-    using std::to_string;
-    std::string str = to_string(value_eval);
-    std::vector<uint8_t> str_vec(str.begin(), str.end());
-    return tuix::CreateField(
-      builder,
-      tuix::FieldUnion_StringField,
-      tuix::CreateStringFieldDirect(builder, &str_vec, str_vec.size()).Union(),
-      result_is_null);
-  }
-  default:
-  {
-    printf("Can't cast %s to %s\n",
-           typeid(InputTuixField).name(), tuix::EnumNameColType(cast->target_type()));
-    std::exit(1);
-    return flatbuffers::Offset<tuix::Field>();
-  }
-  }
-}
-
 template<typename T> flatbuffers::Offset<T> GetOffset(
   flatbuffers::FlatBufferBuilder &builder, const T *pointer) {
   return flatbuffers::Offset<T>(builder.GetCurrentBufferPointer() + builder.GetSize()
                                 - reinterpret_cast<const uint8_t *>(pointer));
 }
 
+/**
+ * The value of a tuix::Field, stored without any FlatBuffers indirection. Fixed-width values live
+ * inline. String values are not copied: string_data points into memory owned by someone else (an
+ * input Row, a literal in an expression buffer, or an evaluator's scratch space), so an
+ * UnboxedField is only valid as long as that memory is.
+ */
+struct UnboxedField {
+  tuix::FieldUnion type;
+  bool is_null;
+  union {
+    bool boolean_value;
+    int32_t int_value; // Also used for DateField (days since epoch)
+    int64_t long_value;
+    float float_value;
+    double double_value;
+  };
+  const uint8_t *string_data;
+  uint32_t string_length;
+};
+
+/** Read the given Field into an UnboxedField. String values will point into the Field. */
+UnboxedField unbox(const tuix::Field *field);
+
+/** Write the given UnboxedField to builder as a tuix::Field. */
+flatbuffers::Offset<tuix::Field> flatbuffers_box(
+  const UnboxedField &value, flatbuffers::FlatBufferBuilder& builder);
+
+/**
+ * Append an order-preserving binary encoding of value to key. Keys built by appending the
+ * encodings of several values compare with memcmp (a proper prefix sorting first) in the same
+ * order as the values compare column by column. Nulls sort before all other values, NaNs after
+ * all other values, and -0.0 equal to 0.0. If descending is true, the encoding is inverted so that
+ * the order of this value is reversed (and nulls sort last).
+ */
+void append_normalized_key(const UnboxedField &value, bool descending, std::vector<uint8_t> &key);
+
 class EncryptedBlocksToEncryptedBlockReader {
 public:
   EncryptedBlocksToEncryptedBlockReader(uint8_t *buf, size_t len) {
@@ -122,6 +99,9 @@ public:
   flatbuffers::Vector<flatbuffers::Offset<tuix::EncryptedBlock>>::const_iterator end() {
     return encrypted_blocks->blocks()->end();
   }
+  uint32_t num_blocks() {
+    return encrypted_blocks->blocks()->size();
+  }
 
 private:
   const tuix::EncryptedBlocks *encrypted_blocks;
@@ -159,6 +139,11 @@ public:
     return rows->rows()->end();
   }
 
+  /** Return the decrypted block. It is valid until the next call to reset. */
+  const tuix::Rows *get_rows() {
+    return rows;
+  }
+
 private:
   void init(const tuix::EncryptedBlock *encrypted_block) {
     uint32_t num_rows = encrypted_block->num_rows();
@@ -192,8 +177,12 @@ class EncryptedBlocksToRowReader {
   typedef flatbuffers::Vector<flatbuffers::Offset<tuix::Row>>::const_iterator RowIterator;
 
 public:
-  EncryptedBlocksToRowReader(uint8_t *buf, size_t len)
-    : block_idx(0) {
+  /**
+   * Read the rows of the given EncryptedBlocks, starting at block first_block. Blocks before
+   * first_block are skipped without being decrypted.
+   */
+  EncryptedBlocksToRowReader(uint8_t *buf, size_t len, uint32_t first_block = 0)
+    : block_idx(first_block) {
     flatbuffers::Verifier v(buf, len);
     check(v.VerifyBuffer<tuix::EncryptedBlocks>(nullptr),
           "Corrupt EncryptedBlocks %p of length %d\n", buf, len);
@@ -201,8 +190,9 @@ public:
     init_row_reader();
   }
 
-  EncryptedBlocksToRowReader(const tuix::EncryptedBlocks *encrypted_blocks)
-    : encrypted_blocks(encrypted_blocks), block_idx(0) {
+  EncryptedBlocksToRowReader(const tuix::EncryptedBlocks *encrypted_blocks,
+                             uint32_t first_block = 0)
+    : encrypted_blocks(encrypted_blocks), block_idx(first_block) {
     init_row_reader();
   }
 
@@ -298,7 +288,16 @@ class FlatbuffersRowWriter {
 public:
   FlatbuffersRowWriter()
     : builder(), rows_vector(), total_num_rows(0), untrusted_alloc(),
-      enc_block_builder(1024, &untrusted_alloc) {}
+      enc_block_builder(1024, &untrusted_alloc), block_index(nullptr) {}
+
+  /**
+   * Also copy the first row of every block subsequently started by write(const tuix::Row *) to
+   * block_index, or stop doing so if block_index is nullptr. The resulting index lets a reader of
+   * sorted output find the block containing a given key without decrypting the output.
+   */
+  void set_block_index(FlatbuffersRowWriter *block_index) {
+    this->block_index = block_index;
+  }
 
   void clear() {
     builder.Clear();
@@ -310,6 +309,9 @@ public:
 
   /** Copy the given Row to the output. */
   void write(const tuix::Row *row) {
+    if (block_index != nullptr && rows_vector.empty()) {
+      block_index->write(row);
+    }
     rows_vector.push_back(flatbuffers_copy(row, builder));
     total_num_rows++;
     maybe_finish_block();
@@ -327,6 +329,18 @@ public:
     maybe_finish_block();
   }
 
+  /** Box the given values and write them to the output as a Row. */
+  void write(const std::vector<UnboxedField> &row_fields) {
+    flatbuffers::uoffset_t num_fields = row_fields.size();
+    std::vector<flatbuffers::Offset<tuix::Field>> field_values(num_fields);
+    for (flatbuffers::uoffset_t i = 0; i < num_fields; i++) {
+      field_values[i] = flatbuffers_box(row_fields[i], builder);
+    }
+    rows_vector.push_back(tuix::CreateRowDirect(builder, &field_values));
+    total_num_rows++;
+    maybe_finish_block();
+  }
+
   /**
    * Concatenate the fields of the two given Rows and write the resulting single Row to the output.
    */
@@ -416,6 +430,8 @@ private:
   UntrustedMemoryAllocator untrusted_alloc;
   flatbuffers::FlatBufferBuilder enc_block_builder;
   std::vector<flatbuffers::Offset<tuix::EncryptedBlock>> enc_block_vector;
+
+  FlatbuffersRowWriter *block_index;
 };
 
 class FlatbuffersTemporaryRow {
@@ -446,6 +462,11 @@ public:
     return row;
   }
 
+  /** Return the number of bytes used by the copy of the row. */
+  size_t size() const {
+    return row != nullptr ? builder.GetSize() : 0;
+  }
+
 private:
   flatbuffers::FlatBufferBuilder builder;
   const tuix::Row *row;
@@ -1,8 +1,117 @@
 #include "Join.h"
 
+#include <cstring>
+#include <memory>
+#include <unordered_map>
+
+#include <sgx_spinlock.h>
+
 #include "ExpressionEvaluation.h"
 #include "common.h"
 
+/**
+ * Writes the output of a join of the type given by its JoinExpr. Kernels report each foreign row
+ * either with its matching primary row or as unmatched, and each unmatched primary row; this
+ * decides what, if anything, to output for it.
+ */
+class JoinOutput {
+public:
+  JoinOutput(FlatbuffersJoinExprEvaluator &join_expr_eval, FlatbuffersRowWriter &w)
+    : join_type(join_expr_eval.get_join_type()),
+      left_null_row(join_expr_eval.get_left_null_row()),
+      right_null_row(join_expr_eval.get_right_null_row()),
+      output_columns(join_expr_eval.get_output_columns()),
+      projected_fields(),
+      w(w) {
+    check(join_type != tuix::JoinType_Cross, "Cross joins are not supported\n");
+    check(!(pads_foreign() && left_null_row == nullptr)
+          && !(pads_primary() && right_null_row == nullptr),
+          "%s join is missing a null row for padding\n", tuix::EnumNameJoinType(join_type));
+  }
+
+  /** Return true if unmatched primary rows are output, so kernels must report them. */
+  static bool pads_primary(tuix::JoinType join_type) {
+    return join_type == tuix::JoinType_LeftOuter || join_type == tuix::JoinType_FullOuter;
+  }
+
+  /**
+   * Return true if primary rows must have distinct keys. Semi and anti joins only test whether a
+   * foreign row has any match.
+   */
+  static bool requires_unique_primary(tuix::JoinType join_type) {
+    return join_type != tuix::JoinType_LeftSemi && join_type != tuix::JoinType_LeftAnti;
+  }
+
+  bool pads_primary() const {
+    return pads_primary(join_type);
+  }
+
+  bool requires_unique_primary() const {
+    return requires_unique_primary(join_type);
+  }
+
+  void write_match(const tuix::Row *primary, const tuix::Row *foreign) {
+    if (join_type == tuix::JoinType_LeftSemi) {
+      write(nullptr, foreign);
+    } else if (join_type != tuix::JoinType_LeftAnti) {
+      write(primary, foreign);
+    }
+  }
+
+  void write_unmatched_foreign(const tuix::Row *foreign) {
+    if (join_type == tuix::JoinType_LeftAnti) {
+      write(nullptr, foreign);
+    } else if (pads_foreign()) {
+      write(left_null_row, foreign);
+    }
+  }
+
+  void write_unmatched_primary(const tuix::Row *primary) {
+    if (pads_primary()) {
+      write(primary, right_null_row);
+    }
+  }
+
+private:
+  /**
+   * Write the fields of primary (if not nullptr) followed by those of foreign, keeping only the
+   * output columns if any are given.
+   */
+  void write(const tuix::Row *primary, const tuix::Row *foreign) {
+    if (output_columns == nullptr) {
+      if (primary == nullptr) {
+        w.write(foreign);
+      } else {
+        w.write(primary, foreign);
+      }
+      return;
+    }
+
+    uint32_t num_primary_fields = primary == nullptr ? 0 : primary->field_values()->size();
+    uint32_t num_fields = num_primary_fields + foreign->field_values()->size();
+    projected_fields.clear();
+    for (uint32_t i : *output_columns) {
+      check(i < num_fields, "Join output column %d out of range for %d fields\n", i, num_fields);
+      projected_fields.push_back(
+        i < num_primary_fields
+        ? primary->field_values()->Get(i)
+        : foreign->field_values()->Get(i - num_primary_fields));
+    }
+    w.write(projected_fields);
+  }
+
+  bool pads_foreign() const {
+    return join_type == tuix::JoinType_RightOuter || join_type == tuix::JoinType_FullOuter;
+  }
+
+  tuix::JoinType join_type;
+  const tuix::Row *left_null_row;
+  const tuix::Row *right_null_row;
+  const flatbuffers::Vector<uint32_t> *output_columns;
+  std::vector<const tuix::Field *> projected_fields;
+  FlatbuffersRowWriter &w;
+};
+
 void scan_collect_last_primary(
   uint8_t *join_expr, size_t join_expr_length,
   uint8_t *input_rows, size_t input_rows_length,
@@ -24,35 +133,547 @@ void scan_collect_last_primary(
   *output_rows_length = w.output_size();
 }
 
-void non_oblivious_sort_merge_join(
+void scan_collect_first_primary(
   uint8_t *join_expr, size_t join_expr_length,
   uint8_t *input_rows, size_t input_rows_length,
-  uint8_t *join_row, size_t join_row_length,
   uint8_t **output_rows, size_t *output_rows_length) {
 
   FlatbuffersJoinExprEvaluator join_expr_eval(join_expr, join_expr_length);
   EncryptedBlocksToRowReader r(input_rows, input_rows_length);
-  EncryptedBlocksToRowReader j(join_row, join_row_length);
   FlatbuffersRowWriter w;
+  while (r.has_next()) {
+    const tuix::Row *row = r.next();
+    if (join_expr_eval.is_primary(row)) {
+      w.write(row);
+      break;
+    }
+  }
 
-  check(j.num_rows() <= 1,
-        "Incorrect number of join rows passed: expected 0 or 1, got %d\n", j.num_rows());
-  FlatbuffersTemporaryRow primary(j.has_next() ? j.next() : nullptr);
+  w.finish(w.write_encrypted_blocks());
+  *output_rows = w.output_buffer().release();
+  *output_rows_length = w.output_size();
+}
 
-  while (r.has_next()) {
-    const tuix::Row *current = r.next();
-
-    if (join_expr_eval.is_primary(current)) {
-      check(!primary.get() || !join_expr_eval.is_same_group(primary.get(), current),
-            "non_oblivious_sort_merge_join - primary table uniqueness constraint violation: "
-            "multiple rows from the primary table had the same join attribute\n");
-      // Advance to a new join attribute
-      primary.set(current);
+/** A primary row from a neighboring partition, with its join key. */
+struct BoundaryPrimaryRow {
+  BoundaryPrimaryRow(FlatbuffersJoinExprEvaluator &join_expr_eval,
+                     uint8_t *row_buf, size_t row_buf_length, const char *name)
+    : r(row_buf, row_buf_length), row(nullptr) {
+    check(r.num_rows() <= 1,
+          "Incorrect number of %s rows passed: expected 0 or 1, got %d\n", name, r.num_rows());
+    if (r.has_next()) {
+      row = r.next();
+      if (!join_expr_eval.append_join_key(row, true, key)) {
+        row = nullptr;
+      }
+    }
+  }
+
+  EncryptedBlocksToRowReader r;
+  const tuix::Row *row;
+  std::vector<uint8_t> key;
+};
+
+void non_oblivious_merge_join(
+  uint8_t *join_expr, size_t join_expr_length,
+  uint8_t *primary_rows, size_t primary_rows_length,
+  uint8_t *foreign_rows, size_t foreign_rows_length,
+  uint8_t *prev_primary_row, size_t prev_primary_row_length,
+  uint8_t *next_primary_row, size_t next_primary_row_length,
+  uint8_t **output_rows, size_t *output_rows_length) {
+
+  FlatbuffersJoinExprEvaluator join_expr_eval(join_expr, join_expr_length);
+  EncryptedBlocksToRowReader p(primary_rows, primary_rows_length);
+  EncryptedBlocksToRowReader f(foreign_rows, foreign_rows_length);
+  BoundaryPrimaryRow prev(join_expr_eval, prev_primary_row, prev_primary_row_length, "previous");
+  BoundaryPrimaryRow next(join_expr_eval, next_primary_row, next_primary_row_length, "next");
+  FlatbuffersRowWriter w;
+  JoinOutput out(join_expr_eval, w);
+
+  // The current primary row is the first one whose key is not less than the current foreign key.
+  // Primary rows with a null key sort first and never match.
+  const tuix::Row *primary = nullptr;
+  bool primary_matched = true;
+  bool seen_primary = false;
+  std::vector<uint8_t> primary_key;
+  std::vector<uint8_t> row_key;
+  auto advance_primary = [&]() {
+    if (primary != nullptr && !primary_matched) {
+      out.write_unmatched_primary(primary);
+    }
+    primary = nullptr;
+    while (p.has_next()) {
+      const tuix::Row *row = p.next();
+      row_key.clear();
+      if (!join_expr_eval.append_join_key(row, true, row_key)) {
+        out.write_unmatched_primary(row);
+        continue;
+      }
+      check(!seen_primary || primary_key < row_key
+            || (!out.requires_unique_primary() && primary_key == row_key),
+            "non_oblivious_merge_join - primary rows must be sorted by join key, and the primary "
+            "table uniqueness constraint must hold\n");
+      primary_key.swap(row_key);
+      seen_primary = true;
+      primary = row;
+      primary_matched = false;
+      return;
+    }
+  };
+  advance_primary();
+
+  std::vector<uint8_t> foreign_key;
+  std::vector<uint8_t> last_foreign_key;
+  while (f.has_next()) {
+    const tuix::Row *current = f.next();
+    foreign_key.clear();
+    if (!join_expr_eval.append_join_key(current, false, foreign_key)) {
+      out.write_unmatched_foreign(current);
+      continue;
+    }
+    check(last_foreign_key <= foreign_key,
+          "non_oblivious_merge_join - foreign rows must be sorted by join key\n");
+    last_foreign_key.swap(foreign_key);
+    const std::vector<uint8_t> &key = last_foreign_key;
+
+    while (primary != nullptr && primary_key < key) {
+      advance_primary();
+    }
+    if (primary != nullptr && primary_key == key) {
+      out.write_match(primary, current);
+      primary_matched = true;
+    } else if (prev.row != nullptr && prev.key == key) {
+      // A key that spans several partitions can have its primary row in any one of them
+      out.write_match(prev.row, current);
+    } else if (next.row != nullptr && next.key == key) {
+      out.write_match(next.row, current);
     } else {
-      if (primary.get() != nullptr && join_expr_eval.is_same_group(primary.get(), current)) {
-        w.write(primary.get(), current);
+      out.write_unmatched_foreign(current);
+    }
+  }
+  // Report the remaining primary rows
+  while (primary != nullptr) {
+    advance_primary();
+  }
+
+  w.finish(w.write_encrypted_blocks());
+  *output_rows = w.output_buffer().release();
+  *output_rows_length = w.output_size();
+}
+
+/** Seeded FNV-1a, followed by a final mix so that the low bits depend on every byte */
+static uint64_t hash_join_key(const uint8_t *key, uint32_t key_length, uint64_t seed) {
+  uint64_t h = 14695981039346656037ULL ^ seed;
+  for (uint32_t i = 0; i < key_length; i++) {
+    h = (h ^ key[i]) * 1099511628211ULL;
+  }
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  return h;
+}
+
+/**
+ * An open-addressing hash table with linear probing from the normalized join key of each build row
+ * to the index of that row. The keys are stored contiguously, and each slot caches the hash of its
+ * key so that most mismatches are rejected without touching the keys.
+ */
+class JoinHashTable {
+public:
+  JoinHashTable(uint32_t num_rows) : num_keys(0) {
+    uint32_t capacity = 16;
+    while (capacity < 2 * static_cast<uint64_t>(num_rows)) {
+      capacity *= 2;
+    }
+    slots.resize(capacity, Slot{0, EMPTY_SLOT, 0});
+    sgx_read_rand(reinterpret_cast<uint8_t *>(&seed), sizeof(seed));
+    key_offsets.push_back(0);
+  }
+
+  /** Insert the given key for the given row. Return false if the key is already present. */
+  bool insert(const uint8_t *key, uint32_t key_length, uint32_t row) {
+    uint64_t h = hash(key, key_length);
+    uint32_t i = find_slot(key, key_length, h);
+    if (slots[i].row != EMPTY_SLOT) {
+      return false;
+    }
+    slots[i].hash = static_cast<uint32_t>(h);
+    slots[i].row = row;
+    slots[i].key = num_keys++;
+    keys.insert(keys.end(), key, key + key_length);
+    key_offsets.push_back(keys.size());
+    return true;
+  }
+
+  /** Return the row with the given key, or EMPTY_SLOT if there is none. */
+  uint32_t find(const uint8_t *key, uint32_t key_length) {
+    return slots[find_slot(key, key_length, hash(key, key_length))].row;
+  }
+
+  static const uint32_t EMPTY_SLOT = UINT32_MAX;
+
+private:
+  struct Slot {
+    uint32_t hash;
+    uint32_t row;
+    uint32_t key;
+  };
+
+  /** Return the slot holding the given key, or the empty slot where it would be inserted. */
+  uint32_t find_slot(const uint8_t *key, uint32_t key_length, uint64_t h) {
+    uint32_t mask = slots.size() - 1;
+    for (uint32_t i = h & mask;; i = (i + 1) & mask) {
+      const Slot &slot = slots[i];
+      if (slot.row == EMPTY_SLOT) {
+        return i;
+      }
+      if (slot.hash == static_cast<uint32_t>(h)
+          && key_offsets[slot.key + 1] - key_offsets[slot.key] == key_length
+          && std::memcmp(&keys[key_offsets[slot.key]], key, key_length) == 0) {
+        return i;
+      }
+    }
+  }
+
+  uint64_t hash(const uint8_t *key, uint32_t key_length) {
+    return hash_join_key(key, key_length, seed);
+  }
+
+  std::vector<Slot> slots;
+  std::vector<uint8_t> keys;
+  std::vector<size_t> key_offsets;
+  uint32_t num_keys;
+  uint64_t seed;
+};
+
+/**
+ * The build side of a hash join: the decrypted rows of the primary table, indexed by their join
+ * keys. Once built it is only read, so it can be probed concurrently from several threads.
+ */
+class HashJoinBuildSide {
+public:
+  HashJoinBuildSide(uint8_t *join_expr, size_t join_expr_length,
+                    uint8_t *build_rows, size_t build_rows_length)
+    : join_expr(join_expr, join_expr + join_expr_length) {
+    FlatbuffersJoinExprEvaluator join_expr_eval(join_expr, join_expr_length);
+    join_type = join_expr_eval.get_join_type();
+
+    // The JoinExpr can only lower the budget
+    uint64_t budget = join_expr_eval.get_memory_budget();
+    if (budget == 0 || budget > HASH_JOIN_MEMORY_BUDGET) {
+      budget = HASH_JOIN_MEMORY_BUDGET;
+    }
+    check(build_rows_length <= budget,
+          "hash_join: build side of %d bytes exceeds the budget of %d bytes\n",
+          build_rows_length, budget);
+
+    // Decrypt the whole build side, keeping its blocks in memory while probing
+    EncryptedBlocksToEncryptedBlockReader b(build_rows, build_rows_length);
+    build_readers = std::vector<EncryptedBlockToRowReader>(b.num_blocks());
+    uint32_t block_idx = 0;
+    for (auto it = b.begin(); it != b.end(); ++it, ++block_idx) {
+      build_readers[block_idx].reset(*it);
+      build.insert(build.end(), build_readers[block_idx].begin(), build_readers[block_idx].end());
+    }
+
+    table.reset(new JoinHashTable(build.size()));
+    std::vector<uint8_t> key;
+    for (uint32_t i = 0; i < build.size(); i++) {
+      check(join_expr_eval.is_primary(build[i]),
+            "hash_join: build side contains a row from the foreign table\n");
+      key.clear();
+      if (join_expr_eval.append_join_key(build[i], key)) {
+        check(table->insert(key.data(), key.size(), i)
+              || !JoinOutput::requires_unique_primary(join_type),
+              "hash_join - primary table uniqueness constraint violation: "
+              "multiple rows from the primary table had the same join attribute\n");
+      }
+    }
+  }
+
+  /** Return true if unmatched build rows must be output after all probes, as for an outer join. */
+  bool pads_build() const {
+    return JoinOutput::pads_primary(join_type);
+  }
+
+  /**
+   * Join each row of probe_rows with the build side, writing the joined rows to w. If matched is
+   * not null, mark the build rows that matched.
+   */
+  void probe(uint8_t *probe_rows, size_t probe_rows_length, FlatbuffersRowWriter &w,
+             std::vector<bool> *matched = nullptr) {
+    // Expression evaluators hold scratch state, so each probe needs its own
+    FlatbuffersJoinExprEvaluator join_expr_eval(join_expr.data(), join_expr.size());
+    JoinOutput out(join_expr_eval, w);
+    EncryptedBlocksToRowReader r(probe_rows, probe_rows_length);
+    std::vector<uint8_t> key;
+    while (r.has_next()) {
+      const tuix::Row *current = r.next();
+      key.clear();
+      uint32_t match = JoinHashTable::EMPTY_SLOT;
+      if (join_expr_eval.append_join_key(current, key)) {
+        match = table->find(key.data(), key.size());
+      }
+      if (match != JoinHashTable::EMPTY_SLOT) {
+        out.write_match(build[match], current);
+        if (matched != nullptr) {
+          (*matched)[match] = true;
+        }
+      } else {
+        out.write_unmatched_foreign(current);
+      }
+    }
+  }
+
+  /** Write the build rows not marked in matched, including those with a null key, padded. */
+  void write_unmatched_build(const std::vector<bool> &matched, FlatbuffersRowWriter &w) {
+    FlatbuffersJoinExprEvaluator join_expr_eval(join_expr.data(), join_expr.size());
+    JoinOutput out(join_expr_eval, w);
+    for (uint32_t i = 0; i < build.size(); i++) {
+      if (!matched[i]) {
+        out.write_unmatched_primary(build[i]);
+      }
+    }
+  }
+
+  tuix::JoinType get_join_type() const {
+    return join_type;
+  }
+
+  uint32_t num_build_rows() const {
+    return build.size();
+  }
+
+private:
+  std::vector<uint8_t> join_expr;
+  tuix::JoinType join_type;
+  std::vector<EncryptedBlockToRowReader> build_readers;
+  std::vector<const tuix::Row *> build;
+  std::unique_ptr<JoinHashTable> table;
+};
+
+void hash_join(
+  uint8_t *join_expr, size_t join_expr_length,
+  uint8_t *build_rows, size_t build_rows_length,
+  uint8_t *probe_rows, size_t probe_rows_length,
+  uint8_t **output_rows, size_t *output_rows_length) {
+
+  HashJoinBuildSide build_side(join_expr, join_expr_length, build_rows, build_rows_length);
+  FlatbuffersRowWriter w;
+  if (build_side.pads_build()) {
+    // The probe side holds every foreign row that can match a build row, so the build rows left
+    // unmatched after it are unmatched overall
+    std::vector<bool> matched(build_side.num_build_rows(), false);
+    build_side.probe(probe_rows, probe_rows_length, w, &matched);
+    build_side.write_unmatched_build(matched, w);
+  } else {
+    build_side.probe(probe_rows, probe_rows_length, w);
+  }
+
+  w.finish(w.write_encrypted_blocks());
+  *output_rows = w.output_buffer().release();
+  *output_rows_length = w.output_size();
+}
+
+// Build sides kept in the enclave between calls to broadcast_probe, by handle
+sgx_spinlock_t broadcast_build_sides_lock = SGX_SPINLOCK_INITIALIZER;
+std::unordered_map<uint64_t, std::shared_ptr<HashJoinBuildSide>> broadcast_build_sides;
+uint64_t next_broadcast_handle = 1;
+
+uint64_t broadcast_build(
+  uint8_t *join_expr, size_t join_expr_length,
+  uint8_t *build_rows, size_t build_rows_length) {
+
+  // Build outside the lock so that other threads can keep probing
+  std::shared_ptr<HashJoinBuildSide> build_side = std::make_shared<HashJoinBuildSide>(
+    join_expr, join_expr_length, build_rows, build_rows_length);
+  check(!build_side->pads_build(),
+        "broadcast_build: %s joins must output unmatched primary rows, which a probe of part of "
+        "the foreign table cannot tell\n",
+        tuix::EnumNameJoinType(build_side->get_join_type()));
+
+  sgx_spin_lock(&broadcast_build_sides_lock);
+  uint64_t handle = next_broadcast_handle++;
+  broadcast_build_sides[handle] = build_side;
+  sgx_spin_unlock(&broadcast_build_sides_lock);
+  return handle;
+}
+
+void broadcast_probe(
+  uint64_t handle,
+  uint8_t *probe_rows, size_t probe_rows_length,
+  uint8_t **output_rows, size_t *output_rows_length) {
+
+  // Hold a reference so that a concurrent broadcast_release cannot free the build side mid-probe
+  sgx_spin_lock(&broadcast_build_sides_lock);
+  auto it = broadcast_build_sides.find(handle);
+  std::shared_ptr<HashJoinBuildSide> build_side =
+    it != broadcast_build_sides.end() ? it->second : nullptr;
+  sgx_spin_unlock(&broadcast_build_sides_lock);
+  check(build_side != nullptr, "broadcast_probe: unknown build side handle %d\n", handle);
+
+  FlatbuffersRowWriter w;
+  build_side->probe(probe_rows, probe_rows_length, w);
+
+  w.finish(w.write_encrypted_blocks());
+  *output_rows = w.output_buffer().release();
+  *output_rows_length = w.output_size();
+}
+
+void broadcast_release(uint64_t handle) {
+  sgx_spin_lock(&broadcast_build_sides_lock);
+  size_t num_erased = broadcast_build_sides.erase(handle);
+  sgx_spin_unlock(&broadcast_build_sides_lock);
+  check(num_erased == 1, "broadcast_release: unknown build side handle %d\n", handle);
+}
+
+// Bits per expected key and hash functions per key of a Bloom filter, for a false positive rate
+// of about 1%
+#define BLOOM_FILTER_BITS_PER_KEY 10
+#define BLOOM_FILTER_NUM_HASHES 7
+// Largest Bloom filter, in bits (16 MB)
+#define BLOOM_FILTER_MAX_BITS (1u << 27)
+
+/**
+ * A Bloom filter over normalized join keys. Filters built for the same expected number of keys
+ * have the same size and hash functions, so they can be merged by or-ing their bits. Outside the
+ * enclave a filter is encrypted as a whole: a uint32_t holding the number of bits, followed by the
+ * bits.
+ */
+class BloomFilter {
+public:
+  BloomFilter(uint32_t num_keys) {
+    uint64_t num_bits = 64;
+    while (num_bits < static_cast<uint64_t>(num_keys) * BLOOM_FILTER_BITS_PER_KEY
+           && num_bits < BLOOM_FILTER_MAX_BITS) {
+      num_bits *= 2;
+    }
+    words.resize(num_bits / 64, 0);
+  }
+
+  BloomFilter(const uint8_t *filter, size_t filter_length) {
+    check(filter_length >= enc_size(sizeof(uint32_t)),
+          "Corrupt Bloom filter of length %d\n", filter_length);
+    std::vector<uint8_t> plaintext(dec_size(filter_length));
+    decrypt(filter, filter_length, plaintext.data());
+    uint32_t num_bits;
+    std::memcpy(&num_bits, plaintext.data(), sizeof(uint32_t));
+    check(num_bits >= 64 && num_bits <= BLOOM_FILTER_MAX_BITS && (num_bits & (num_bits - 1)) == 0
+          && plaintext.size() == sizeof(uint32_t) + num_bits / 8,
+          "Corrupt Bloom filter of %d bits\n", num_bits);
+    words.resize(num_bits / 64);
+    std::memcpy(words.data(), plaintext.data() + sizeof(uint32_t), num_bits / 8);
+  }
+
+  void insert(const uint8_t *key, uint32_t key_length) {
+    uint64_t h = hash_join_key(key, key_length, 0);
+    uint64_t mask = words.size() * 64 - 1;
+    for (uint32_t i = 0; i < BLOOM_FILTER_NUM_HASHES; i++) {
+      uint64_t bit = bit_index(h, i) & mask;
+      words[bit / 64] |= static_cast<uint64_t>(1) << (bit % 64);
+    }
+  }
+
+  /** Return false if the given key was definitely not inserted. */
+  bool may_contain(const uint8_t *key, uint32_t key_length) const {
+    uint64_t h = hash_join_key(key, key_length, 0);
+    uint64_t mask = words.size() * 64 - 1;
+    for (uint32_t i = 0; i < BLOOM_FILTER_NUM_HASHES; i++) {
+      uint64_t bit = bit_index(h, i) & mask;
+      if ((words[bit / 64] & (static_cast<uint64_t>(1) << (bit % 64))) == 0) {
+        return false;
       }
     }
+    return true;
+  }
+
+  void merge(const BloomFilter &other) {
+    check(words.size() == other.words.size(),
+          "Cannot merge Bloom filters of %d and %d bits\n",
+          words.size() * 64, other.words.size() * 64);
+    for (uint32_t i = 0; i < words.size(); i++) {
+      words[i] |= other.words[i];
+    }
+  }
+
+  /** Encrypt the filter into untrusted memory. */
+  void write(uint8_t **output_filter, size_t *output_filter_length) const {
+    uint32_t num_bits = words.size() * 64;
+    std::vector<uint8_t> plaintext(sizeof(uint32_t) + num_bits / 8);
+    std::memcpy(plaintext.data(), &num_bits, sizeof(uint32_t));
+    std::memcpy(plaintext.data() + sizeof(uint32_t), words.data(), num_bits / 8);
+
+    *output_filter_length = enc_size(plaintext.size());
+    ocall_malloc(*output_filter_length, output_filter);
+    encrypt(plaintext.data(), plaintext.size(), *output_filter);
+  }
+
+private:
+  /** Double hashing: the ith bit index is derived from the two halves of the key hash. */
+  static uint64_t bit_index(uint64_t h, uint32_t i) {
+    uint32_t h1 = static_cast<uint32_t>(h);
+    uint32_t h2 = static_cast<uint32_t>(h >> 32) | 1;
+    return static_cast<uint64_t>(h1) + static_cast<uint64_t>(i) * h2;
+  }
+
+  std::vector<uint64_t> words;
+};
+
+void build_bloom_filter(
+  uint8_t *join_expr, size_t join_expr_length,
+  uint32_t num_keys,
+  uint8_t *input_rows, size_t input_rows_length,
+  uint8_t **output_filter, size_t *output_filter_length) {
+
+  FlatbuffersJoinExprEvaluator join_expr_eval(join_expr, join_expr_length);
+  EncryptedBlocksToRowReader r(input_rows, input_rows_length);
+  BloomFilter filter(num_keys);
+  std::vector<uint8_t> key;
+  while (r.has_next()) {
+    const tuix::Row *row = r.next();
+    check(join_expr_eval.is_primary(row),
+          "build_bloom_filter: input contains a row from the foreign table\n");
+    key.clear();
+    if (join_expr_eval.append_join_key(row, key)) {
+      filter.insert(key.data(), key.size());
+    }
+  }
+
+  filter.write(output_filter, output_filter_length);
+}
+
+void merge_bloom_filters(
+  uint8_t *filter_a, size_t filter_a_length,
+  uint8_t *filter_b, size_t filter_b_length,
+  uint8_t **output_filter, size_t *output_filter_length) {
+
+  BloomFilter merged(filter_a, filter_a_length);
+  merged.merge(BloomFilter(filter_b, filter_b_length));
+  merged.write(output_filter, output_filter_length);
+}
+
+void bloom_filter_rows(
+  uint8_t *join_expr, size_t join_expr_length,
+  uint8_t *filter, size_t filter_length,
+  uint8_t *input_rows, size_t input_rows_length,
+  uint8_t **output_rows, size_t *output_rows_length) {
+
+  FlatbuffersJoinExprEvaluator join_expr_eval(join_expr, join_expr_length);
+  BloomFilter bloom_filter(filter, filter_length);
+  EncryptedBlocksToRowReader r(input_rows, input_rows_length);
+  FlatbuffersRowWriter w;
+  std::vector<uint8_t> key;
+  while (r.has_next()) {
+    const tuix::Row *row = r.next();
+    if (join_expr_eval.is_primary(row)) {
+      w.write(row);
+      continue;
+    }
+    key.clear();
+    if (join_expr_eval.append_join_key(row, key)
+        && bloom_filter.may_contain(key.data(), key.size())) {
+      w.write(row);
+    }
   }
 
   w.finish(w.write_encrypted_blocks());
@@ -4,15 +4,101 @@
 #ifndef JOIN_H
 #define JOIN_H
 
+/** Write the last row of the primary table in input_rows, if any. */
 void scan_collect_last_primary(
   uint8_t *join_expr, size_t join_expr_length,
   uint8_t *input_rows, size_t input_rows_length,
   uint8_t **output_rows, size_t *output_rows_length);
 
-void non_oblivious_sort_merge_join(
-    uint8_t *join_expr, size_t join_expr_length,
-    uint8_t *input_rows, size_t input_rows_length,
-    uint8_t *join_row, size_t join_row_length,
-    uint8_t **output_rows, size_t *output_rows_length);
+/** Write the first row of the primary table in input_rows, if any. */
+void scan_collect_first_primary(
+  uint8_t *join_expr, size_t join_expr_length,
+  uint8_t *input_rows, size_t input_rows_length,
+  uint8_t **output_rows, size_t *output_rows_length);
+
+/**
+ * Join the rows of the primary table in primary_rows, sorted by the left join keys, with the rows
+ * of the foreign table in foreign_rows, sorted by the right join keys, by merging them. The output
+ * depends on the join type of join_expr (see JoinType in operators.fbs). Each primary row must have
+ * a distinct key, except for semi and anti joins.
+ *
+ * When both tables are range partitioned by the same boundaries, a key that spans several
+ * partitions may have its primary row in any one of them. prev_primary_row and next_primary_row
+ * hold the last primary row of the preceding partitions and the first primary row of the
+ * following partitions (or no rows), so that foreign rows can join with them as well. An unmatched
+ * primary row is padded by the partition that contains it, so LeftOuter and FullOuter joins must
+ * not span partitions.
+ */
+void non_oblivious_merge_join(
+  uint8_t *join_expr, size_t join_expr_length,
+  uint8_t *primary_rows, size_t primary_rows_length,
+  uint8_t *foreign_rows, size_t foreign_rows_length,
+  uint8_t *prev_primary_row, size_t prev_primary_row_length,
+  uint8_t *next_primary_row, size_t next_primary_row_length,
+  uint8_t **output_rows, size_t *output_rows_length);
+
+/**
+ * Join the rows of the primary table in build_rows with the rows of the foreign table in
+ * probe_rows, for a join whose build side fits in HASH_JOIN_MEMORY_BUDGET, or in the smaller budget
+ * requested by the JoinExpr. The build side is decrypted into a hash table keyed by the left join
+ * keys, and the probe side is streamed through it, so neither input needs to be sorted. Like
+ * non_oblivious_merge_join, each primary row must have a distinct key except for semi and anti
+ * joins. For LeftOuter and FullOuter joins, probe_rows must hold every foreign row that can match a
+ * row of build_rows, as after hash partitioning both tables on their join keys, and the build rows
+ * left unmatched are padded.
+ */
+void hash_join(
+  uint8_t *join_expr, size_t join_expr_length,
+  uint8_t *build_rows, size_t build_rows_length,
+  uint8_t *probe_rows, size_t probe_rows_length,
+  uint8_t **output_rows, size_t *output_rows_length);
+
+/**
+ * For a broadcast join, decrypt and index the rows of the primary table in build_rows once, as for
+ * hash_join, and keep them in the enclave. Return a handle that broadcast_probe can use to join
+ * any number of partitions of the foreign table with them, until it is passed to
+ * broadcast_release. Since each probe sees only part of the foreign table, LeftOuter and FullOuter
+ * joins are not supported.
+ */
+uint64_t broadcast_build(
+  uint8_t *join_expr, size_t join_expr_length,
+  uint8_t *build_rows, size_t build_rows_length);
+
+/** Join the rows of the foreign table in probe_rows with the build side with the given handle. */
+void broadcast_probe(
+  uint64_t handle,
+  uint8_t *probe_rows, size_t probe_rows_length,
+  uint8_t **output_rows, size_t *output_rows_length);
+
+/** Free the build side with the given handle. */
+void broadcast_release(uint64_t handle);
+
+/**
+ * For a semi-join reduction, build a Bloom filter over the join keys of the rows of the primary
+ * table in input_rows, sized for num_keys keys in total. Filters built with the same num_keys can
+ * be combined with merge_bloom_filters. The filter is written as a single encrypted buffer.
+ */
+void build_bloom_filter(
+  uint8_t *join_expr, size_t join_expr_length,
+  uint32_t num_keys,
+  uint8_t *input_rows, size_t input_rows_length,
+  uint8_t **output_filter, size_t *output_filter_length);
+
+/** Combine two Bloom filters from build_bloom_filter into one that contains the keys of both. */
+void merge_bloom_filters(
+  uint8_t *filter_a, size_t filter_a_length,
+  uint8_t *filter_b, size_t filter_b_length,
+  uint8_t **output_filter, size_t *output_filter_length);
+
+/**
+ * Drop the rows of the foreign table in input_rows whose join keys are not in the given Bloom
+ * filter, and so cannot join with any row of the primary table. Rows with a null join key are also
+ * dropped. Rows of the primary table are kept.
+ */
+void bloom_filter_rows(
+  uint8_t *join_expr, size_t join_expr_length,
+  uint8_t *filter, size_t filter_length,
+  uint8_t *input_rows, size_t input_rows_length,
+  uint8_t **output_rows, size_t *output_rows_length);
 
 #endif
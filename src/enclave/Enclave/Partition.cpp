@@ -0,0 +1,67 @@
+#include "Partition.h"
+
+#include <memory>
+
+#include <sgx_trts.h>
+
+#include "Crypto.h"
+#include "ExpressionEvaluation.h"
+#include "common.h"
+
+void hash_partition(uint8_t *partition_expr, size_t partition_expr_length,
+                    uint32_t num_partitions,
+                    uint8_t *input_rows, size_t input_rows_length,
+                    uint8_t **output_partition_ptrs, size_t *output_partition_lengths) {
+  flatbuffers::Verifier v(partition_expr, partition_expr_length);
+  check(v.VerifyBuffer<tuix::HashPartitionExpr>(nullptr),
+        "Corrupt HashPartitionExpr %p of length %d\n", partition_expr, partition_expr_length);
+  check(num_partitions > 0, "hash_partition: no output partitions\n");
+
+  const tuix::HashPartitionExpr *expr =
+    flatbuffers::GetRoot<tuix::HashPartitionExpr>(partition_expr);
+  std::vector<std::unique_ptr<FlatbuffersExpressionEvaluator>> key_evaluators;
+  for (auto it = expr->keys()->begin(); it != expr->keys()->end(); ++it) {
+    key_evaluators.emplace_back(new FlatbuffersExpressionEvaluator(*it));
+  }
+
+  sgx_cmac_128bit_key_t hash_key;
+  derive_key("opaque hash partition", &hash_key);
+
+  std::vector<std::unique_ptr<FlatbuffersRowWriter>> writers(num_partitions);
+  for (uint32_t i = 0; i < num_partitions; i++) {
+    writers[i].reset(new FlatbuffersRowWriter());
+  }
+
+  // Rows with a null key all hash alike, so spreading them keeps them from overflowing one
+  // partition. Start at a random partition so that small inputs do not all favor the first.
+  uint32_t next_null_partition;
+  sgx_read_rand(reinterpret_cast<uint8_t *>(&next_null_partition), sizeof(next_null_partition));
+
+  // Hash the normalized key values, so that rows whose keys compare equal land together
+  EncryptedBlocksToRowReader r(input_rows, input_rows_length);
+  std::vector<uint8_t> key;
+  while (r.has_next()) {
+    const tuix::Row *row = r.next();
+    key.clear();
+    bool has_null_key = false;
+    for (auto &evaluator : key_evaluators) {
+      const UnboxedField &value = evaluator->eval_unboxed(row);
+      has_null_key |= value.is_null;
+      append_normalized_key(value, false, key);
+    }
+    if (has_null_key && expr->spread_null_keys()) {
+      writers[next_null_partition++ % num_partitions]->write(row);
+      continue;
+    }
+    uint64_t h = siphash(&hash_key, key.data(), key.size());
+    writers[h % num_partitions]->write(row);
+  }
+  memset(hash_key, 0, sizeof(hash_key));
+
+  for (uint32_t i = 0; i < num_partitions; i++) {
+    FlatbuffersRowWriter &w = *writers[i];
+    w.finish(w.write_encrypted_blocks());
+    output_partition_ptrs[i] = w.output_buffer().release();
+    output_partition_lengths[i] = w.output_size();
+  }
+}
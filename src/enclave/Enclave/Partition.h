@@ -0,0 +1,23 @@
+#include <cstddef>
+#include <cstdint>
+
+#ifndef PARTITION_H
+#define PARTITION_H
+
+/**
+ * Hash-partition the input partition on the keys in the given tuix::HashPartitionExpr, in a
+ * single pass with no sorting or sampling. Rows whose keys are equal (as for a join or grouping)
+ * go to the same output partition, and since the hash is keyed by a key derived from the global
+ * key, two inputs partitioned into the same number of partitions on keys of the same types are
+ * co-partitioned, whichever enclave partitions them. If the HashPartitionExpr asks for it, rows
+ * with a null key are instead spread over all output partitions.
+ *
+ * The hash partitioning is expressed as an array of buffers, one per output partition, each
+ * holding tuix::EncryptedBlocks.
+ */
+void hash_partition(uint8_t *partition_expr, size_t partition_expr_length,
+                    uint32_t num_partitions,
+                    uint8_t *input_rows, size_t input_rows_length,
+                    uint8_t **output_partition_ptrs, size_t *output_partition_lengths);
+
+#endif // PARTITION_H
@@ -20,17 +20,41 @@ void project(uint8_t *project_list, size_t project_list_length,
     project_eval_list.emplace_back(new FlatbuffersExpressionEvaluator(*it));
   }
 
-  EncryptedBlocksToRowReader r(input_rows, input_rows_length);
+  EncryptedBlocksToEncryptedBlockReader r(input_rows, input_rows_length);
+  EncryptedBlockToRowReader block_reader;
   FlatbuffersRowWriter w;
 
-  std::vector<const tuix::Field *> out_fields(project_eval_list.size());
+  std::vector<const UnboxedColumn *> out_columns(project_eval_list.size());
+  std::vector<UnboxedField> out_fields(project_eval_list.size());
 
-  while (r.has_next()) {
-    const tuix::Row *row = r.next();
-    for (uint32_t j = 0; j < project_eval_list.size(); j++) {
-      out_fields[j] = project_eval_list[j]->eval(row);
+  for (auto it = r.begin(); it != r.end(); ++it) {
+    block_reader.reset(*it);
+    const tuix::Rows *rows = block_reader.get_rows();
+
+    // Evaluate each output column on the whole block at once
+    bool batch_ok = true;
+    for (uint32_t j = 0; j < project_eval_list.size() && batch_ok; j++) {
+      out_columns[j] = project_eval_list[j]->eval_batch(rows);
+      batch_ok = out_columns[j] != nullptr;
+    }
+    if (batch_ok) {
+      for (uint32_t i = 0; i < rows->rows()->size(); i++) {
+        for (uint32_t j = 0; j < out_columns.size(); j++) {
+          out_fields[j] = out_columns[j]->get(i);
+        }
+        w.write(out_fields);
+      }
+      continue;
+    }
+
+    // The block's columns are not uniformly typed, so evaluate it one row at a time
+    while (block_reader.has_next()) {
+      const tuix::Row *row = block_reader.next();
+      for (uint32_t j = 0; j < project_eval_list.size(); j++) {
+        out_fields[j] = project_eval_list[j]->eval_unboxed(row);
+      }
+      w.write(out_fields);
     }
-    w.write(out_fields);
   }
 
   w.finish(w.write_encrypted_blocks());
@@ -0,0 +1,265 @@
+#include "Sketch.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "ExpressionEvaluation.h"
+
+// Capacity of the top level of a quantile sketch. The rank error of the sketch is proportional to
+// 1/QUANTILE_SKETCH_K, and it retains about 3 * QUANTILE_SKETCH_K key rows.
+#define QUANTILE_SKETCH_K 256
+
+/** A key row retained by a QuantileSketch, together with its normalized sort key. */
+struct SketchItem {
+  std::vector<uint8_t> key;
+  // A serialized tuix::Row holding only the sort key fields
+  std::vector<uint8_t> key_row;
+};
+
+/**
+ * A KLL quantile sketch over key rows. Level h holds items that each stand for 2^h inserted rows.
+ * Whenever the sketch holds more items than its capacity, the lowest full level is compacted: its
+ * items are sorted, and every other one (starting at a random offset) is promoted to the next level
+ * while the rest are discarded. Lower levels have geometrically smaller capacities, so the sketch
+ * stays small while bounding the rank error.
+ */
+class QuantileSketch {
+public:
+  QuantileSketch(uint32_t k) : k(k), levels(1), size(0) {}
+
+  void insert(SketchItem &&item, uint32_t level) {
+    while (levels.size() <= level) {
+      levels.emplace_back();
+    }
+    levels[level].push_back(std::move(item));
+    size++;
+    compress();
+  }
+
+  /** Write each retained item as a key row followed by an IntegerField holding its level. */
+  void write(FlatbuffersRowWriter &w) {
+    for (uint32_t h = 0; h < levels.size(); h++) {
+      UnboxedField level;
+      level.type = tuix::FieldUnion_IntegerField;
+      level.is_null = false;
+      level.int_value = h;
+      level.string_data = nullptr;
+      level.string_length = 0;
+      for (const SketchItem &item : levels[h]) {
+        write_item(item, &level, w);
+      }
+    }
+  }
+
+  /**
+   * Write up to num_partitions - 1 boundary key rows that split the sketched rows into
+   * num_partitions ranges of about equal weight.
+   *
+   * A key that alone weighs more than one range (a heavy hitter) would otherwise send all of its
+   * rows to a single partition, so it gets one boundary per range that ends within it, each tagged
+   * with a DoubleField holding the fraction of the rows with that key that fall before it. See
+   * partition_for_sort.
+   */
+  void write_quantiles(uint32_t num_partitions, FlatbuffersRowWriter &w) {
+    std::vector<std::pair<const SketchItem *, uint64_t>> weighted;
+    uint64_t total_weight = 0;
+    for (uint32_t h = 0; h < levels.size(); h++) {
+      for (const SketchItem &item : levels[h]) {
+        weighted.emplace_back(&item, static_cast<uint64_t>(1) << h);
+        total_weight += static_cast<uint64_t>(1) << h;
+      }
+    }
+    std::sort(weighted.begin(), weighted.end(),
+              [](const std::pair<const SketchItem *, uint64_t> &a,
+                 const std::pair<const SketchItem *, uint64_t> &b) {
+                return a.first->key < b.first->key;
+              });
+
+    // Range i ends at cumulative weight total_weight * i / num_partitions. Walk the groups of items
+    // with equal keys, each covering the cumulative weights [group_begin, group_end).
+    UnboxedField fraction;
+    fraction.type = tuix::FieldUnion_DoubleField;
+    fraction.is_null = false;
+    fraction.string_data = nullptr;
+    fraction.string_length = 0;
+    uint64_t group_begin = 0;
+    uint32_t boundary = 1;
+    for (uint32_t i = 0; i < weighted.size() && boundary < num_partitions;) {
+      uint32_t group_size = 0;
+      uint64_t group_weight = 0;
+      while (i + group_size < weighted.size()
+             && weighted[i + group_size].first->key == weighted[i].first->key) {
+        group_weight += weighted[i + group_size].second;
+        group_size++;
+      }
+      uint64_t group_end = group_begin + group_weight;
+      bool heavy = group_weight * num_partitions > total_weight;
+
+      bool written = false;
+      while (boundary < num_partitions
+             && total_weight * boundary < group_end * num_partitions) {
+        if (heavy) {
+          fraction.double_value =
+            static_cast<double>(total_weight * boundary - group_begin * num_partitions)
+            / static_cast<double>(group_weight * num_partitions);
+          write_item(*weighted[i].first, &fraction, w);
+        } else if (!written) {
+          write_item(*weighted[i].first, nullptr, w);
+        }
+        written = true;
+        boundary++;
+      }
+
+      group_begin = group_end;
+      i += group_size;
+    }
+  }
+
+private:
+  uint32_t capacity(uint32_t level) {
+    uint32_t result = k;
+    for (uint32_t h = level + 1; h < levels.size(); h++) {
+      result = result * 2 / 3;
+    }
+    return std::max(result, 2u);
+  }
+
+  void compress() {
+    uint32_t total_capacity = 0;
+    for (uint32_t h = 0; h < levels.size(); h++) {
+      total_capacity += capacity(h);
+    }
+    if (size <= total_capacity) {
+      return;
+    }
+
+    for (uint32_t h = 0; h < levels.size(); h++) {
+      if (levels[h].size() >= capacity(h)) {
+        compact(h);
+        return;
+      }
+    }
+  }
+
+  void compact(uint32_t h) {
+    if (h + 1 == levels.size()) {
+      levels.emplace_back();
+    }
+    std::vector<SketchItem> &items = levels[h];
+    std::sort(items.begin(), items.end(), [](const SketchItem &a, const SketchItem &b) {
+      return a.key < b.key;
+    });
+
+    // With an odd number of items, the largest one stays behind
+    std::vector<SketchItem> remaining;
+    if (items.size() % 2 == 1) {
+      remaining.push_back(std::move(items.back()));
+      items.pop_back();
+    }
+
+    uint8_t offset;
+    sgx_read_rand(&offset, 1);
+    for (uint32_t i = offset & 1; i < items.size(); i += 2) {
+      levels[h + 1].push_back(std::move(items[i]));
+    }
+    size -= items.size() / 2;
+    items.swap(remaining);
+  }
+
+  /** Write the key row of the given item, followed by extra_field if it is not null. */
+  void write_item(const SketchItem &item, const UnboxedField *extra_field,
+                  FlatbuffersRowWriter &w) {
+    const tuix::Row *key_row = flatbuffers::GetRoot<tuix::Row>(item.key_row.data());
+    if (extra_field == nullptr) {
+      w.write(key_row);
+      return;
+    }
+    fields.clear();
+    for (auto it = key_row->field_values()->begin(); it != key_row->field_values()->end(); ++it) {
+      fields.push_back(unbox(*it));
+    }
+    fields.push_back(*extra_field);
+    w.write(fields);
+  }
+
+  uint32_t k;
+  std::vector<std::vector<SketchItem>> levels;
+  uint32_t size;
+  std::vector<UnboxedField> fields;
+};
+
+/** Serialize the given fields as a standalone key row. */
+void serialize_key_row(const UnboxedField *fields, uint32_t num_fields,
+                       flatbuffers::FlatBufferBuilder &builder, std::vector<uint8_t> &key_row) {
+  builder.Clear();
+  std::vector<flatbuffers::Offset<tuix::Field>> field_values(num_fields);
+  for (uint32_t i = 0; i < num_fields; i++) {
+    field_values[i] = flatbuffers_box(fields[i], builder);
+  }
+  builder.Finish(tuix::CreateRowDirect(builder, &field_values));
+  key_row.assign(builder.GetBufferPointer(), builder.GetBufferPointer() + builder.GetSize());
+}
+
+void sketch_sort_keys(uint8_t *sort_order, size_t sort_order_length,
+                      uint8_t *input_rows, size_t input_rows_length,
+                      uint8_t **output_rows, size_t *output_rows_length) {
+  FlatbuffersSortOrderEvaluator sort_eval(sort_order, sort_order_length);
+  EncryptedBlocksToRowReader r(input_rows, input_rows_length);
+  QuantileSketch sketch(QUANTILE_SKETCH_K);
+  flatbuffers::FlatBufferBuilder builder;
+
+  while (r.has_next()) {
+    const tuix::Row *row = r.next();
+    const std::vector<UnboxedField> &fields = sort_eval.eval_key_fields(row);
+    SketchItem item;
+    serialize_key_row(fields.data(), fields.size(), builder, item.key_row);
+    sort_eval.append_key_row_key(
+      flatbuffers::GetRoot<tuix::Row>(item.key_row.data()), item.key);
+    sketch.insert(std::move(item), 0);
+  }
+
+  FlatbuffersRowWriter w;
+  sketch.write(w);
+  w.finish(w.write_encrypted_blocks());
+  *output_rows = w.output_buffer().release();
+  *output_rows_length = w.output_size();
+}
+
+void find_range_bounds_from_sketches(uint8_t *sort_order, size_t sort_order_length,
+                                     uint32_t num_partitions,
+                                     uint8_t *sketches, size_t sketches_length,
+                                     uint8_t **output_rows, size_t *output_rows_length) {
+  FlatbuffersSortOrderEvaluator sort_eval(sort_order, sort_order_length);
+  EncryptedBlocksToRowReader r(sketches, sketches_length);
+  QuantileSketch sketch(QUANTILE_SKETCH_K);
+  flatbuffers::FlatBufferBuilder builder;
+  uint32_t num_key_fields = sort_eval.num_key_fields();
+
+  std::vector<UnboxedField> fields;
+  while (r.has_next()) {
+    const tuix::Row *row = r.next();
+    check(row->field_values()->size() == num_key_fields + 1,
+          "Sketch row has %d fields, expected %d\n",
+          row->field_values()->size(), num_key_fields + 1);
+    const tuix::Field *level = row->field_values()->Get(num_key_fields);
+    check(level->value_type() == tuix::FieldUnion_IntegerField,
+          "Sketch row level must be an IntegerField\n");
+
+    SketchItem item;
+    sort_eval.append_key_row_key(row, item.key);
+    fields.clear();
+    for (uint32_t i = 0; i < num_key_fields; i++) {
+      fields.push_back(unbox(row->field_values()->Get(i)));
+    }
+    serialize_key_row(fields.data(), num_key_fields, builder, item.key_row);
+    sketch.insert(std::move(item),
+                  static_cast<const tuix::IntegerField *>(level->value())->value());
+  }
+
+  FlatbuffersRowWriter w;
+  sketch.write_quantiles(num_partitions, w);
+  w.finish(w.write_encrypted_blocks());
+  *output_rows = w.output_buffer().release();
+  *output_rows_length = w.output_size();
+}
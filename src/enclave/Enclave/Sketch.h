@@ -0,0 +1,30 @@
+#include <cstddef>
+#include <cstdint>
+
+#ifndef _SKETCH_H_
+#define _SKETCH_H_
+
+/**
+ * For distributed sorting, summarize the distribution of the sort keys of the input rows in a
+ * compact, mergeable quantile sketch (a KLL sketch) whose size does not depend on the number of
+ * input rows. The sketch is written as EncryptedBlocks of key rows. Each key row holds the values of
+ * the sort expressions for one retained row, followed by an IntegerField level: the key row stands
+ * for 2^level input rows.
+ */
+void sketch_sort_keys(uint8_t *sort_order, size_t sort_order_length,
+                      uint8_t *input_rows, size_t input_rows_length,
+                      uint8_t **output_rows, size_t *output_rows_length);
+
+/**
+ * For distributed sorting, merge the given sketches produced by sketch_sort_keys (concatenated into
+ * a single EncryptedBlocks) and write up to num_partitions - 1 boundary key rows that split the
+ * sketched rows into num_partitions ranges of about equal size. The boundaries can be passed to
+ * partition_for_sort. A sort key that makes up more than one range is split across several
+ * partitions by repeating its boundary, tagged with a trailing DoubleField fraction.
+ */
+void find_range_bounds_from_sketches(uint8_t *sort_order, size_t sort_order_length,
+                                     uint32_t num_partitions,
+                                     uint8_t *sketches, size_t sketches_length,
+                                     uint8_t **output_rows, size_t *output_rows_length);
+
+#endif /* _SKETCH_H_ */
@@ -1,200 +1,640 @@
 #include "Sort.h"
 
 #include <algorithm>
-#include <queue>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <utility>
 
+#include "Crypto.h"
 #include "ExpressionEvaluation.h"
 
-class MergeItem {
- public:
-  const tuix::Row *v;
-  uint32_t run_idx;
-};
+/**
+ * A tournament tree of losers over k sorted runs, holding the current row of each run together
+ * with its cached sort key. Each internal node records the run that lost the match played there,
+ * so after the winning row is consumed, the next row from the same run only has to be replayed
+ * against the losers on the path from its leaf to the root: ceil(log2(k)) comparisons per row, all
+ * on one path through a small contiguous array.
+ *
+ * Exhausted runs lose to every row. Ties go to the lower-numbered run, so merging is stable.
+ */
+class LoserTree {
+public:
+  explicit LoserTree(uint32_t num_runs)
+    : current(num_runs), losers(num_runs), winner(0) {}
 
-flatbuffers::Offset<tuix::EncryptedBlocks> external_merge(
-  SortedRunsReader &r,
-  uint32_t run_start,
-  uint32_t num_runs,
-  FlatbuffersRowWriter &w,
-  FlatbuffersSortOrderEvaluator &sort_eval) {
+  /** The current row of each run, or one with a null row once the run is exhausted. */
+  SortPointer &run(uint32_t i) {
+    return current[i];
+  }
+
+  /** Play the initial tournament once the first row of every run has been set. */
+  void init() {
+    uint32_t k = current.size();
+    winner = 0;
+    if (k <= 1) {
+      return;
+    }
+    // winners[n] is the winner of the subtree rooted at internal node n. Leaf i is node k + i.
+    std::vector<uint32_t> winners(k);
+    for (uint32_t n = k - 1; n >= 1; n--) {
+      uint32_t a = 2 * n >= k ? 2 * n - k : winners[2 * n];
+      uint32_t b = 2 * n + 1 >= k ? 2 * n + 1 - k : winners[2 * n + 1];
+      if (beats(b, a)) {
+        std::swap(a, b);
+      }
+      winners[n] = a;
+      losers[n] = b;
+    }
+    winner = winners[1];
+  }
+
+  /** Return the run holding the smallest current row. */
+  uint32_t top() const {
+    return winner;
+  }
 
-  // Maintain a priority queue with one row per run
-  auto compare = [&sort_eval](const MergeItem &a, const MergeItem &b) {
-    return sort_eval.less_than(b.v, a.v);
+  /** Whether every run is exhausted. */
+  bool empty() const {
+    return current.empty() || current[winner].row == nullptr;
+  }
+
+  /** Restore the tournament after the current row of run top() has been replaced. */
+  void replay() {
+    uint32_t w = winner;
+    for (uint32_t n = (w + current.size()) / 2; n >= 1; n /= 2) {
+      if (beats(losers[n], w)) {
+        std::swap(losers[n], w);
+      }
+    }
+    winner = w;
+  }
+
+private:
+  bool beats(uint32_t a, uint32_t b) const {
+    if (current[a].row == nullptr || current[b].row == nullptr) {
+      return current[b].row == nullptr && (current[a].row != nullptr || a < b);
+    }
+    int cmp = current[a].compare(current[b]);
+    return cmp < 0 || (cmp == 0 && a < b);
+  }
+
+  std::vector<SortPointer> current;
+  // losers[n] is the run that lost at internal node n, for 1 <= n < k. losers[0] is unused.
+  std::vector<uint32_t> losers;
+  uint32_t winner;
+};
+
+/**
+ * Merge num_runs sorted runs into w. next_from_run(i, key) must return the next row of run i and
+ * write its sort key to key, or return nullptr once run i is exhausted. Each returned row must stay
+ * valid until the next call for the same run.
+ */
+template<typename NextFromRun>
+void merge_runs(uint32_t num_runs, NextFromRun next_from_run, FlatbuffersRowWriter &w) {
+  // The key of the current row from each run is stored in run_keys
+  LoserTree tree(num_runs);
+  std::vector<std::vector<uint8_t>> run_keys(num_runs);
+  auto read_from_run = [&](uint32_t i) {
+    std::vector<uint8_t> &key = run_keys[i];
+    key.clear();
+    const tuix::Row *row = next_from_run(i, key);
+    tree.run(i) = SortPointer(row, key.data(), key.size());
   };
-  std::priority_queue<MergeItem, std::vector<MergeItem>, decltype(compare)>
-    queue(compare);
 
-  // Initialize the priority queue with the first row from each run
-  for (uint32_t i = run_start; i < run_start + num_runs; i++) {
-    debug("external_merge: Read first row from run %d\n", i);
-    MergeItem item;
-    item.v = r.next_from_run(i);
-    item.run_idx = i;
-    queue.push(item);
+  // Initialize the tree with the first row from each run
+  for (uint32_t i = 0; i < num_runs; i++) {
+    debug("merge_runs: Read first row from run %d\n", i);
+    read_from_run(i);
   }
+  tree.init();
 
-  // Merge the runs using the priority queue
-  while (!queue.empty()) {
-    MergeItem item = queue.top();
-    queue.pop();
-    w.write(item.v);
+  // Repeatedly output the smallest row and replace it with the next row from the same run
+  while (!tree.empty()) {
+    uint32_t i = tree.top();
+    w.write(tree.run(i).row);
+    read_from_run(i);
+    tree.replay();
+  }
+}
+
+// Longest normalized key for which sort_encrypted_blocks uses radix sort. A key of up to two
+// longs, ints or dates (each one null flag plus 4 or 8 bytes) fits.
+#define MAX_RADIX_KEY_LENGTH 18
 
-    // Read another row from the same run that this one came from
-    if (r.run_has_next(item.run_idx)) {
-      item.v = r.next_from_run(item.run_idx);
-      queue.push(item);
+struct RadixItem {
+  uint8_t key[MAX_RADIX_KEY_LENGTH];
+  const tuix::Row *row;
+};
+
+/**
+ * Sort items by their first key_length key bytes using a stable LSD radix sort, one byte per pass
+ * from the last byte to the first. Passes over a byte that is the same in every key are skipped,
+ * which is common for null flags and for the high bytes of small integers.
+ */
+void radix_sort(std::vector<RadixItem> &items, uint32_t key_length) {
+  // Histogram every byte position in a single scan. The counts do not depend on the order of the
+  // items, so they stay valid across passes.
+  std::vector<uint32_t> counts(key_length * 256, 0);
+  for (const RadixItem &item : items) {
+    for (uint32_t b = 0; b < key_length; b++) {
+      counts[b * 256 + item.key[b]]++;
     }
   }
-  return w.write_encrypted_blocks();
+
+  std::vector<RadixItem> buf(items.size());
+  for (uint32_t b = key_length; b-- > 0; ) {
+    uint32_t *count = &counts[b * 256];
+    if (count[items[0].key[b]] == items.size()) {
+      continue;
+    }
+    uint32_t offsets[256];
+    uint32_t offset = 0;
+    for (uint32_t d = 0; d < 256; d++) {
+      offsets[d] = offset;
+      offset += count[d];
+    }
+    for (const RadixItem &item : items) {
+      buf[offsets[item.key[b]]++] = item;
+    }
+    items.swap(buf);
+  }
 }
 
-flatbuffers::Offset<tuix::EncryptedBlocks> sort_single_encrypted_block(
-  FlatbuffersRowWriter &w,
-  const tuix::EncryptedBlock *block,
-  FlatbuffersSortOrderEvaluator &sort_eval) {
+/**
+ * Sort the rows of the given blocks together, calling emit(row, key, key_length) on each row in
+ * sorted order along with its sort key. All of the blocks are decrypted into enclave memory at
+ * once.
+ */
+template<typename Emit>
+void sort_encrypted_blocks(const std::vector<const tuix::EncryptedBlock *> &blocks,
+                           FlatbuffersSortOrderEvaluator &sort_eval,
+                           Emit emit) {
+  std::vector<EncryptedBlockToRowReader> readers(blocks.size());
+  std::vector<const tuix::Row *> rows;
+  for (uint32_t j = 0; j < blocks.size(); j++) {
+    readers[j].reset(blocks[j]);
+    rows.insert(rows.end(), readers[j].begin(), readers[j].end());
+  }
 
-  EncryptedBlockToRowReader r;
-  r.reset(block);
-  std::vector<const tuix::Row *> sort_ptrs(r.begin(), r.end());
+  // Compute each row's sort key once, storing all keys contiguously
+  std::vector<uint8_t> keys;
+  std::vector<uint32_t> key_offsets;
+  for (const tuix::Row *row : rows) {
+    key_offsets.push_back(keys.size());
+    sort_eval.append_key(row, keys);
+  }
+  key_offsets.push_back(keys.size());
+  uint32_t num_rows = rows.size();
 
-  std::sort(
-    sort_ptrs.begin(), sort_ptrs.end(),
-    [&sort_eval](const tuix::Row *a, const tuix::Row *b) {
-      return sort_eval.less_than(a, b);
-    });
+  // Every key has the same short length when all sort columns are integers, longs, dates, floats
+  // or doubles. Comparing such keys bytewise is the same as comparing them as fixed-width
+  // integers, so they can be radix sorted.
+  uint32_t key_length = num_rows > 0 ? key_offsets[1] : 0;
+  bool fixed_length_keys = num_rows > 1 && key_length <= MAX_RADIX_KEY_LENGTH;
+  for (uint32_t i = 0; fixed_length_keys && i < num_rows; i++) {
+    fixed_length_keys = key_offsets[i + 1] - key_offsets[i] == key_length;
+  }
+
+  if (fixed_length_keys) {
+    std::vector<RadixItem> items(num_rows);
+    for (uint32_t i = 0; i < num_rows; i++) {
+      memcpy(items[i].key, keys.data() + key_offsets[i], key_length);
+      items[i].row = rows[i];
+    }
+
+    radix_sort(items, key_length);
+
+    for (const RadixItem &item : items) {
+      emit(item.row, item.key, key_length);
+    }
+    return;
+  }
+
+  std::vector<SortPointer> sort_ptrs;
+  sort_ptrs.reserve(num_rows);
+  for (uint32_t i = 0; i < num_rows; i++) {
+    sort_ptrs.emplace_back(
+      rows[i], keys.data() + key_offsets[i], key_offsets[i + 1] - key_offsets[i]);
+  }
+
+  std::sort(sort_ptrs.begin(), sort_ptrs.end());
 
   for (auto it = sort_ptrs.begin(); it != sort_ptrs.end(); ++it) {
-    w.write(*it);
+    emit(it->row, it->key, it->key_length);
   }
+}
+
+/** Sort the rows of the given blocks together into a single sorted run written to w. */
+flatbuffers::Offset<tuix::EncryptedBlocks> sort_encrypted_blocks(
+  FlatbuffersRowWriter &w,
+  const std::vector<const tuix::EncryptedBlock *> &blocks,
+  FlatbuffersSortOrderEvaluator &sort_eval) {
+
+  sort_encrypted_blocks(
+    blocks, sort_eval,
+    [&w](const tuix::Row *row, const uint8_t *, uint32_t) {
+      w.write(row);
+    });
   return w.write_encrypted_blocks();
 }
 
+/**
+ * A sorted run waiting to be merged. A run written during the sort owns its untrusted buffer,
+ * while a run that is part of a SortedRuns passed in by the caller does not.
+ */
+struct SortedRun {
+  SortedRun(std::unique_ptr<uint8_t, decltype(&ocall_free)> owned_buf, size_t len)
+    : buf(std::move(owned_buf)) {
+    flatbuffers::Verifier v(buf.get(), len);
+    check(v.VerifyBuffer<tuix::EncryptedBlocks>(nullptr),
+          "Corrupt EncryptedBlocks %p of length %d\n", buf.get(), len);
+    blocks = flatbuffers::GetRoot<tuix::EncryptedBlocks>(buf.get());
+  }
+
+  explicit SortedRun(const tuix::EncryptedBlocks *blocks)
+    : buf(nullptr, &ocall_free), blocks(blocks) {}
+
+  std::unique_ptr<uint8_t, decltype(&ocall_free)> buf;
+  const tuix::EncryptedBlocks *blocks;
+};
+
+/**
+ * Return the number of runs that each merge should combine when merging num_runs sorted runs using
+ * about memory_budget bytes of enclave memory. Each run being merged holds one decrypted block.
+ */
+uint32_t merge_fan_in(uint32_t num_runs, size_t memory_budget) {
+  uint32_t fan_in = std::max<size_t>(memory_budget / MAX_BLOCK_SIZE, 2);
+  return std::min(fan_in, num_runs);
+}
+
+/**
+ * Merge the given sorted runs into a single sorted run and finish w with it as an EncryptedBlocks,
+ * using about memory_budget bytes of enclave memory. If block_index is not nullptr, the first row
+ * of every block of the result is also written to it.
+ *
+ * Runs are merged fan_in at a time by decrypting an EncryptedBlock from each one, merging them
+ * within the enclave using a loser tree, and re-encrypting to a new run. Runs are merged in FIFO
+ * order so that each merge combines the shortest remaining runs. The first merge combines just
+ * enough runs that every later merge, and in particular the final one, is a full fan_in-way merge;
+ * this minimizes the amount of data that passes through more than one merge.
+ */
+void merge_sorted_runs(FlatbuffersSortOrderEvaluator &sort_eval,
+                       std::deque<SortedRun> &runs,
+                       size_t memory_budget,
+                       FlatbuffersRowWriter &w,
+                       FlatbuffersRowWriter *block_index) {
+  uint32_t fan_in = merge_fan_in(runs.size(), memory_budget);
+  uint32_t num_to_merge = runs.size();
+  if (runs.size() > 1) {
+    num_to_merge = (runs.size() - 1) % (fan_in - 1) + 1;
+    if (num_to_merge == 1) {
+      num_to_merge = fan_in;
+    }
+  }
+  while (true) {
+    bool final_merge = num_to_merge == runs.size();
+    debug("merge_sorted_runs: Merging %d of %d runs\n", num_to_merge, runs.size());
+
+    std::vector<EncryptedBlocksToRowReader> readers;
+    for (uint32_t j = 0; j < num_to_merge; j++) {
+      readers.emplace_back(runs[j].blocks);
+    }
+    w.clear();
+    if (final_merge) {
+      w.set_block_index(block_index);
+    }
+    merge_runs(
+      num_to_merge,
+      [&](uint32_t j, std::vector<uint8_t> &key) -> const tuix::Row * {
+        if (!readers[j].has_next()) {
+          return nullptr;
+        }
+        const tuix::Row *row = readers[j].next();
+        sort_eval.append_key(row, key);
+        return row;
+      },
+      w);
+    w.finish(w.write_encrypted_blocks());
+    readers.clear();
+    runs.erase(runs.begin(), runs.begin() + num_to_merge);
+
+    if (final_merge) {
+      w.set_block_index(nullptr);
+      return;
+    }
+    runs.emplace_back(w.output_buffer(), w.output_size());
+    num_to_merge = fan_in;
+  }
+}
+
+/**
+ * Sort blocks [begin_block, end_block) of the input into a single sorted run and finish w with it
+ * as an EncryptedBlocks, using about memory_budget bytes of enclave memory. If block_index is not
+ * nullptr, the first row of every block of the run is also written to it.
+ */
+void sort_block_range(FlatbuffersSortOrderEvaluator &sort_eval,
+                      EncryptedBlocksToEncryptedBlockReader &input,
+                      uint32_t begin_block, uint32_t end_block,
+                      size_t memory_budget,
+                      FlatbuffersRowWriter &w,
+                      FlatbuffersRowWriter *block_index) {
+  // 1. Generate sorted runs by decrypting as many consecutive EncryptedBlocks as fit in the memory
+  // budget (but at least one), sorting them together within the enclave, and re-encrypting them to
+  // a separate buffer per run. The size of the encrypted rows stands in for their decrypted size.
+  std::deque<SortedRun> runs;
+  {
+    size_t total_bytes = 0;
+    uint32_t i = begin_block;
+    for (auto it = input.begin() + begin_block; i < end_block; ++it, ++i) {
+      total_bytes += it->enc_rows()->size();
+    }
+    if (end_block - begin_block <= 1 || total_bytes <= memory_budget) {
+      // All blocks fit in one run, so sort them directly into the final run
+      std::vector<const tuix::EncryptedBlock *> run_blocks(input.begin() + begin_block,
+                                                           input.begin() + end_block);
+      w.set_block_index(block_index);
+      w.finish(sort_encrypted_blocks(w, run_blocks, sort_eval));
+      w.set_block_index(nullptr);
+      return;
+    }
+
+    std::vector<const tuix::EncryptedBlock *> run_blocks;
+    size_t run_bytes = 0;
+    auto write_run = [&]() {
+      debug("Sorting %d buffers into run %d\n", run_blocks.size(), runs.size());
+      w.clear();
+      w.finish(sort_encrypted_blocks(w, run_blocks, sort_eval));
+      runs.emplace_back(w.output_buffer(), w.output_size());
+      run_blocks.clear();
+      run_bytes = 0;
+    };
+    i = begin_block;
+    for (auto it = input.begin() + begin_block; i < end_block; ++it, ++i) {
+      size_t block_bytes = it->enc_rows()->size();
+      if (!run_blocks.empty() && run_bytes + block_bytes > memory_budget) {
+        write_run();
+      }
+      run_blocks.push_back(*it);
+      run_bytes += block_bytes;
+    }
+    write_run();
+  }
+
+  // 2. Merge the sorted runs
+  merge_sorted_runs(sort_eval, runs, memory_budget, w, block_index);
+}
+
 void external_sort(uint8_t *sort_order, size_t sort_order_length,
                    uint8_t *input_rows, size_t input_rows_length,
                    uint8_t **output_rows, size_t *output_rows_length) {
   FlatbuffersSortOrderEvaluator sort_eval(sort_order, sort_order_length);
-
-  // 1. Sort each EncryptedBlock individually by decrypting it, sorting within the enclave, and
-  // re-encrypting to a different buffer.
+  EncryptedBlocksToEncryptedBlockReader r(input_rows, input_rows_length);
   FlatbuffersRowWriter w;
-  {
-    EncryptedBlocksToEncryptedBlockReader r(input_rows, input_rows_length);
-    std::vector<flatbuffers::Offset<tuix::EncryptedBlocks>> runs;
-    uint32_t i = 0;
-    for (auto it = r.begin(); it != r.end(); ++it, ++i) {
-      debug("Sorting buffer %d with %d rows\n", i, it->num_rows());
-      runs.push_back(sort_single_encrypted_block(w, *it, sort_eval));
-    }
-    if (runs.size() > 1) {
-      w.finish(w.write_sorted_runs(runs));
-    } else if (runs.size() == 1) {
-      w.finish(runs[0]);
-      *output_rows = w.output_buffer().release();
-      *output_rows_length = w.output_size();
-      return;
-    } else {
-      w.finish(w.write_encrypted_blocks());
-      *output_rows = w.output_buffer().release();
-      *output_rows_length = w.output_size();
-      return;
-    }
+  sort_block_range(sort_eval, r, 0, r.num_blocks(), SORT_MEMORY_BUDGET, w, nullptr);
+  *output_rows = w.output_buffer().release();
+  *output_rows_length = w.output_size();
+}
+
+void external_merge(uint8_t *sort_order, size_t sort_order_length,
+                    uint8_t *input_runs, size_t input_runs_length,
+                    uint8_t **output_rows, size_t *output_rows_length) {
+  FlatbuffersSortOrderEvaluator sort_eval(sort_order, sort_order_length);
+
+  flatbuffers::Verifier v(input_runs, input_runs_length);
+  check(v.VerifyBuffer<tuix::SortedRuns>(nullptr),
+        "Corrupt SortedRuns %p of length %d\n", input_runs, input_runs_length);
+  const tuix::SortedRuns *sorted_runs = flatbuffers::GetRoot<tuix::SortedRuns>(input_runs);
+  std::deque<SortedRun> runs;
+  for (auto it = sorted_runs->runs()->begin(); it != sorted_runs->runs()->end(); ++it) {
+    runs.emplace_back(*it);
   }
 
-  // 2. Merge sorted runs. Initially each buffer forms a sorted run. We merge B runs at a time by
-  // decrypting an EncryptedBlock from each one, merging them within the enclave using a priority
-  // queue, and re-encrypting to a different buffer.
-  auto runs_buf = w.output_buffer();
-  auto runs_len = w.output_size();
-  SortedRunsReader r(runs_buf.get(), runs_len);
-  while (r.num_runs() > 1) {
-    debug("external_sort: Merging %d runs, up to %d at a time\n",
-         r.num_runs(), MAX_NUM_STREAMS);
+  FlatbuffersRowWriter w;
+  merge_sorted_runs(sort_eval, runs, SORT_MEMORY_BUDGET, w, nullptr);
+  *output_rows = w.output_buffer().release();
+  *output_rows_length = w.output_size();
+}
 
-    w.clear();
-    std::vector<flatbuffers::Offset<tuix::EncryptedBlocks>> runs;
-    for (uint32_t run_start = 0; run_start < r.num_runs(); run_start += MAX_NUM_STREAMS) {
-      uint32_t num_runs =
-        std::min(MAX_NUM_STREAMS, static_cast<uint32_t>(r.num_runs()) - run_start);
-      debug("external_sort: Merging buffers %d-%d\n", run_start, run_start + num_runs - 1);
+void external_sort_chunk(uint8_t *sort_order, size_t sort_order_length,
+                         uint32_t chunk_idx, uint32_t num_chunks,
+                         uint8_t *input_rows, size_t input_rows_length,
+                         uint8_t **output_run, size_t *output_run_length,
+                         uint8_t **output_index, size_t *output_index_length) {
+  check(chunk_idx < num_chunks, "Chunk %d out of range (%d chunks)\n", chunk_idx, num_chunks);
+  FlatbuffersSortOrderEvaluator sort_eval(sort_order, sort_order_length);
+  EncryptedBlocksToEncryptedBlockReader r(input_rows, input_rows_length);
+
+  // Divide the blocks as evenly as possible among the chunks
+  uint64_t num_blocks = r.num_blocks();
+  uint32_t begin_block = static_cast<uint32_t>(num_blocks * chunk_idx / num_chunks);
+  uint32_t end_block = static_cast<uint32_t>(num_blocks * (chunk_idx + 1) / num_chunks);
+
+  // The chunks are sorted concurrently, so they share the memory budget
+  size_t memory_budget = std::max<size_t>(SORT_MEMORY_BUDGET / num_chunks, MAX_BLOCK_SIZE);
 
-      runs.push_back(external_merge(r, run_start, num_runs, w, sort_eval));
+  FlatbuffersRowWriter w;
+  FlatbuffersRowWriter index_w;
+  sort_block_range(sort_eval, r, begin_block, end_block, memory_budget, w, &index_w);
+  *output_run = w.output_buffer().release();
+  *output_run_length = w.output_size();
+
+  index_w.finish(index_w.write_encrypted_blocks());
+  *output_index = index_w.output_buffer().release();
+  *output_index_length = index_w.output_size();
+}
+
+void merge_sorted_range(uint8_t *sort_order, size_t sort_order_length,
+                        uint32_t num_runs,
+                        uint8_t **runs, size_t *run_lengths,
+                        uint8_t **run_indexes, size_t *run_index_lengths,
+                        uint32_t range_idx, uint32_t num_ranges,
+                        uint8_t **output_rows, size_t *output_rows_length) {
+  check(range_idx < num_ranges, "Range %d out of range (%d ranges)\n", range_idx, num_ranges);
+  FlatbuffersSortOrderEvaluator sort_eval(sort_order, sort_order_length);
+
+  // Compute the key of the first row of every block of every run. Block j of run i starts with the
+  // row whose key is block_keys[i][j].
+  std::vector<std::vector<std::vector<uint8_t>>> block_keys(num_runs);
+  std::vector<const std::vector<uint8_t> *> all_block_keys;
+  for (uint32_t i = 0; i < num_runs; i++) {
+    EncryptedBlocksToRowReader index(run_indexes[i], run_index_lengths[i]);
+    while (index.has_next()) {
+      block_keys[i].emplace_back();
+      sort_eval.append_key(index.next(), block_keys[i].back());
     }
+  }
+  for (uint32_t i = 0; i < num_runs; i++) {
+    for (const std::vector<uint8_t> &key : block_keys[i]) {
+      all_block_keys.push_back(&key);
+    }
+  }
 
-    if (runs.size() > 1) {
-      w.finish(w.write_sorted_runs(runs));
-      runs_buf = w.output_buffer();
-      runs_len = w.output_size();
-      r.reset(runs_buf.get(), runs_len);
-    } else {
-      // Done merging. Return the single remaining sorted run.
-      w.finish(runs[0]);
-      *output_rows = w.output_buffer().release();
-      *output_rows_length = w.output_size();
-      return;
+  // Choose splitters so that each range covers about the same number of blocks. Every range
+  // computes the same splitters, so the ranges partition the key space without coordination.
+  // This range contains the rows with keys in [lower, upper), where nullptr means unbounded.
+  std::sort(all_block_keys.begin(), all_block_keys.end(),
+            [](const std::vector<uint8_t> *a, const std::vector<uint8_t> *b) {
+              return *a < *b;
+            });
+  auto splitter = [&](uint32_t boundary) -> const std::vector<uint8_t> * {
+    if (boundary == 0 || boundary == num_ranges || all_block_keys.empty()) {
+      return nullptr;
+    }
+    return all_block_keys[static_cast<uint64_t>(all_block_keys.size()) * boundary / num_ranges];
+  };
+  const std::vector<uint8_t> *lower = splitter(range_idx);
+  const std::vector<uint8_t> *upper = splitter(range_idx + 1);
+
+  // Open each run at the last block that starts before the lower bound, since it may contain rows
+  // in this range. Earlier blocks are never decrypted.
+  std::vector<EncryptedBlocksToRowReader> readers;
+  for (uint32_t i = 0; i < num_runs; i++) {
+    uint32_t first_block = 0;
+    if (lower != nullptr) {
+      auto it = std::lower_bound(block_keys[i].begin(), block_keys[i].end(), *lower);
+      first_block = it == block_keys[i].begin() ? 0 : (it - block_keys[i].begin()) - 1;
     }
+    readers.emplace_back(runs[i], run_lengths[i], first_block);
   }
+
+  // If there are no rows, there are no block keys and every range is unbounded, but then there is
+  // nothing to merge either
+  FlatbuffersRowWriter w;
+  merge_runs(
+    num_runs,
+    [&](uint32_t i, std::vector<uint8_t> &key) -> const tuix::Row * {
+      while (readers[i].has_next()) {
+        const tuix::Row *row = readers[i].next();
+        key.clear();
+        sort_eval.append_key(row, key);
+        if (lower != nullptr && key < *lower) {
+          continue;
+        }
+        return upper == nullptr || key < *upper ? row : nullptr;
+      }
+      return nullptr;
+    },
+    w);
+  w.finish(w.write_encrypted_blocks());
+  *output_rows = w.output_buffer().release();
+  *output_rows_length = w.output_size();
 }
 
-void sample(uint8_t *input_rows, size_t input_rows_length,
-			uint8_t **output_rows, size_t *output_rows_length) {
+void top_k(uint8_t *sort_order, size_t sort_order_length,
+           uint32_t num_rows,
+           uint8_t *input_rows, size_t input_rows_length,
+           uint8_t **output_rows, size_t *output_rows_length) {
+  FlatbuffersSortOrderEvaluator sort_eval(sort_order, sort_order_length);
   EncryptedBlocksToRowReader r(input_rows, input_rows_length);
-  FlatbuffersRowWriter w;
 
-  // Sample ~5% of the rows or 1000 rows, whichever is greater
-  uint16_t sampling_ratio;
-  if (r.num_rows() > 1000 * 20) {
-    sampling_ratio = 3276; // 5% of 2^16
-  } else {
-    sampling_ratio = 16383;
-  }
+  // Keep the best rows seen so far in slots, along with their sort keys. heap is a max-heap of
+  // slot indices ordered by key, so its top is the worst row that is currently kept.
+  std::vector<std::unique_ptr<FlatbuffersTemporaryRow>> rows;
+  std::vector<std::vector<uint8_t>> keys;
+  std::vector<uint32_t> heap;
+  auto compare = [&keys](uint32_t a, uint32_t b) {
+    return keys[a] < keys[b];
+  };
 
-  while (r.has_next()) {
+  std::vector<uint8_t> key;
+  size_t kept_bytes = 0;
+  while (r.has_next() && num_rows > 0) {
     const tuix::Row *row = r.next();
+    key.clear();
+    sort_eval.append_key(row, key);
 
-    uint16_t rand;
-    sgx_read_rand(reinterpret_cast<uint8_t *>(&rand), 2);
-    if (rand <= sampling_ratio) {
-      w.write(row);
+    if (heap.size() < num_rows) {
+      // Fill a new slot
+      uint32_t slot = rows.size();
+      rows.emplace_back(new FlatbuffersTemporaryRow(row));
+      keys.push_back(key);
+      heap.push_back(slot);
+      std::push_heap(heap.begin(), heap.end(), compare);
+      kept_bytes += rows[slot]->size() + keys[slot].size();
+    } else if (key < keys[heap.front()]) {
+      // Evict the worst row and reuse its slot. Rows that would not be kept are never copied.
+      std::pop_heap(heap.begin(), heap.end(), compare);
+      uint32_t slot = heap.back();
+      kept_bytes -= rows[slot]->size() + keys[slot].size();
+      rows[slot]->set(row);
+      keys[slot].swap(key);
+      std::push_heap(heap.begin(), heap.end(), compare);
+      kept_bytes += rows[slot]->size() + keys[slot].size();
+    } else {
+      continue;
     }
+    check(kept_bytes <= SORT_MEMORY_BUDGET,
+          "top_k: the first %d rows take more than %d bytes of enclave memory\n",
+          num_rows, SORT_MEMORY_BUDGET);
   }
 
+  std::sort_heap(heap.begin(), heap.end(), compare);
+
+  FlatbuffersRowWriter w;
+  for (uint32_t slot : heap) {
+    w.write(rows[slot]->get());
+  }
   w.finish(w.write_encrypted_blocks());
   *output_rows = w.output_buffer().release();
   *output_rows_length = w.output_size();
 }
 
-void find_range_bounds(uint8_t *sort_order, size_t sort_order_length,
-                       uint32_t num_partitions,
-                       uint8_t *input_rows, size_t input_rows_length,
-                       uint8_t **output_rows, size_t *output_rows_length) {
-  // Sort the input rows
-  uint8_t *sorted_rows;
-  size_t sorted_rows_length;
-  external_sort(sort_order, sort_order_length,
-                input_rows, input_rows_length,
-                &sorted_rows, &sorted_rows_length);
-
-  // Split them into one range per partition
-  EncryptedBlocksToRowReader r(sorted_rows, sorted_rows_length);
-  FlatbuffersRowWriter w;
-  uint32_t num_rows_per_part = r.num_rows() / num_partitions;
-  uint32_t current_rows_in_part = 0;
+void sample(uint8_t *sort_order, size_t sort_order_length,
+            uint32_t sample_size,
+            uint8_t *input_rows, size_t input_rows_length,
+            uint8_t **output_rows, size_t *output_rows_length) {
+  check(sample_size > 0, "sample: sample_size must be positive\n");
+  check(sort_order_length > 0, "sample: sort_order must not be empty\n");
+  EncryptedBlocksToRowReader r(input_rows, input_rows_length);
+
+  // The sample is written in the format of sketch_sort_keys, with every row standing for 2^level
+  // input rows. Keep about num_rows / 2^level rows (between sample_size and 2 * sample_size) so
+  // that the weights add up to the number of input rows.
+  uint32_t num_rows = r.num_rows();
+  uint32_t level = 0;
+  while ((static_cast<uint64_t>(sample_size) << (level + 1)) <= num_rows) {
+    level++;
+  }
+  uint32_t reservoir_size = static_cast<uint32_t>(
+    ((static_cast<uint64_t>(num_rows) + (1ull << level) - 1) >> level));
+
+  // Reservoir sampling: after i rows, each has been kept with probability reservoir_size / i
+  RandomNumberGenerator rng;
+  std::vector<std::unique_ptr<FlatbuffersTemporaryRow>> reservoir;
+  uint64_t num_seen = 0;
   while (r.has_next()) {
     const tuix::Row *row = r.next();
-    if (current_rows_in_part == num_rows_per_part) {
-      w.write(row);
-      current_rows_in_part = 0;
-	} else {
-	  ++current_rows_in_part;
-	}
+    if (reservoir.size() < reservoir_size) {
+      reservoir.emplace_back(new FlatbuffersTemporaryRow(row));
+    } else {
+      uint64_t slot = rng.uniform(num_seen + 1);
+      if (slot < reservoir_size) {
+        reservoir[slot]->set(row);
+      }
+    }
+    num_seen++;
+  }
+
+  FlatbuffersRowWriter w;
+  FlatbuffersSortOrderEvaluator sort_eval(sort_order, sort_order_length);
+  UnboxedField level_field;
+  level_field.type = tuix::FieldUnion_IntegerField;
+  level_field.is_null = false;
+  level_field.int_value = level;
+  level_field.string_data = nullptr;
+  level_field.string_length = 0;
+
+  std::vector<UnboxedField> fields;
+  for (auto &row : reservoir) {
+    fields = sort_eval.eval_key_fields(row->get());
+    fields.push_back(level_field);
+    w.write(fields);
   }
 
   w.finish(w.write_encrypted_blocks());
   *output_rows = w.output_buffer().release();
   *output_rows_length = w.output_size();
-
-  ocall_free(sorted_rows);
 }
 
 void partition_for_sort(uint8_t *sort_order, size_t sort_order_length,
@@ -202,56 +642,427 @@ void partition_for_sort(uint8_t *sort_order, size_t sort_order_length,
                         uint8_t *input_rows, size_t input_rows_length,
                         uint8_t *boundary_rows, size_t boundary_rows_length,
                         uint8_t **output_partition_ptrs, size_t *output_partition_lengths) {
-  // Sort the input rows
-  uint8_t *sorted_rows;
-  size_t sorted_rows_length;
-  external_sort(sort_order, sort_order_length,
-                input_rows, input_rows_length,
-                &sorted_rows, &sorted_rows_length);
-
-  // Scan through the input rows and copy each to the appropriate output partition specified by the
-  // ranges encoded in the given boundary_rows. A range contains all rows greater than or equal to
-  // one boundary row and less than the next boundary row. The first range contains all rows less
-  // than the first boundary row, and the last range contains all rows greater than or equal to the
-  // last boundary row.
   FlatbuffersSortOrderEvaluator sort_eval(sort_order, sort_order_length);
-  EncryptedBlocksToRowReader r(sorted_rows, sorted_rows_length);
-  FlatbuffersRowWriter w;
-  uint32_t output_partition_idx = 0;
 
+  // Normalize the boundary key rows once. A range contains all rows greater than or equal to one
+  // boundary and less than the next boundary. The first range contains all rows less than the
+  // first boundary, and the last range contains all rows greater than or equal to the last
+  // boundary.
+  //
+  // A boundary may be tagged with a fraction f, in which case a row whose key equals the boundary
+  // key falls after it with probability 1 - f. Such boundaries repeat the key of a heavy hitter
+  // with increasing fractions, so its rows are spread over consecutive partitions.
+  std::vector<std::vector<uint8_t>> boundary_keys;
+  std::vector<double> boundary_fractions;
   EncryptedBlocksToRowReader b(boundary_rows, boundary_rows_length);
-  // Invariant: b_upper is the first boundary row strictly greater than the current range, or
-  // nullptr if we are in the last range
-  FlatbuffersTemporaryRow b_upper(b.has_next() ? b.next() : nullptr);
+  uint32_t num_key_fields = sort_eval.num_key_fields();
+  while (b.has_next()) {
+    const tuix::Row *boundary = b.next();
+    boundary_keys.emplace_back();
+    sort_eval.append_key_row_key(boundary, boundary_keys.back());
+    double fraction = 0.0;
+    if (boundary->field_values()->size() > num_key_fields) {
+      const tuix::Field *f = boundary->field_values()->Get(num_key_fields);
+      check(f->value_type() == tuix::FieldUnion_DoubleField,
+            "partition_for_sort: boundary fraction must be a DoubleField\n");
+      fraction = static_cast<const tuix::DoubleField *>(f->value())->value();
+    }
+    boundary_fractions.push_back(fraction);
+  }
+  check(boundary_keys.size() < num_partitions,
+        "partition_for_sort: %d boundary rows for %d partitions\n",
+        boundary_keys.size(), num_partitions);
 
-  while (r.has_next()) {
-    const tuix::Row *row = r.next();
+  // Sort as many consecutive input blocks as fit in the memory budget at a time, and split each
+  // sorted batch at the boundaries. Each batch therefore contributes one sorted run to every output
+  // partition that it has rows for, so that the receiver only needs to merge them.
+  std::vector<std::unique_ptr<FlatbuffersRowWriter>> writers(num_partitions);
+  std::vector<std::vector<flatbuffers::Offset<tuix::EncryptedBlocks>>> runs(num_partitions);
+  std::vector<uint32_t> batch_num_rows(num_partitions);
+  for (uint32_t i = 0; i < num_partitions; i++) {
+    writers[i].reset(new FlatbuffersRowWriter());
+  }
+
+  EncryptedBlocksToEncryptedBlockReader r(input_rows, input_rows_length);
+  std::vector<const tuix::EncryptedBlock *> batch;
+  size_t batch_bytes = 0;
+  RandomNumberGenerator rng;
+  auto compare_to_boundary = [&](const uint8_t *key, uint32_t key_length, uint32_t i) {
+    return compare_strings(key, key_length, boundary_keys[i].data(), boundary_keys[i].size());
+  };
+  auto partition_batch = [&]() {
+    // The rows arrive in sorted order, so the first partition that a row may fall in only ever
+    // advances
+    uint32_t output_partition_idx = 0;
+    std::fill(batch_num_rows.begin(), batch_num_rows.end(), 0);
+    sort_encrypted_blocks(
+      batch, sort_eval,
+      [&](const tuix::Row *row, const uint8_t *key, uint32_t key_length) {
+        int cmp;
+        while (output_partition_idx < boundary_keys.size()
+               && ((cmp = compare_to_boundary(key, key_length, output_partition_idx)) > 0
+                   || (cmp == 0 && boundary_fractions[output_partition_idx] == 0.0))) {
+          output_partition_idx++;
+        }
+        // A row equal to a fractional boundary picks one of the partitions its key spans
+        uint32_t row_partition_idx = output_partition_idx;
+        if (row_partition_idx < boundary_keys.size()
+            && compare_to_boundary(key, key_length, row_partition_idx) == 0) {
+          double u = (rng.next() >> 11) * (1.0 / (static_cast<uint64_t>(1) << 53));
+          while (row_partition_idx < boundary_keys.size()
+                 && compare_to_boundary(key, key_length, row_partition_idx) == 0
+                 && u >= boundary_fractions[row_partition_idx]) {
+            row_partition_idx++;
+          }
+        }
+        writers[row_partition_idx]->write(row);
+        batch_num_rows[row_partition_idx]++;
+      });
+    for (uint32_t i = 0; i < num_partitions; i++) {
+      if (batch_num_rows[i] > 0) {
+        runs[i].push_back(writers[i]->write_encrypted_blocks());
+      }
+    }
+    batch.clear();
+    batch_bytes = 0;
+  };
+  for (auto it = r.begin(); it != r.end(); ++it) {
+    size_t block_bytes = it->enc_rows()->size();
+    if (!batch.empty() && batch_bytes + block_bytes > SORT_MEMORY_BUDGET) {
+      partition_batch();
+    }
+    batch.push_back(*it);
+    batch_bytes += block_bytes;
+  }
+  if (!batch.empty()) {
+    partition_batch();
+  }
 
-    // Advance boundary rows to maintain the invariant on b_upper
-    while (b_upper.get() != nullptr && !sort_eval.less_than(row, b_upper.get())) {
-      b_upper.set(b.has_next() ? b.next() : nullptr);
+  for (uint32_t i = 0; i < num_partitions; i++) {
+    FlatbuffersRowWriter &w = *writers[i];
+    w.finish(w.write_sorted_runs(runs[i]));
+    output_partition_ptrs[i] = w.output_buffer().release();
+    output_partition_lengths[i] = w.output_size();
+  }
+}
 
-      // Write out the newly-finished partition
-      w.finish(w.write_encrypted_blocks());
-      output_partition_ptrs[output_partition_idx] = w.output_buffer().release();
-      output_partition_lengths[output_partition_idx] = w.output_size();
-      w.clear();
-      output_partition_idx++;
+/**
+ * Branch-free comparison of two byte strings of length n: return 1 if a sorts before b and 0
+ * otherwise, after looking at every byte.
+ */
+static uint32_t oblivious_less(const uint8_t *a, const uint8_t *b, uint32_t n) {
+  uint32_t less = 0;
+  uint32_t decided = 0;
+  for (uint32_t i = 0; i < n; i++) {
+    uint32_t lt = (static_cast<uint32_t>(a[i]) - b[i]) >> 31;
+    uint32_t gt = (static_cast<uint32_t>(b[i]) - a[i]) >> 31;
+    less |= lt & ~decided;
+    decided |= lt | gt;
+  }
+  return less & 1;
+}
+
+/**
+ * The sort keys of a group of rows in the oblivious sort, each with the index of its row. Items are
+ * only ever moved by compare_exchange, which compares and swaps them without branching on their
+ * contents, so the instructions executed and the memory accessed depend only on the number of
+ * items.
+ *
+ * Every key has the same width: a dummy flag (so that padding rows sort last), the normalized sort
+ * key padded with zeros, and the big-endian length of the normalized key (so that a key still
+ * sorts after its proper prefixes).
+ */
+class ObliviousItems {
+public:
+  void reset(uint32_t max_key_length) {
+    this->max_key_length = max_key_length;
+    width = 1 + max_key_length + 4;
+    keys.clear();
+    rows.clear();
+  }
+
+  void push_back(const uint8_t *key, uint32_t key_length, bool is_dummy, uint32_t row) {
+    size_t offset = keys.size();
+    keys.resize(offset + width, 0);
+    uint8_t *k = &keys[offset];
+    k[0] = is_dummy;
+    memcpy(k + 1, key, key_length);
+    k = k + 1 + max_key_length;
+    k[0] = key_length >> 24;
+    k[1] = key_length >> 16;
+    k[2] = key_length >> 8;
+    k[3] = key_length;
+    rows.push_back(row);
+  }
+
+  uint32_t row(uint32_t i) {
+    return rows[i];
+  }
+
+  /**
+   * Order items i and j: afterwards, item i sorts no later than item j if ascending, and no earlier
+   * otherwise.
+   */
+  void compare_exchange(uint32_t i, uint32_t j, bool ascending) {
+    uint8_t *a = &keys[static_cast<size_t>(i) * width];
+    uint8_t *b = &keys[static_cast<size_t>(j) * width];
+    uint32_t swap = ascending ? oblivious_less(b, a, width) : oblivious_less(a, b, width);
+    uint8_t key_mask = -static_cast<uint8_t>(swap);
+    for (uint32_t t = 0; t < width; t++) {
+      uint8_t d = (a[t] ^ b[t]) & key_mask;
+      a[t] ^= d;
+      b[t] ^= d;
     }
+    uint32_t d = (rows[i] ^ rows[j]) & -swap;
+    rows[i] ^= d;
+    rows[j] ^= d;
+  }
 
-    w.write(row);
+  /** Sort the n items starting at begin in ascending order. n must be a power of two. */
+  void bitonic_sort(uint32_t begin, uint32_t n) {
+    for (uint32_t k = 2; k <= n; k *= 2) {
+      for (uint32_t j = k / 2; j > 0; j /= 2) {
+        for (uint32_t i = 0; i < n; i++) {
+          uint32_t l = i ^ j;
+          if (l > i) {
+            compare_exchange(begin + i, begin + l, (i & k) == 0);
+          }
+        }
+      }
+    }
   }
 
-  // Write out the final partition. If there were fewer boundary rows than expected output
-  // partitions, write out enough empty partitions to ensure the expected number of output
-  // partitions.
-  while (output_partition_idx < num_partitions) {
-    w.finish(w.write_encrypted_blocks());
-    output_partition_ptrs[output_partition_idx] = w.output_buffer().release();
-    output_partition_lengths[output_partition_idx] = w.output_size();
-    w.clear();
-    output_partition_idx++;
+  /**
+   * Given two ascending runs of n items starting at a and b, move the n smallest items to a (if
+   * ascending) or to b (otherwise), leaving both runs in ascending order. n must be a power of
+   * two.
+   */
+  void merge_split(uint32_t a, uint32_t b, uint32_t n, bool ascending) {
+    // Compare each item of one run with its mirror image in the other, which leaves each run
+    // bitonic and every item of one run no greater than every item of the other
+    for (uint32_t i = 0; i < n; i++) {
+      compare_exchange(a + i, b + n - 1 - i, ascending);
+    }
+    bitonic_merge(a, n);
+    bitonic_merge(b, n);
+  }
+
+private:
+  /** Sort the bitonic sequence of n items starting at begin in ascending order. */
+  void bitonic_merge(uint32_t begin, uint32_t n) {
+    for (uint32_t j = n / 2; j > 0; j /= 2) {
+      for (uint32_t i = 0; i < n; i++) {
+        if ((i & j) == 0) {
+          compare_exchange(begin + i, begin + i + j, true);
+        }
+      }
+    }
+  }
+
+  uint32_t max_key_length;
+  uint32_t width;
+  std::vector<uint8_t> keys;
+  std::vector<uint32_t> rows;
+};
+
+/**
+ * One pass of the oblivious sort over all buckets. Buckets are processed in groups that differ only
+ * in bits [lo_bit, lo_bit + num_bits) of their index, each group being decrypted, put through
+ * every step of the pass in enclave memory, and re-encrypted. A step (k, j) of the bitonic network
+ * merge-splits buckets i and i ^ j, in ascending order if i & k is zero.
+ */
+struct ObliviousPass {
+  uint32_t lo_bit;
+  uint32_t num_bits;
+  std::vector<std::pair<uint32_t, uint32_t>> steps;
+};
+
+void oblivious_sort(uint8_t *sort_order, size_t sort_order_length,
+                    uint8_t *input_rows, size_t input_rows_length,
+                    uint8_t **output_rows, size_t *output_rows_length) {
+  FlatbuffersSortOrderEvaluator sort_eval(sort_order, sort_order_length);
+  EncryptedBlocksToEncryptedBlockReader input(input_rows, input_rows_length);
+  std::vector<const tuix::EncryptedBlock *> input_blocks(input.begin(), input.end());
+  uint32_t num_rows = 0;
+  for (const tuix::EncryptedBlock *block : input_blocks) {
+    num_rows += block->num_rows();
+  }
+
+  FlatbuffersRowWriter out;
+  if (num_rows == 0) {
+    out.finish(out.write_encrypted_blocks());
+    *output_rows = out.output_buffer().release();
+    *output_rows_length = out.output_size();
+    return;
+  }
+
+  // Each bucket holds a power-of-two number of rows, about one block's worth, and there is a
+  // power-of-two number of buckets, padded with dummy rows. A group of up to max_group_size
+  // buckets fits in the memory budget.
+  size_t row_bytes = std::max<size_t>(input_rows_length / num_rows, 1);
+  uint32_t bucket_size = 1;
+  while (static_cast<size_t>(bucket_size) * 2 * row_bytes <= MAX_BLOCK_SIZE) {
+    bucket_size *= 2;
+  }
+  uint32_t num_buckets = 1;
+  while (static_cast<uint64_t>(num_buckets) * bucket_size < num_rows) {
+    num_buckets *= 2;
+  }
+  uint32_t log_group_size = 0;
+  while ((2u << log_group_size) <= std::max<size_t>(SORT_MEMORY_BUDGET / MAX_BLOCK_SIZE, 2)
+         && (1u << log_group_size) < num_buckets) {
+    log_group_size++;
+  }
+
+  // The first pass sorts each group of buckets read from the input. Every later merge stage k
+  // needs the steps j = k/2, ..., 1, which only touch bits log2(j) of the bucket index, so they
+  // are divided into windows of log_group_size bits that each take one pass. The last window of
+  // every stage is aligned to bit 0, so the last pass visits the buckets in order.
+  std::vector<ObliviousPass> passes;
+  passes.push_back(ObliviousPass{0, log_group_size, {}});
+  for (uint32_t k = 2; k <= (1u << log_group_size); k *= 2) {
+    for (uint32_t j = k / 2; j > 0; j /= 2) {
+      passes.back().steps.emplace_back(k, j);
+    }
+  }
+  for (uint32_t log_k = log_group_size + 1; (1u << log_k) <= num_buckets; log_k++) {
+    for (int32_t hi = log_k - 1; hi >= 0;) {
+      uint32_t lo = hi / log_group_size * log_group_size;
+      passes.push_back(ObliviousPass{lo, hi - lo + 1, {}});
+      for (int32_t b = hi; b >= static_cast<int32_t>(lo); b--) {
+        passes.back().steps.emplace_back(1u << log_k, 1u << b);
+      }
+      hi = static_cast<int32_t>(lo) - 1;
+    }
+  }
+
+  std::vector<std::unique_ptr<SortedRun>> buckets(num_buckets);
+  std::vector<std::unique_ptr<EncryptedBlockToRowReader>> readers;
+  std::vector<const tuix::Row *> rows;
+  std::vector<uint8_t> keys;
+  std::vector<uint32_t> key_offsets;
+  ObliviousItems items;
+  FlatbuffersRowWriter w;
+
+  // Padding rows copy the first input row, so they look like any other row once encrypted
+  flatbuffers::FlatBufferBuilder dummy_builder;
+  const tuix::Row *dummy = nullptr;
+
+  uint32_t input_block_idx = 0;
+  uint32_t input_block_first_row = 0;
+  for (uint32_t p = 0; p < passes.size(); p++) {
+    const ObliviousPass &pass = passes[p];
+    uint32_t group_size = 1u << pass.num_bits;
+    uint32_t lo_mask = (1u << pass.lo_bit) - 1;
+    for (uint32_t q = 0; q < num_buckets / group_size; q++) {
+      uint32_t base = (q & lo_mask) | ((q & ~lo_mask) << pass.num_bits);
+
+      // Decrypt the rows of the group
+      readers.clear();
+      rows.clear();
+      if (p == 0) {
+        // The group covers consecutive input rows, starting partway through an input block
+        uint32_t begin = base * bucket_size;
+        uint32_t end = (base + group_size) * bucket_size;
+        while (input_block_idx < input_blocks.size()
+               && input_block_first_row + input_blocks[input_block_idx]->num_rows() <= begin) {
+          input_block_first_row += input_blocks[input_block_idx]->num_rows();
+          input_block_idx++;
+        }
+        uint32_t row_idx = input_block_first_row;
+        for (uint32_t b = input_block_idx; b < input_blocks.size() && row_idx < end; b++) {
+          readers.emplace_back(new EncryptedBlockToRowReader());
+          readers.back()->reset(input_blocks[b]);
+          for (auto it = readers.back()->begin(); it != readers.back()->end(); ++it, ++row_idx) {
+            if (row_idx >= begin && row_idx < end) {
+              rows.push_back(*it);
+            }
+          }
+        }
+        if (dummy == nullptr) {
+          std::vector<flatbuffers::Offset<tuix::Field>> fields;
+          for (auto it = rows[0]->field_values()->begin();
+               it != rows[0]->field_values()->end(); ++it) {
+            fields.push_back(flatbuffers_copy<tuix::Field>(*it, dummy_builder));
+          }
+          dummy_builder.Finish(tuix::CreateRowDirect(dummy_builder, &fields, true));
+          dummy = flatbuffers::GetRoot<tuix::Row>(dummy_builder.GetBufferPointer());
+        }
+        rows.resize(group_size * bucket_size, dummy);
+      } else {
+        for (uint32_t t = 0; t < group_size; t++) {
+          const SortedRun &bucket = *buckets[base | (t << pass.lo_bit)];
+          for (auto it = bucket.blocks->blocks()->begin();
+               it != bucket.blocks->blocks()->end(); ++it) {
+            readers.emplace_back(new EncryptedBlockToRowReader());
+            readers.back()->reset(*it);
+            rows.insert(rows.end(), readers.back()->begin(), readers.back()->end());
+          }
+        }
+        check(rows.size() == group_size * bucket_size,
+              "oblivious_sort: group has %d rows, expected %d\n",
+              rows.size(), group_size * bucket_size);
+      }
+
+      // Build the fixed-width keys of the group
+      keys.clear();
+      key_offsets.clear();
+      for (const tuix::Row *row : rows) {
+        key_offsets.push_back(keys.size());
+        sort_eval.append_key(row, keys);
+      }
+      key_offsets.push_back(keys.size());
+      uint32_t max_key_length = 0;
+      for (uint32_t i = 0; i < rows.size(); i++) {
+        max_key_length = std::max(max_key_length, key_offsets[i + 1] - key_offsets[i]);
+      }
+      items.reset(max_key_length);
+      for (uint32_t i = 0; i < rows.size(); i++) {
+        items.push_back(keys.data() + key_offsets[i], key_offsets[i + 1] - key_offsets[i],
+                        rows[i]->is_dummy(), i);
+      }
+
+      // Run the steps of the pass within the group
+      if (p == 0) {
+        for (uint32_t t = 0; t < group_size; t++) {
+          items.bitonic_sort(t * bucket_size, bucket_size);
+        }
+      }
+      for (const auto &step : pass.steps) {
+        uint32_t k = step.first;
+        uint32_t j = step.second;
+        for (uint32_t t = 0; t < group_size; t++) {
+          uint32_t i = base | (t << pass.lo_bit);
+          if ((i ^ j) > i) {
+            items.merge_split(t * bucket_size, (t ^ (j >> pass.lo_bit)) * bucket_size,
+                              bucket_size, (i & k) == 0);
+          }
+        }
+      }
+
+      // Write the group back, or write the sorted rows to the output after the last pass
+      if (p + 1 == passes.size()) {
+        for (uint32_t i = 0; i < rows.size(); i++) {
+          const tuix::Row *row = rows[items.row(i)];
+          if (!row->is_dummy()) {
+            out.write(row);
+          }
+        }
+      } else {
+        for (uint32_t t = 0; t < group_size; t++) {
+          for (uint32_t i = t * bucket_size; i < (t + 1) * bucket_size; i++) {
+            w.write(rows[items.row(i)]);
+          }
+          w.finish(w.write_encrypted_blocks());
+          buckets[base | (t << pass.lo_bit)].reset(
+            new SortedRun(w.output_buffer(), w.output_size()));
+          w.clear();
+        }
+      }
+    }
   }
 
-  ocall_free(sorted_rows);
+  out.finish(out.write_encrypted_blocks());
+  *output_rows = out.output_buffer().release();
+  *output_rows_length = out.output_size();
 }
@@ -6,38 +6,103 @@
 
 /**
  * Sort an arbitrary number of encrypted input rows by decrypting a limited number of rows at a time
- * into enclave memory, sorting them using quicksort, and re-encrypting them to untrusted memory.
- * The granularity of decryption is a tuix::EncryptedBlock, which should fit entirely in enclave
- * memory.
+ * into enclave memory, sorting them, and re-encrypting them to untrusted memory as sorted runs,
+ * which are then merged. The granularity of decryption is a tuix::EncryptedBlock, which should fit
+ * entirely in enclave memory. Each sorted run covers as many blocks as fit in SORT_MEMORY_BUDGET.
  */
 void external_sort(uint8_t *sort_order, size_t sort_order_length,
                    uint8_t *input_rows, size_t input_rows_length,
                    uint8_t **output_rows, size_t *output_rows_length);
 
 /**
- * For distributed sorting, sample rows from a partition of data so they can be collected to a
- * single machine.
+ * Merge the sorted runs of the given tuix::SortedRuns into a single sorted EncryptedBlocks, as the
+ * merge phase of external_sort does.
  */
-void sample(uint8_t *input_rows, size_t input_rows_length,
-			uint8_t **output_rows, size_t *output_rows_length);
+void external_merge(uint8_t *sort_order, size_t sort_order_length,
+                    uint8_t *input_runs, size_t input_runs_length,
+                    uint8_t **output_rows, size_t *output_rows_length);
 
 /**
- * For distributed sorting, range-partition the input rows and write the boundary rows into
- * output_rows. The input rows are intended to be sampled from a distributed collection of rows from
- * num_partitions different partitions. Only the intermediate boundary rows will be output,
- * producing (up to) num_partitions - 1 rows. If fewer than num_partitions - 1 input rows are
- * provided, then only that many boundary rows will be returned.
+ * First phase of a parallel external sort. Split the input blocks into num_chunks contiguous
+ * chunks and sort chunk chunk_idx into a single sorted run, as external_sort does. Different chunks
+ * can be sorted concurrently from different threads. Also write an index of the run to
+ * output_index, consisting of the first row of each of its blocks.
  */
-void find_range_bounds(uint8_t *sort_order, size_t sort_order_length,
-                       uint32_t num_partitions,
-                       uint8_t *input_rows, size_t input_rows_length,
-                       uint8_t **output_rows, size_t *output_rows_length);
+void external_sort_chunk(uint8_t *sort_order, size_t sort_order_length,
+                         uint32_t chunk_idx, uint32_t num_chunks,
+                         uint8_t *input_rows, size_t input_rows_length,
+                         uint8_t **output_run, size_t *output_run_length,
+                         uint8_t **output_index, size_t *output_index_length);
+
+/**
+ * Second phase of a parallel external sort. Given the sorted runs and indexes produced by
+ * external_sort_chunk, choose num_ranges - 1 splitter keys from the indexes and merge the rows of
+ * all runs that fall into key range range_idx. Every range chooses the same splitters, so the
+ * ranges can be merged concurrently from different threads, and concatenating their outputs in
+ * order yields the fully sorted input. Blocks of a run that lie entirely before the range are not
+ * decrypted.
+ */
+void merge_sorted_range(uint8_t *sort_order, size_t sort_order_length,
+                        uint32_t num_runs,
+                        uint8_t **runs, size_t *run_lengths,
+                        uint8_t **run_indexes, size_t *run_index_lengths,
+                        uint32_t range_idx, uint32_t num_ranges,
+                        uint8_t **output_rows, size_t *output_rows_length);
+
+/**
+ * Write the num_rows smallest input rows according to sort_order to output_rows, in sorted order.
+ * Only num_rows rows are held in enclave memory at a time, and they must fit in SORT_MEMORY_BUDGET.
+ * To find the smallest rows of a distributed collection, call this on each partition and then once
+ * more on the concatenation of the results.
+ */
+void top_k(uint8_t *sort_order, size_t sort_order_length,
+           uint32_t num_rows,
+           uint8_t *input_rows, size_t input_rows_length,
+           uint8_t **output_rows, size_t *output_rows_length);
+
+/**
+ * Sort the input rows obliviously: the sequence of accesses to untrusted memory, and the
+ * comparisons and swaps within the enclave, do not depend on the sort keys. (Copying each row to
+ * its sorted position after a group is sorted does access enclave memory in key order.)
+ *
+ * The rows are padded with dummy rows into a power-of-two number of buckets of a power-of-two
+ * number of rows, and the buckets are sorted with a bitonic network whose compare-exchange is a
+ * merge-split of two sorted buckets. Consecutive steps of the network that involve only a few
+ * bits of the bucket index are run together on a group of buckets held in enclave memory, so each
+ * bucket is re-encrypted once per group of log2(SORT_MEMORY_BUDGET / MAX_BLOCK_SIZE) steps rather
+ * than once per step. Within a group, items are compared and swapped without branching on their
+ * keys.
+ */
+void oblivious_sort(uint8_t *sort_order, size_t sort_order_length,
+                    uint8_t *input_rows, size_t input_rows_length,
+                    uint8_t **output_rows, size_t *output_rows_length);
+
+/**
+ * For distributed sorting, sample rows from a partition of data so they can be collected to a
+ * single machine. The sample is a uniform reservoir sample, so its size does not depend on the
+ * number of input rows.
+ *
+ * Only the values of the sort expressions are written, in the format produced by sketch_sort_keys
+ * (see Sketch.h): between sample_size and 2 * sample_size key rows (or all of them, if there are
+ * fewer), each tagged with a level such that the weights add up to the number of input rows. Such
+ * samples from every partition can be passed to find_range_bounds_from_sketches.
+ */
+void sample(uint8_t *sort_order, size_t sort_order_length,
+            uint32_t sample_size,
+            uint8_t *input_rows, size_t input_rows_length,
+            uint8_t **output_rows, size_t *output_rows_length);
+
 /**
  * For distributed sorting, range-partition the input partition according to the specified
- * boundaries. The boundaries should be obtained by broadcasting the output of find_range_bounds to
- * each partition.
+ * boundaries. The boundaries should be obtained by broadcasting the output of
+ * find_range_bounds_from_sketches to each partition. The input is sorted in memory-sized batches
+ * (without merging), and each batch is split at the boundaries. Rows whose key equals a boundary
+ * tagged with a fraction are spread at random over the partitions that the key spans, so a heavy
+ * hitter does not end up in a single partition.
  *
- * The range partitioning is expressed as an array of buffers, one per output partition.
+ * The range partitioning is expressed as an array of buffers, one per output partition. Each is a
+ * tuix::SortedRuns holding one run per input batch, which the receiver can pass to external_merge
+ * after combining the runs it receives from every partition.
  */
 void partition_for_sort(uint8_t *sort_order, size_t sort_order_length,
                         uint32_t num_partitions,
@@ -3,6 +3,19 @@
 
 #define MAX_BLOCK_SIZE 1000000
 
-#define MAX_NUM_STREAMS 40u
+// Approximate amount of enclave memory that external sort uses to generate each sorted run. It
+// also bounds the fan-in of each merge, since every run being merged holds one decrypted block.
+#define SORT_MEMORY_BUDGET 32000000
+
+// Largest build side, in encrypted bytes, that hash_join holds in enclave memory. Joins with a
+// larger build side are hash partitioned so that each partition fits. A JoinExpr may request a
+// smaller budget.
+#define HASH_JOIN_MEMORY_BUDGET 32000000
+
+// Approximate amount of enclave memory that hash_aggregate uses for its hash table and spill
+// buffers. Rows of groups that do not fit are spilled to untrusted memory and aggregated later.
+// partial_aggregate instead writes out the table when it is full. An AggregateOp may request a
+// smaller budget. Must match EncryptedAggregateExec.
+#define AGGREGATE_MEMORY_BUDGET 32000000
 
 #endif // DEFINE_H
@@ -261,6 +261,12 @@ object Utils {
           tuix.FieldUnion.BooleanField,
           tuix.BooleanField.createBooleanField(builder, b),
           isNull)
+      case (null, BooleanType) =>
+        tuix.Field.createField(
+          builder,
+          tuix.FieldUnion.BooleanField,
+          tuix.BooleanField.createBooleanField(builder, false),
+          isNull)
       case (x: Int, IntegerType) =>
         tuix.Field.createField(
           builder,
@@ -291,6 +297,12 @@ object Utils {
           tuix.FieldUnion.FloatField,
           tuix.FloatField.createFloatField(builder, x),
           isNull)
+      case (null, FloatType) =>
+        tuix.Field.createField(
+          builder,
+          tuix.FieldUnion.FloatField,
+          tuix.FloatField.createFloatField(builder, 0.0f),
+          isNull)
       case (x: Double, DoubleType) =>
         tuix.Field.createField(
           builder,
@@ -309,6 +321,12 @@ object Utils {
           tuix.FieldUnion.DateField,
           tuix.DateField.createDateField(builder, x),
           isNull)
+      case (null, DateType) =>
+        tuix.Field.createField(
+          builder,
+          tuix.FieldUnion.DateField,
+          tuix.DateField.createDateField(builder, 0),
+          isNull)
       case (s: UTF8String, StringType) =>
         val utf8 = s.getBytes()
         tuix.Field.createField(
@@ -679,9 +697,24 @@ object Utils {
     builder.sizedByteArray()
   }
 
+  def serializeHashPartitionExpr(
+      keys: Seq[Expression], input: Seq[Attribute],
+      spreadNullKeys: Boolean = false): Array[Byte] = {
+    val builder = new FlatBufferBuilder
+    builder.finish(
+      tuix.HashPartitionExpr.createHashPartitionExpr(
+        builder,
+        tuix.HashPartitionExpr.createKeysVector(
+          builder,
+          keys.map(e => flatbuffersSerializeExpression(builder, e, input)).toArray),
+        spreadNullKeys))
+    builder.sizedByteArray()
+  }
+
   def serializeJoinExpression(
     joinType: JoinType, leftKeys: Seq[Expression], rightKeys: Seq[Expression],
-    leftSchema: Seq[Attribute], rightSchema: Seq[Attribute]): Array[Byte] = {
+    leftSchema: Seq[Attribute], rightSchema: Seq[Attribute],
+    outputColumns: Option[Seq[Int]] = None, memoryBudget: Long = 0L): Array[Byte] = {
     val builder = new FlatBufferBuilder
     builder.finish(
       tuix.JoinExpr.createJoinExpr(
@@ -702,14 +735,30 @@ object Utils {
           leftKeys.map(e => flatbuffersSerializeExpression(builder, e, leftSchema)).toArray),
         tuix.JoinExpr.createRightKeysVector(
           builder,
-          rightKeys.map(e => flatbuffersSerializeExpression(builder, e, rightSchema)).toArray)))
+          rightKeys.map(e => flatbuffersSerializeExpression(builder, e, rightSchema)).toArray),
+        flatbuffersCreateNullRow(builder, leftSchema),
+        flatbuffersCreateNullRow(builder, rightSchema),
+        outputColumns.map(cols =>
+          tuix.JoinExpr.createOutputColumnsVector(builder, cols.toArray)).getOrElse(0),
+        memoryBudget))
     builder.sizedByteArray()
   }
 
+  /** Create a tuix.Row of nulls with the types of the given schema. */
+  def flatbuffersCreateNullRow(builder: FlatBufferBuilder, schema: Seq[Attribute]): Int = {
+    tuix.Row.createRow(
+      builder,
+      tuix.Row.createFieldValuesVector(
+        builder,
+        schema.map(attr => flatbuffersCreateField(builder, null, attr.dataType, true)).toArray),
+      false)
+  }
+
   def serializeAggOp(
     groupingExpressions: Seq[Expression],
     aggExpressions: Seq[NamedExpression],
-    input: Seq[Attribute]): Array[Byte] = {
+    input: Seq[Attribute],
+    memoryBudget: Long = 0L): Array[Byte] = {
     // aggExpressions contains both grouping expressions and AggregateExpressions. Transform the
     // grouping expressions into AggregateExpressions that collect the first seen value.
     val aggExpressionsWithFirst = aggExpressions.map {
@@ -734,13 +783,15 @@ object Utils {
           builder,
           aggExpressionsWithFirst
             .map(e => serializeAggExpression(builder, e, input, aggSchema, concatSchema))
-            .toArray)))
+            .toArray),
+        memoryBudget))
     builder.sizedByteArray()
   }
 
   /**
    * Serialize an AggregateExpression into a tuix.AggregateExpr. Returns the offset of the written
-   * tuix.AggregateExpr.
+   * tuix.AggregateExpr. Besides the update expressions, each aggregate carries its kind and its
+   * inputs so that the enclave can compute it natively, which also skips null inputs.
    */
   def serializeAggExpression(
     builder: FlatBufferBuilder, e: AggregateExpression, input: Seq[Attribute],
@@ -750,7 +801,6 @@ object Utils {
         val sum = avg.aggBufferAttributes(0)
         val count = avg.aggBufferAttributes(1)
 
-        // TODO: support aggregating null values
         // TODO: support DecimalType to match Spark SQL behavior
         tuix.AggregateExpr.createAggregateExpr(
           builder,
@@ -767,12 +817,15 @@ object Utils {
               /* count = */ flatbuffersSerializeExpression(
                 builder, Add(count, Literal(1L)), concatSchema))),
           flatbuffersSerializeExpression(
-            builder, Divide(sum, Cast(count, DoubleType)), aggSchema))
+            builder, Divide(sum, Cast(count, DoubleType)), aggSchema),
+          tuix.AggregateKind.Average,
+          tuix.AggregateExpr.createInputExprsVector(
+            builder,
+            Array(flatbuffersSerializeExpression(builder, Cast(child, DoubleType), input))))
 
       case c @ Count(children) =>
         val count = c.aggBufferAttributes(0)
 
-        // TODO: support skipping null values
         tuix.AggregateExpr.createAggregateExpr(
           builder,
           tuix.AggregateExpr.createInitialValuesVector(
@@ -785,13 +838,16 @@ object Utils {
               /* count = */ flatbuffersSerializeExpression(
                 builder, Add(count, Literal(1L)), concatSchema))),
           flatbuffersSerializeExpression(
-            builder, count, aggSchema))
+            builder, count, aggSchema),
+          tuix.AggregateKind.Count,
+          tuix.AggregateExpr.createInputExprsVector(
+            builder,
+            children.map(flatbuffersSerializeExpression(builder, _, input)).toArray))
 
       case f @ First(child, Literal(false, BooleanType)) =>
         val first = f.aggBufferAttributes(0)
         val valueSet = f.aggBufferAttributes(1)
 
-        // TODO: support aggregating null values
         tuix.AggregateExpr.createAggregateExpr(
           builder,
           tuix.AggregateExpr.createInitialValuesVector(
@@ -807,13 +863,16 @@ object Utils {
                 builder, If(valueSet, first, child), concatSchema),
               /* valueSet = */ flatbuffersSerializeExpression(
                 builder, Literal(true), concatSchema))),
-          flatbuffersSerializeExpression(builder, first, aggSchema))
+          flatbuffersSerializeExpression(builder, first, aggSchema),
+          tuix.AggregateKind.First,
+          tuix.AggregateExpr.createInputExprsVector(
+            builder,
+            Array(flatbuffersSerializeExpression(builder, child, input))))
 
       case l @ Last(child, Literal(false, BooleanType)) =>
         val last = l.aggBufferAttributes(0)
         // val valueSet = l.aggBufferAttributes(1)
 
-        // TODO: support aggregating null values
         tuix.AggregateExpr.createAggregateExpr(
           builder,
           tuix.AggregateExpr.createInitialValuesVector(
@@ -829,7 +888,11 @@ object Utils {
                 builder, child, concatSchema),
               /* valueSet = */ flatbuffersSerializeExpression(
                 builder, Literal(true), concatSchema))),
-          flatbuffersSerializeExpression(builder, last, aggSchema))
+          flatbuffersSerializeExpression(builder, last, aggSchema),
+          tuix.AggregateKind.Last,
+          tuix.AggregateExpr.createInputExprsVector(
+            builder,
+            Array(flatbuffersSerializeExpression(builder, child, input))))
 
       case m @ Max(child) =>
         val max = m.aggBufferAttributes(0)
@@ -847,7 +910,11 @@ object Utils {
               /* max = */ flatbuffersSerializeExpression(
                 builder, If(Or(IsNull(max), GreaterThan(child, max)), child, max), concatSchema))),
           flatbuffersSerializeExpression(
-            builder, max, aggSchema))
+            builder, max, aggSchema),
+          tuix.AggregateKind.Max,
+          tuix.AggregateExpr.createInputExprsVector(
+            builder,
+            Array(flatbuffersSerializeExpression(builder, child, input))))
 
       case m @ Min(child) =>
         val min = m.aggBufferAttributes(0)
@@ -865,14 +932,17 @@ object Utils {
               /* min = */ flatbuffersSerializeExpression(
                 builder, If(Or(IsNull(min), LessThan(child, min)), child, min), concatSchema))),
           flatbuffersSerializeExpression(
-            builder, min, aggSchema))
+            builder, min, aggSchema),
+          tuix.AggregateKind.Min,
+          tuix.AggregateExpr.createInputExprsVector(
+            builder,
+            Array(flatbuffersSerializeExpression(builder, child, input))))
 
       case s @ Sum(child) =>
         val sum = s.aggBufferAttributes(0)
 
         val sumDataType = s.dataType
 
-        // TODO: support aggregating null values
         tuix.AggregateExpr.createAggregateExpr(
           builder,
           tuix.AggregateExpr.createInitialValuesVector(
@@ -886,10 +956,24 @@ object Utils {
               /* sum = */ flatbuffersSerializeExpression(
                 builder, Add(sum, Cast(child, sumDataType)), concatSchema))),
           flatbuffersSerializeExpression(
-            builder, sum, aggSchema))
+            builder, sum, aggSchema),
+          tuix.AggregateKind.Sum,
+          tuix.AggregateExpr.createInputExprsVector(
+            builder,
+            Array(flatbuffersSerializeExpression(builder, Cast(child, sumDataType), input))))
     }
   }
 
+  private def copyEncryptedBlock(builder: FlatBufferBuilder, encryptedBlock: tuix.EncryptedBlock)
+    : Int = {
+    val encRows = new Array[Byte](encryptedBlock.encRowsLength)
+    encryptedBlock.encRowsAsByteBuffer.get(encRows)
+    tuix.EncryptedBlock.createEncryptedBlock(
+      builder,
+      encryptedBlock.numRows,
+      tuix.EncryptedBlock.createEncRowsVector(builder, encRows))
+  }
+
   def concatEncryptedBlocks(blocks: Seq[Block]): Block = {
     val allBlocks = for {
       block <- blocks
@@ -901,16 +985,57 @@ object Utils {
     builder.finish(
       tuix.EncryptedBlocks.createEncryptedBlocks(
         builder, tuix.EncryptedBlocks.createBlocksVector(builder, allBlocks.map { encryptedBlock =>
-          val encRows = new Array[Byte](encryptedBlock.encRowsLength)
-          encryptedBlock.encRowsAsByteBuffer.get(encRows)
-          tuix.EncryptedBlock.createEncryptedBlock(
-            builder,
-            encryptedBlock.numRows,
-            tuix.EncryptedBlock.createEncRowsVector(builder, encRows))
+          copyEncryptedBlock(builder, encryptedBlock)
+        }.toArray)))
+    Block(builder.sizedByteArray())
+  }
+
+  /** Combine the runs of several tuix.SortedRuns into a single tuix.SortedRuns. */
+  def concatSortedRuns(sortedRuns: Seq[Block]): Block = {
+    val allRuns = for {
+      block <- sortedRuns
+      runs = tuix.SortedRuns.getRootAsSortedRuns(ByteBuffer.wrap(block.bytes))
+      i <- 0 until runs.runsLength
+    } yield runs.runs(i)
+
+    val builder = new FlatBufferBuilder
+    builder.finish(
+      tuix.SortedRuns.createSortedRuns(
+        builder, tuix.SortedRuns.createRunsVector(builder, allRuns.map { run =>
+          val blocks = (0 until run.blocksLength).map { i =>
+            copyEncryptedBlock(builder, run.blocks(i))
+          }.toArray
+          tuix.EncryptedBlocks.createEncryptedBlocks(
+            builder, tuix.EncryptedBlocks.createBlocksVector(builder, blocks))
         }.toArray)))
     Block(builder.sizedByteArray())
   }
 
+  /**
+   * Hash partition the rows of childRDD into numPartitions partitions on the keys in
+   * partitionExprSer, a tuix.HashPartitionExpr. Two RDDs hash partitioned into the same number of
+   * partitions on keys of the same types are co-partitioned.
+   */
+  def hashPartition(
+      childRDD: RDD[Block], partitionExprSer: Array[Byte], numPartitions: Int): RDD[Block] = {
+    childRDD.flatMap { block =>
+      val (enclave, eid) = initEnclave()
+      val partitions = enclave.HashPartition(eid, partitionExprSer, numPartitions, block.bytes)
+      partitions.zipWithIndex.map {
+        case (partition, i) => (i, Block(partition))
+      }
+    }.groupByKey(numPartitions).map {
+      case (i, blocks) => concatEncryptedBlocks(blocks.toSeq)
+    }
+  }
+
+  /** Return the number of rows in the given tuix.EncryptedBlocks, from its unencrypted headers. */
+  def numRows(block: Block): Long = {
+    val encryptedBlocks =
+      tuix.EncryptedBlocks.getRootAsEncryptedBlocks(ByteBuffer.wrap(block.bytes))
+    (0 until encryptedBlocks.blocksLength).map(i => encryptedBlocks.blocks(i).numRows).sum
+  }
+
   def emptyBlock: Block = {
     val builder = new FlatBufferBuilder
     builder.finish(
@@ -19,6 +19,7 @@ package edu.berkeley.cs.rise.opaque.execution
 
 import edu.berkeley.cs.rise.opaque.Utils
 import org.apache.spark.rdd.RDD
+import org.apache.spark.sql.SQLContext
 import org.apache.spark.sql.catalyst.expressions.Attribute
 import org.apache.spark.sql.catalyst.expressions.SortOrder
 import org.apache.spark.sql.execution.SparkPlan
@@ -30,14 +31,61 @@ case class EncryptedSortExec(order: Seq[SortOrder], child: SparkPlan)
 
   override def executeBlocked() = {
     val orderSer = Utils.serializeSortOrder(order, child.output)
-    EncryptedSortExec.sort(child.asInstanceOf[OpaqueOperatorExec].executeBlocked(), orderSer)
+    val sortThreads = EncryptedSortExec.sortThreads(sqlContext)
+    val sampleForBounds = EncryptedSortExec.sampleForBounds(sqlContext)
+    EncryptedSortExec.sort(
+      child.asInstanceOf[OpaqueOperatorExec].executeBlocked(), orderSer, sortThreads,
+      sampleForBounds)
   }
 }
 
 object EncryptedSortExec {
   import Utils.time
 
-  def sort(childRDD: RDD[Block], orderSer: Array[Byte]): RDD[Block] = {
+  /**
+   * Conf for the number of threads each task uses to sort a partition within the enclave, 1 by
+   * default. The enclave caps this at the number of threads it can spare.
+   */
+  val sortThreadsConf = "spark.opaque.sort.threads"
+
+  /** Read sortThreadsConf on the driver, to pass to the sort tasks. */
+  def sortThreads(sqlContext: SQLContext): Int =
+    math.max(1, sqlContext.getConf(sortThreadsConf, "1").toInt)
+
+  /**
+   * Conf for how to choose range boundaries for a multi-partition sort: "sketch" (the default)
+   * merges a quantile sketch of each partition, while "sample" merges a fixed-size reservoir sample
+   * of the sort keys of each partition, which is cheaper to compute but less accurate.
+   */
+  val boundsConf = "spark.opaque.sort.bounds"
+
+  /** Read boundsConf on the driver, returning true if range boundaries come from samples. */
+  def sampleForBounds(sqlContext: SQLContext): Boolean =
+    sqlContext.getConf(boundsConf, "sketch") match {
+      case "sketch" => false
+      case "sample" => true
+      case other => throw new IllegalArgumentException(s"$boundsConf: unknown mode $other")
+    }
+
+  /** Number of rows each partition contributes to the sample when sampleForBounds is set. */
+  private val sampleSize = 1000
+
+  /** Sort a single partition within the enclave, using multiple threads if configured. */
+  private def externalSort(
+      enclave: SGXEnclave, eid: Long, orderSer: Array[Byte], input: Array[Byte],
+      sortThreads: Int): Array[Byte] = {
+    if (sortThreads > 1) {
+      // Each thread produces one key range of the output, in order
+      val ranges = enclave.ParallelExternalSort(eid, orderSer, input, sortThreads)
+      Utils.concatEncryptedBlocks(ranges.map(Block(_))).bytes
+    } else {
+      enclave.ExternalSort(eid, orderSer, input)
+    }
+  }
+
+  def sort(
+      childRDD: RDD[Block], orderSer: Array[Byte], sortThreads: Int,
+      sampleForBounds: Boolean): RDD[Block] = {
     Utils.ensureCached(childRDD)
     time("force child of EncryptedSort") { childRDD.count }
     // RA.initRA(childRDD)
@@ -46,45 +94,78 @@ object EncryptedSortExec {
       val numPartitions = childRDD.partitions.length
       val result =
         if (numPartitions <= 1) {
-          childRDD.map { block =>
-            val (enclave, eid) = Utils.initEnclave()
-            val sortedRows = enclave.ExternalSort(eid, orderSer, block.bytes)
-            Block(sortedRows)
-          }
+          sortPartitions(childRDD, orderSer, sortThreads)
         } else {
-          // Collect a sample of the input rows
-          val sampled = time("non-oblivious sort - Sample") {
-            Utils.concatEncryptedBlocks(childRDD.map { block =>
-              val (enclave, eid) = Utils.initEnclave()
-              val sampledBlock = enclave.Sample(eid, block.bytes)
-              Block(sampledBlock)
-            }.collect)
-          }
-          // Find range boundaries locally
-          val (enclave, eid) = Utils.initEnclave()
-          val boundaries = time("non-oblivious sort - FindRangeBounds") {
-            enclave.FindRangeBounds(eid, orderSer, numPartitions, sampled.bytes)
-          }
-          // Broadcast the range boundaries and use them to partition the input
-          childRDD.flatMap { block =>
-            val (enclave, eid) = Utils.initEnclave()
-            val partitions = enclave.PartitionForSort(
-              eid, orderSer, numPartitions, block.bytes, boundaries)
-            partitions.zipWithIndex.map {
-              case (partition, i) => (i, Block(partition))
-            }
-          }
-          // Shuffle the input to achieve range partitioning and sort locally
-            .groupByKey(numPartitions).map {
-              case (i, blocks) =>
-                val (enclave, eid) = Utils.initEnclave()
-                Block(enclave.ExternalSort(
-                  eid, orderSer, Utils.concatEncryptedBlocks(blocks.toSeq).bytes))
-            }
+          val boundaries = rangeBounds(childRDD, orderSer, numPartitions, sampleForBounds)
+          rangePartitionAndMerge(childRDD, orderSer, numPartitions, boundaries)
         }
       Utils.ensureCached(result)
       result.count()
       result
     }
   }
+
+  /** Sort each partition of childRDD independently, using sortThreads threads per partition. */
+  def sortPartitions(
+      childRDD: RDD[Block], orderSer: Array[Byte], sortThreads: Int): RDD[Block] = {
+    childRDD.map { block =>
+      val (enclave, eid) = Utils.initEnclave()
+      val sortedRows = externalSort(enclave, eid, orderSer, block.bytes, sortThreads)
+      Block(sortedRows)
+    }
+  }
+
+  /**
+   * Choose up to numPartitions - 1 boundary key rows that split the rows of childRDD into
+   * numPartitions ranges of about equal size under the given sort order, from a sample of each
+   * partition if sampleForBounds is set and from a quantile sketch otherwise.
+   */
+  def rangeBounds(
+      childRDD: RDD[Block], orderSer: Array[Byte], numPartitions: Int,
+      sampleForBounds: Boolean): Array[Byte] = {
+    // Collect a fixed-size quantile sketch of the sort keys of each partition. A sample of key rows
+    // has the same format.
+    val sketches = time("non-oblivious sort - SketchSortKeys") {
+      Utils.concatEncryptedBlocks(childRDD.map { block =>
+        val (enclave, eid) = Utils.initEnclave()
+        if (sampleForBounds) {
+          Block(enclave.Sample(eid, orderSer, sampleSize, block.bytes))
+        } else {
+          Block(enclave.SketchSortKeys(eid, orderSer, block.bytes))
+        }
+      }.collect)
+    }
+    // Merge the sketches and find range boundaries locally
+    val (enclave, eid) = Utils.initEnclave()
+    time("non-oblivious sort - FindRangeBoundsFromSketches") {
+      enclave.FindRangeBoundsFromSketches(eid, orderSer, numPartitions, sketches.bytes)
+    }
+  }
+
+  /**
+   * Range partition the rows of childRDD into numPartitions partitions using boundaries from
+   * rangeBounds, and sort each partition. The boundaries may come from a different sort order, as
+   * long as its keys have the same types.
+   */
+  def rangePartitionAndMerge(
+      childRDD: RDD[Block], orderSer: Array[Byte], numPartitions: Int,
+      boundaries: Array[Byte]): RDD[Block] = {
+    // Broadcast the range boundaries and use them to partition the input
+    childRDD.flatMap { block =>
+      val (enclave, eid) = Utils.initEnclave()
+      val partitions = enclave.PartitionForSort(
+        eid, orderSer, numPartitions, block.bytes, boundaries)
+      partitions.zipWithIndex.map {
+        case (partition, i) => (i, Block(partition))
+      }
+    }
+    // Shuffle the input to achieve range partitioning. Each partition arrives as sorted runs, so it
+    // only needs to be merged.
+      .groupByKey(numPartitions).map {
+        case (i, runs) =>
+          val (enclave, eid) = Utils.initEnclave()
+          Block(enclave.ExternalMerge(
+            eid, orderSer, Utils.concatSortedRuns(runs.toSeq).bytes))
+      }
+  }
 }
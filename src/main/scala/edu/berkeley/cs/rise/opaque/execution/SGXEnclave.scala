@@ -31,24 +31,51 @@ class SGXEnclave extends java.io.Serializable {
   @native def Encrypt(eid: Long, plaintext: Array[Byte]): Array[Byte]
   @native def Decrypt(eid: Long, ciphertext: Array[Byte]): Array[Byte]
 
-  @native def Sample(eid: Long, input: Array[Byte]): Array[Byte]
-  @native def FindRangeBounds(
-    eid: Long, order: Array[Byte], numPartitions: Int, input: Array[Byte]): Array[Byte]
+  @native def Sample(
+    eid: Long, order: Array[Byte], sampleSize: Int, input: Array[Byte]): Array[Byte]
+  @native def SketchSortKeys(eid: Long, order: Array[Byte], input: Array[Byte]): Array[Byte]
+  @native def FindRangeBoundsFromSketches(
+    eid: Long, order: Array[Byte], numPartitions: Int, sketches: Array[Byte]): Array[Byte]
   @native def PartitionForSort(
     eid: Long, order: Array[Byte], numPartitions: Int, input: Array[Byte],
     boundaries: Array[Byte]): Array[Array[Byte]]
+  @native def HashPartition(
+    eid: Long, partitionExpr: Array[Byte], numPartitions: Int,
+    input: Array[Byte]): Array[Array[Byte]]
   @native def ExternalSort(eid: Long, order: Array[Byte], input: Array[Byte]): Array[Byte]
+  @native def ObliviousSort(eid: Long, order: Array[Byte], input: Array[Byte]): Array[Byte]
+  @native def ExternalMerge(eid: Long, order: Array[Byte], input: Array[Byte]): Array[Byte]
+  @native def TopK(
+    eid: Long, order: Array[Byte], numRows: Int, input: Array[Byte]): Array[Byte]
+  @native def ParallelExternalSort(
+    eid: Long, order: Array[Byte], input: Array[Byte], numThreads: Int): Array[Array[Byte]]
 
   @native def ScanCollectLastPrimary(
     eid: Long, joinExpr: Array[Byte], input: Array[Byte]): Array[Byte]
-  @native def NonObliviousSortMergeJoin(
-    eid: Long, joinExpr: Array[Byte], input: Array[Byte], joinRow: Array[Byte]): Array[Byte]
+  @native def ScanCollectFirstPrimary(
+    eid: Long, joinExpr: Array[Byte], input: Array[Byte]): Array[Byte]
+  @native def NonObliviousMergeJoin(
+    eid: Long, joinExpr: Array[Byte], primaryRows: Array[Byte], foreignRows: Array[Byte],
+    prevPrimaryRow: Array[Byte], nextPrimaryRow: Array[Byte]): Array[Byte]
+  @native def HashJoin(
+    eid: Long, joinExpr: Array[Byte], buildRows: Array[Byte], probeRows: Array[Byte]): Array[Byte]
+  @native def BroadcastBuild(eid: Long, joinExpr: Array[Byte], buildRows: Array[Byte]): Long
+  @native def BroadcastProbe(eid: Long, handle: Long, probeRows: Array[Byte]): Array[Byte]
+  @native def BroadcastRelease(eid: Long, handle: Long): Unit
+  @native def BuildBloomFilter(
+    eid: Long, joinExpr: Array[Byte], numKeys: Int, input: Array[Byte]): Array[Byte]
+  @native def MergeBloomFilters(eid: Long, filterA: Array[Byte], filterB: Array[Byte]): Array[Byte]
+  @native def BloomFilterRows(
+    eid: Long, joinExpr: Array[Byte], filter: Array[Byte], input: Array[Byte]): Array[Byte]
 
   @native def NonObliviousAggregateStep1(
     eid: Long, aggOp: Array[Byte], inputRows: Array[Byte]): (Array[Byte], Array[Byte], Array[Byte])
   @native def NonObliviousAggregateStep2(
     eid: Long, aggOp: Array[Byte], inputRows: Array[Byte], nextPartitionFirstRow: Array[Byte],
     prevPartitionLastGroup: Array[Byte], prevPartitionLastRow: Array[Byte]): Array[Byte]
+  @native def HashAggregate(eid: Long, aggOp: Array[Byte], inputRows: Array[Byte]): Array[Byte]
+  @native def PartialAggregate(eid: Long, aggOp: Array[Byte], inputRows: Array[Byte]): Array[Byte]
+  @native def FinalAggregate(eid: Long, aggOp: Array[Byte], inputRows: Array[Byte]): Array[Byte]
 
   // Remote attestation, enclave side
   @native def RemoteAttestation0(): Array[Byte]
@@ -17,14 +17,21 @@
 
 package edu.berkeley.cs.rise.opaque.execution
 
+import scala.collection.mutable
 import scala.collection.mutable.ArrayBuffer
 
 import edu.berkeley.cs.rise.opaque.Utils
+import org.apache.spark.broadcast.Broadcast
 import org.apache.spark.rdd.RDD
 import org.apache.spark.sql.catalyst.InternalRow
 import org.apache.spark.sql.catalyst.expressions.AttributeSet
 import org.apache.spark.sql.catalyst.expressions._
+import org.apache.spark.sql.catalyst.plans.FullOuter
+import org.apache.spark.sql.catalyst.plans.Inner
 import org.apache.spark.sql.catalyst.plans.JoinType
+import org.apache.spark.sql.catalyst.plans.LeftAnti
+import org.apache.spark.sql.catalyst.plans.LeftOuter
+import org.apache.spark.sql.catalyst.plans.LeftSemi
 import org.apache.spark.sql.catalyst.plans.physical.Partitioning
 import org.apache.spark.sql.execution.SparkPlan
 
@@ -230,6 +237,75 @@ case class ObliviousFilterExec(condition: Expression, child: SparkPlan)
   }
 }
 
+case class ObliviousSortExec(order: Seq[SortOrder], child: SparkPlan)
+  extends UnaryExecNode with OpaqueOperatorExec {
+
+  override def output: Seq[Attribute] = child.output
+
+  override def executeBlocked(): RDD[Block] = {
+    val orderSer = Utils.serializeSortOrder(order, child.output)
+    timeOperator(child.asInstanceOf[OpaqueOperatorExec].executeBlocked(), "ObliviousSortExec") {
+      childRDD =>
+        // The sort network spans a single enclave, so shuffle all partitions to one task. The
+        // shuffle keeps the child's partitions computed in parallel and the data off the driver.
+        childRDD.repartition(1).mapPartitions { blocks =>
+          val (enclave, eid) = Utils.initEnclave()
+          Iterator(Block(enclave.ObliviousSort(
+            eid, orderSer, Utils.concatEncryptedBlocks(blocks.toSeq).bytes)))
+        }
+    }
+  }
+}
+
+case class EncryptedTopKExec(limit: Int, order: Seq[SortOrder], child: SparkPlan)
+  extends UnaryExecNode with OpaqueOperatorExec {
+
+  override def output: Seq[Attribute] = child.output
+
+  override def executeBlocked(): RDD[Block] = {
+    val orderSer = Utils.serializeSortOrder(order, child.output)
+    val maxLimit = sqlContext.getConf(
+      EncryptedTopKExec.maxLimitConf, EncryptedTopKExec.defaultMaxLimit.toString).toInt
+    if (limit > maxLimit) {
+      // Too many rows to keep in the enclave, so sort the whole input instead. Like other limits on
+      // encrypted data, the limit itself is not applied yet.
+      EncryptedSortExec.sort(
+        child.asInstanceOf[OpaqueOperatorExec].executeBlocked(), orderSer,
+        EncryptedSortExec.sortThreads(sqlContext), EncryptedSortExec.sampleForBounds(sqlContext))
+    } else {
+      timeOperator(child.asInstanceOf[OpaqueOperatorExec].executeBlocked(), "EncryptedTopKExec") {
+        childRDD =>
+          // Find the first rows of each partition, then the first rows among those
+          val partitionTopKs = childRDD.map { block =>
+            val (enclave, eid) = Utils.initEnclave()
+            Block(enclave.TopK(eid, orderSer, limit, block.bytes))
+          }.collect
+          sparkContext.parallelize(Seq(Utils.concatEncryptedBlocks(partitionTopKs)), 1).map {
+            block =>
+              val (enclave, eid) = Utils.initEnclave()
+              Block(enclave.TopK(eid, orderSer, limit, block.bytes))
+          }
+      }
+    }
+  }
+}
+
+object EncryptedTopKExec {
+  /**
+   * Largest limit to find with TopK, which keeps that many rows in enclave memory and fails if they
+   * exceed SORT_MEMORY_BUDGET. Rows of up to a few hundred bytes fit at this limit.
+   */
+  val defaultMaxLimit: Int = 100000
+
+  /** Conf that overrides defaultMaxLimit. */
+  val maxLimitConf = "spark.opaque.topK.maxLimit"
+}
+
+/**
+ * A grouped aggregation hash partitions its input on the grouping expressions and aggregates each
+ * partition in an enclave hash table, so the input need not be sorted. A global aggregation has
+ * a single group spanning all partitions, which is carried from each partition to the next.
+ */
 case class EncryptedAggregateExec(
     groupingExpressions: Seq[Expression],
     aggExpressions: Seq[NamedExpression],
@@ -242,81 +318,351 @@ case class EncryptedAggregateExec(
   override def output: Seq[Attribute] = aggExpressions.map(_.toAttribute)
 
   override def executeBlocked(): RDD[Block] = {
-    val aggExprSer = Utils.serializeAggOp(groupingExpressions, aggExpressions, child.output)
+    val memoryBudget = math.min(
+      sqlContext.getConf(
+        EncryptedAggregateExec.memoryBudgetConf,
+        EncryptedAggregateExec.maxMemoryBudget.toString).toLong,
+      EncryptedAggregateExec.maxMemoryBudget)
+    val aggExprSer = Utils.serializeAggOp(
+      groupingExpressions, aggExpressions, child.output, memoryBudget)
 
     timeOperator(
       child.asInstanceOf[OpaqueOperatorExec].executeBlocked(),
       "EncryptedAggregateExec") { childRDD =>
-
-      val (firstRows, lastGroups, lastRows) = childRDD.map { block =>
-        val (enclave, eid) = Utils.initEnclave()
-        val (firstRow, lastGroup, lastRow) = enclave.NonObliviousAggregateStep1(
-          eid, aggExprSer, block.bytes)
-        (Block(firstRow), Block(lastGroup), Block(lastRow))
-      }.collect.unzip3
-
-      // Send first row to previous partition and last group to next partition
-      val shiftedFirstRows = firstRows.drop(1) :+ Utils.emptyBlock
-      val shiftedLastGroups = Utils.emptyBlock +: lastGroups.dropRight(1)
-      val shiftedLastRows = Utils.emptyBlock +: lastRows.dropRight(1)
-      val shifted = (shiftedFirstRows, shiftedLastGroups, shiftedLastRows).zipped.toSeq
-      assert(shifted.size == childRDD.partitions.length)
-      val shiftedRDD = sparkContext.parallelize(shifted, childRDD.partitions.length)
-
-      childRDD.zipPartitions(shiftedRDD) { (blockIter, boundaryIter) =>
-        (blockIter.toSeq, boundaryIter.toSeq) match {
-          case (Seq(block), Seq(Tuple3(
-            nextPartitionFirstRow, prevPartitionLastGroup, prevPartitionLastRow))) =>
+      if (groupingExpressions.nonEmpty) {
+        val numPartitions = childRDD.partitions.length
+        if (numPartitions <= 1) {
+          childRDD.map { block =>
+            val (enclave, eid) = Utils.initEnclave()
+            Block(enclave.HashAggregate(eid, aggExprSer, block.bytes))
+          }
+        } else {
+          // Aggregate each partition before the shuffle, so that only about one partial row per
+          // group per partition is shuffled. A partial row starts with the grouping values.
+          val partialRDD = childRDD.map { block =>
             val (enclave, eid) = Utils.initEnclave()
-            Iterator(Block(enclave.NonObliviousAggregateStep2(
-              eid, aggExprSer, block.bytes,
-              nextPartitionFirstRow.bytes, prevPartitionLastGroup.bytes,
-              prevPartitionLastRow.bytes)))
+            Block(enclave.PartialAggregate(eid, aggExprSer, block.bytes))
+          }
+          val partialGroupingAttributes = groupingExpressions.zipWithIndex.map {
+            case (e, i) => AttributeReference("_" + i, e.dataType, e.nullable)()
+          }
+          Utils.hashPartition(
+            partialRDD,
+            Utils.serializeHashPartitionExpr(partialGroupingAttributes, partialGroupingAttributes),
+            numPartitions).map { block =>
+            val (enclave, eid) = Utils.initEnclave()
+            Block(enclave.FinalAggregate(eid, aggExprSer, block.bytes))
+          }
+        }
+      } else {
+        val (firstRows, lastGroups, lastRows) = childRDD.map { block =>
+          val (enclave, eid) = Utils.initEnclave()
+          val (firstRow, lastGroup, lastRow) = enclave.NonObliviousAggregateStep1(
+            eid, aggExprSer, block.bytes)
+          (Block(firstRow), Block(lastGroup), Block(lastRow))
+        }.collect.unzip3
+
+        // Send first row to previous partition and last group to next partition
+        val shiftedFirstRows = firstRows.drop(1) :+ Utils.emptyBlock
+        val shiftedLastGroups = Utils.emptyBlock +: lastGroups.dropRight(1)
+        val shiftedLastRows = Utils.emptyBlock +: lastRows.dropRight(1)
+        val shifted = (shiftedFirstRows, shiftedLastGroups, shiftedLastRows).zipped.toSeq
+        assert(shifted.size == childRDD.partitions.length)
+        val shiftedRDD = sparkContext.parallelize(shifted, childRDD.partitions.length)
+
+        childRDD.zipPartitions(shiftedRDD) { (blockIter, boundaryIter) =>
+          (blockIter.toSeq, boundaryIter.toSeq) match {
+            case (Seq(block), Seq(Tuple3(
+              nextPartitionFirstRow, prevPartitionLastGroup, prevPartitionLastRow))) =>
+              val (enclave, eid) = Utils.initEnclave()
+              Iterator(Block(enclave.NonObliviousAggregateStep2(
+                eid, aggExprSer, block.bytes,
+                nextPartitionFirstRow.bytes, prevPartitionLastGroup.bytes,
+                prevPartitionLastRow.bytes)))
+          }
         }
       }
     }
   }
 }
 
-case class EncryptedSortMergeJoinExec(
+object EncryptedAggregateExec {
+  /** Enclave memory for hash aggregation, in bytes. Must match AGGREGATE_MEMORY_BUDGET */
+  val maxMemoryBudget: Long = 32000000L
+
+  /**
+   * Conf that lowers the memory budget below maxMemoryBudget, so that hash aggregation spills with
+   * fewer groups. Mainly useful for testing spilling on small data.
+   */
+  val memoryBudgetConf = "spark.opaque.aggregate.memoryBudget"
+}
+
+/**
+ * Join the primary table `left` with the foreign table `right`, each projected by the planner to a
+ * tag (0 for primary rows, 1 for foreign rows), its join keys and its columns. `joinType` is
+ * interpreted as for tuix.JoinExpr: LeftSemi and LeftAnti output only rows of the foreign table. If
+ * the encrypted primary table fits in the enclave memory budget, it is broadcast to every executor,
+ * decrypted and indexed once per enclave, and probed in place by each partition of the foreign
+ * table, avoiding both the shuffle and the sort of both tables. Otherwise, after using a Bloom
+ * filter over the primary keys to drop foreign rows that cannot join, both tables are hash
+ * partitioned on their join keys and each pair of partitions is hash joined. Semi and anti joins,
+ * whose primary keys may repeat, instead sort each table on its own join keys and merge the two.
+ * LeftOuter and FullOuter joins are never broadcast, since each probe sees only part of the foreign
+ * table, and are always hash partitioned so that every primary row meets all of its foreign rows.
+ * Only the columns in `output` are written by the enclave, so tags and join keys need no separate
+ * projection.
+ */
+case class EncryptedHashJoinExec(
     joinType: JoinType,
     leftKeys: Seq[Expression],
     rightKeys: Seq[Expression],
     leftSchema: Seq[Attribute],
     rightSchema: Seq[Attribute],
     output: Seq[Attribute],
-    child: SparkPlan)
-  extends UnaryExecNode with OpaqueOperatorExec {
+    left: SparkPlan,
+    right: SparkPlan)
+  extends BinaryExecNode with OpaqueOperatorExec {
+  import Utils.time
 
   override def executeBlocked() = {
+    val memoryBudget = math.min(
+      sqlContext.getConf(
+        EncryptedHashJoinExec.memoryBudgetConf,
+        EncryptedHashJoinExec.maxMemoryBudget.toString).toLong,
+      EncryptedHashJoinExec.maxMemoryBudget)
+    val joinedSchema = joinType match {
+      case LeftSemi | LeftAnti => rightSchema
+      case _ => leftSchema ++ rightSchema
+    }
+    val outputColumns = output.map { a =>
+      val i = joinedSchema.indexWhere(_.exprId == a.exprId)
+      assert(i >= 0, s"Join output $a not found in $joinedSchema")
+      i
+    }
     val joinExprSer = Utils.serializeJoinExpression(
-      joinType, leftKeys, rightKeys, leftSchema, rightSchema)
+      joinType, leftKeys, rightKeys, leftSchema, rightSchema,
+      if (outputColumns == joinedSchema.indices) None else Some(outputColumns), memoryBudget)
 
-    timeOperator(
-      child.asInstanceOf[OpaqueOperatorExec].executeBlocked(),
-      "EncryptedSortMergeJoinExec") { childRDD =>
+    val leftRDD = left.asInstanceOf[OpaqueOperatorExec].executeBlocked()
+    val rightRDD = right.asInstanceOf[OpaqueOperatorExec].executeBlocked()
+    Utils.ensureCached(leftRDD)
+    Utils.ensureCached(rightRDD)
+    // Measure the primary table on the executors, so that a table too large to broadcast is never
+    // collected to the driver
+    val (leftBytes, leftNumRows) = time("Force left child of EncryptedHashJoinExec") {
+      leftRDD.map(block => (block.bytes.length.toLong, Utils.numRows(block))).fold((0L, 0L)) {
+        case ((bytesA, rowsA), (bytesB, rowsB)) => (bytesA + bytesB, rowsA + rowsB)
+      }
+    }
+    time("Force right child of EncryptedHashJoinExec") { rightRDD.count }
+
+    // A join that outputs unmatched primary rows needs to see all foreign rows with each primary
+    // row, so it cannot be broadcast, where each probe sees only part of the foreign table
+    val padsPrimary = joinType == LeftOuter || joinType == FullOuter
+
+    if (!padsPrimary && leftBytes <= memoryBudget) {
+      time("EncryptedHashJoinExec") {
+        val buildRows = sparkContext.broadcast(Utils.concatEncryptedBlocks(leftRDD.collect))
+        val result = rightRDD.map { block =>
+          val (enclave, eid) = Utils.initEnclave()
+          val handle = EncryptedHashJoinExec.acquireBuildSide(enclave, eid, joinExprSer, buildRows)
+          try {
+            Block(enclave.BroadcastProbe(eid, handle, block.bytes))
+          } finally {
+            EncryptedHashJoinExec.releaseBuildSide(eid, buildRows)
+          }
+        }
+        Utils.ensureCached(result)
+        result.count
+        result
+      }
+    } else {
+      // For an inner or semi join, drop the foreign rows that cannot join with any primary row
+      // before sorting, using a Bloom filter over the keys of the primary table
+      val filteredRightRDD =
+        if (joinType == Inner || joinType == LeftSemi) {
+          val filter = time("EncryptedHashJoinExec - BuildBloomFilter") {
+            val numKeys = math.min(leftNumRows, Int.MaxValue).toInt
+            leftRDD.map { block =>
+              val (enclave, eid) = Utils.initEnclave()
+              enclave.BuildBloomFilter(eid, joinExprSer, numKeys, block.bytes)
+            }.treeReduce { (a, b) =>
+              val (enclave, eid) = Utils.initEnclave()
+              enclave.MergeBloomFilters(eid, a, b)
+            }
+          }
+          val filterBroadcast = sparkContext.broadcast(filter)
+          rightRDD.map { block =>
+            val (enclave, eid) = Utils.initEnclave()
+            Block(enclave.BloomFilterRows(eid, joinExprSer, filterBroadcast.value, block.bytes))
+          }
+        } else {
+          rightRDD
+        }
 
-      val lastPrimaryRows = childRDD.map { block =>
-        val (enclave, eid) = Utils.initEnclave()
-        Block(enclave.ScanCollectLastPrimary(eid, joinExprSer, block.bytes))
-      }.collect
-      val shifted = Utils.emptyBlock +: lastPrimaryRows.dropRight(1)
-      assert(shifted.size == childRDD.partitions.length)
-      val processedJoinRowsRDD =
-        sparkContext.parallelize(shifted, childRDD.partitions.length)
-
-      childRDD.zipPartitions(processedJoinRowsRDD) { (blockIter, joinRowIter) =>
-        (blockIter.toSeq, joinRowIter.toSeq) match {
-          case (Seq(block), Seq(joinRow)) =>
+      val numInputPartitions =
+        math.max(leftRDD.partitions.length, filteredRightRDD.partitions.length)
+
+      // If primary keys are distinct, they spread evenly over hash partitions, so hash partition
+      // both tables on their join keys into enough partitions that each partition of the primary
+      // table fits in the enclave memory budget, and hash join the co-partitioned pairs. Rows with
+      // a null key never join, so they are spread over all partitions rather than hashed to one.
+      if (joinType != LeftSemi && joinType != LeftAnti) {
+        val numPartitions = math.max(
+          numInputPartitions,
+          math.ceil(2.0 * leftBytes / memoryBudget).toInt)
+        val leftPartitionExprSer =
+          Utils.serializeHashPartitionExpr(leftKeys, left.output, spreadNullKeys = true)
+        val rightPartitionExprSer =
+          Utils.serializeHashPartitionExpr(rightKeys, right.output, spreadNullKeys = true)
+        // Unless the join outputs unmatched primary rows, those with a null key are dead weight in
+        // the build side, so drop them first
+        val nonNullLeftRDD =
+          if (padsPrimary) {
+            leftRDD
+          } else {
+            val leftNotNullSer = Utils.serializeFilterExpression(
+              leftKeys.map(k => IsNotNull(k): Expression).reduce(And), left.output)
+            leftRDD.map { block =>
+              val (enclave, eid) = Utils.initEnclave()
+              Block(enclave.Filter(eid, leftNotNullSer, block.bytes))
+            }
+          }
+        val (partitionedLeftRDD, partitionedRightRDD) =
+          time("EncryptedHashJoinExec - HashPartition") {
+            val l = Utils.hashPartition(nonNullLeftRDD, leftPartitionExprSer, numPartitions)
+            val r = Utils.hashPartition(filteredRightRDD, rightPartitionExprSer, numPartitions)
+            Utils.ensureCached(l)
+            Utils.ensureCached(r)
+            l.count
+            r.count
+            (l, r)
+          }
+
+        timeOperator(partitionedRightRDD, "EncryptedHashJoinExec - HashJoin") { _ =>
+          partitionedLeftRDD.zipPartitions(partitionedRightRDD) { (buildIter, probeIter) =>
+            val build = buildIter.toSeq.headOption.getOrElse(Utils.emptyBlock)
+            val probe = probeIter.toSeq.headOption.getOrElse(Utils.emptyBlock)
             val (enclave, eid) = Utils.initEnclave()
-            Iterator(Block(enclave.NonObliviousSortMergeJoin(
-              eid, joinExprSer, block.bytes, joinRow.bytes)))
+            Iterator(Block(enclave.HashJoin(eid, joinExprSer, build.bytes, probe.bytes)))
+          }
+        }
+      } else {
+        // Otherwise sort each table by its own join keys, range partitioning both by the same
+        // boundaries so that matching rows meet in the same partition, and merge them
+        val leftOrderSer =
+          Utils.serializeSortOrder(leftKeys.map(k => SortOrder(k, Ascending)), left.output)
+        val rightOrderSer =
+          Utils.serializeSortOrder(rightKeys.map(k => SortOrder(k, Ascending)), right.output)
+        val numPartitions = numInputPartitions
+        val sortThreads = EncryptedSortExec.sortThreads(sqlContext)
+        val (sortedLeftRDD, sortedRightRDD) = time("EncryptedHashJoinExec - sort") {
+          if (numPartitions <= 1) {
+            (EncryptedSortExec.sortPartitions(leftRDD, leftOrderSer, sortThreads),
+              EncryptedSortExec.sortPartitions(filteredRightRDD, rightOrderSer, sortThreads))
+          } else {
+            val boundaries = EncryptedSortExec.rangeBounds(
+              filteredRightRDD, rightOrderSer, numPartitions,
+              EncryptedSortExec.sampleForBounds(sqlContext))
+            (EncryptedSortExec.rangePartitionAndMerge(
+              leftRDD, leftOrderSer, numPartitions, boundaries),
+              EncryptedSortExec.rangePartitionAndMerge(
+                filteredRightRDD, rightOrderSer, numPartitions, boundaries))
+          }
+        }
+        Utils.ensureCached(sortedLeftRDD)
+        Utils.ensureCached(sortedRightRDD)
+
+        timeOperator(sortedRightRDD, "EncryptedHashJoinExec - NonObliviousMergeJoin") { _ =>
+          EncryptedHashJoinExec.mergeJoin(sortedLeftRDD, sortedRightRDD, joinExprSer)
         }
       }
     }
   }
 }
 
+object EncryptedHashJoinExec {
+  /**
+   * Largest primary table, in encrypted bytes, to hash join. The budget in use is sent to the
+   * enclave in each JoinExpr, and the enclave enforces it, capped at HASH_JOIN_MEMORY_BUDGET.
+   */
+  val maxMemoryBudget: Long = 32000000L
+
+  /**
+   * Conf that lowers the memory budget below maxMemoryBudget, so that smaller primary tables take
+   * the partitioned join paths. Mainly useful for testing those paths on small data.
+   */
+  val memoryBudgetConf = "spark.opaque.join.memoryBudget"
+
+  /**
+   * Merge join the corresponding partitions of primaryRDD and foreignRDD, each sorted by its own
+   * join keys and range partitioned by the same boundaries.
+   */
+  def mergeJoin(
+      primaryRDD: RDD[Block], foreignRDD: RDD[Block], joinExprSer: Array[Byte]): RDD[Block] = {
+    // A key that spans several partitions has its primary row in only one of them, so pass each
+    // partition the nearest primary rows on either side
+    val firstPrimaryRows = primaryRDD.map { block =>
+      val (enclave, eid) = Utils.initEnclave()
+      Block(enclave.ScanCollectFirstPrimary(eid, joinExprSer, block.bytes))
+    }.collect
+    val lastPrimaryRows = primaryRDD.map { block =>
+      val (enclave, eid) = Utils.initEnclave()
+      Block(enclave.ScanCollectLastPrimary(eid, joinExprSer, block.bytes))
+    }.collect
+    val prevPrimaryRows = lastPrimaryRows.scanLeft(Utils.emptyBlock) {
+      (prev, last) => if (Utils.numRows(last) > 0) last else prev
+    }.dropRight(1)
+    val nextPrimaryRows = firstPrimaryRows.scanRight(Utils.emptyBlock) {
+      (first, next) => if (Utils.numRows(first) > 0) first else next
+    }.drop(1)
+    val boundaryRowsRDD = primaryRDD.sparkContext.parallelize(
+      prevPrimaryRows.zip(nextPrimaryRows), primaryRDD.partitions.length)
+
+    primaryRDD.zipPartitions(foreignRDD, boundaryRowsRDD) {
+      (primaryIter, foreignIter, boundaryRowsIter) =>
+        val primary = primaryIter.toSeq.headOption.getOrElse(Utils.emptyBlock)
+        val foreign = foreignIter.toSeq.headOption.getOrElse(Utils.emptyBlock)
+        val (prevPrimaryRow, nextPrimaryRow) = boundaryRowsIter.next()
+        val (enclave, eid) = Utils.initEnclave()
+        Iterator(Block(enclave.NonObliviousMergeJoin(
+          eid, joinExprSer, primary.bytes, foreign.bytes, prevPrimaryRow.bytes,
+          nextPrimaryRow.bytes)))
+    }
+  }
+
+  /**
+   * Build sides held by the enclave of this executor, keyed by enclave and broadcast ID, with the
+   * number of tasks currently probing each one.
+   */
+  private val buildSides = mutable.HashMap[(Long, Long), (Long, Int)]()
+
+  /**
+   * Return a handle to the build side of the given broadcast primary table in the given enclave,
+   * building it on first use so that all tasks of a join on this executor share one build side.
+   * Build sides of earlier joins that are no longer being probed are freed first, so each enclave
+   * holds at most one idle build side.
+   */
+  def acquireBuildSide(
+      enclave: SGXEnclave, eid: Long, joinExprSer: Array[Byte],
+      buildRows: Broadcast[Block]): Long = synchronized {
+    for ((id, (handle, users)) <- buildSides.toSeq
+         if id != (eid, buildRows.id) && users == 0) {
+      enclave.BroadcastRelease(id._1, handle)
+      buildSides.remove(id)
+    }
+    val (handle, users) = buildSides.getOrElse(
+      (eid, buildRows.id), (enclave.BroadcastBuild(eid, joinExprSer, buildRows.value.bytes), 0))
+    buildSides((eid, buildRows.id)) = (handle, users + 1)
+    handle
+  }
+
+  def releaseBuildSide(eid: Long, buildRows: Broadcast[Block]): Unit = synchronized {
+    val (handle, users) = buildSides((eid, buildRows.id))
+    buildSides((eid, buildRows.id)) = (handle, users - 1)
+  }
+}
+
 case class ObliviousUnionExec(
     left: SparkPlan,
     right: SparkPlan)
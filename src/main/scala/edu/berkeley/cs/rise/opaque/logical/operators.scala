@@ -26,7 +26,12 @@ import org.apache.spark.sql.catalyst.expressions.AttributeSet
 import org.apache.spark.sql.catalyst.expressions.Expression
 import org.apache.spark.sql.catalyst.expressions.NamedExpression
 import org.apache.spark.sql.catalyst.expressions.SortOrder
+import org.apache.spark.sql.catalyst.plans.FullOuter
 import org.apache.spark.sql.catalyst.plans.JoinType
+import org.apache.spark.sql.catalyst.plans.LeftAnti
+import org.apache.spark.sql.catalyst.plans.LeftOuter
+import org.apache.spark.sql.catalyst.plans.LeftSemi
+import org.apache.spark.sql.catalyst.plans.RightOuter
 import org.apache.spark.sql.catalyst.plans.logical.BinaryNode
 import org.apache.spark.sql.catalyst.plans.logical.LeafNode
 import org.apache.spark.sql.catalyst.plans.logical.LogicalPlan
@@ -142,6 +147,11 @@ case class EncryptedSort(order: Seq[SortOrder], child: OpaqueOperator)
   override def output: Seq[Attribute] = child.output
 }
 
+case class EncryptedTopK(limit: Int, order: Seq[SortOrder], child: OpaqueOperator)
+  extends UnaryNode with OpaqueOperator {
+  override def output: Seq[Attribute] = child.output
+}
+
 case class ObliviousAggregate(
     groupingExpressions: Seq[Expression],
     aggExpressions: Seq[NamedExpression],
@@ -181,7 +191,18 @@ case class EncryptedJoin(
     condition: Option[Expression])
   extends BinaryNode with OpaqueOperator {
 
-  override def output: Seq[Attribute] = left.output ++ right.output
+  override def output: Seq[Attribute] = joinType match {
+    case LeftSemi | LeftAnti =>
+      left.output
+    case LeftOuter =>
+      left.output ++ right.output.map(_.withNullability(true))
+    case RightOuter =>
+      left.output.map(_.withNullability(true)) ++ right.output
+    case FullOuter =>
+      left.output.map(_.withNullability(true)) ++ right.output.map(_.withNullability(true))
+    case _ =>
+      left.output ++ right.output
+  }
 }
 
 case class ObliviousUnion(
@@ -22,9 +22,8 @@ import edu.berkeley.cs.rise.opaque.Utils
 import edu.berkeley.cs.rise.opaque.execution.OpaqueOperatorExec
 import org.apache.spark.sql.InMemoryRelationMatcher
 import org.apache.spark.sql.UndoCollapseProject
-import org.apache.spark.sql.catalyst.expressions.And
 import org.apache.spark.sql.catalyst.expressions.Ascending
-import org.apache.spark.sql.catalyst.expressions.IsNotNull
+import org.apache.spark.sql.catalyst.expressions.IntegerLiteral
 import org.apache.spark.sql.catalyst.expressions.SortOrder
 import org.apache.spark.sql.catalyst.plans.logical._
 import org.apache.spark.sql.catalyst.rules.Rule
@@ -76,13 +75,6 @@ object ConvertToOpaqueOperators extends Rule[LogicalPlan] {
     case p @ Project(projectList, child) if isEncrypted(child) =>
       EncryptedProject(projectList, child.asInstanceOf[OpaqueOperator])
 
-    // We don't support null values yet, so there's no point in checking whether the output of an
-    // encrypted operator is null
-    case p @ Filter(And(IsNotNull(_), IsNotNull(_)), child) if isEncrypted(child) =>
-      child
-    case p @ Filter(IsNotNull(_), child) if isEncrypted(child) =>
-      child
-
     case p @ Filter(condition, child) if isOblivious(child) =>
       ObliviousFilter(condition, ObliviousPermute(child.asInstanceOf[OpaqueOperator]))
     case p @ Filter(condition, child) if isEncrypted(child) =>
@@ -117,25 +109,32 @@ object ConvertToOpaqueOperators extends Rule[LogicalPlan] {
               groupingExprs.map(e => SortOrder(e, Ascending)),
               child.asInstanceOf[OpaqueOperator]))
       }
+    // Encrypted aggregation groups rows by hashing, so unlike the oblivious aggregation it needs
+    // no sort
     case p @ Aggregate(groupingExprs, aggExprs, child) if isEncrypted(p) =>
       UndoCollapseProject.separateProjectAndAgg(p) match {
         case Some((projectExprs, aggExprs)) =>
           EncryptedProject(
             projectExprs,
             EncryptedAggregate(
-              groupingExprs, aggExprs,
-              EncryptedSort(
-                groupingExprs.map(e => SortOrder(e, Ascending)),
-                child.asInstanceOf[OpaqueOperator])))
+              groupingExprs, aggExprs, child.asInstanceOf[OpaqueOperator]))
         case None =>
           EncryptedAggregate(
-            groupingExprs, aggExprs,
-            EncryptedSort(
-              groupingExprs.map(e => SortOrder(e, Ascending)),
-              child.asInstanceOf[OpaqueOperator]))
+            groupingExprs, aggExprs, child.asInstanceOf[OpaqueOperator])
       }
 
-    // For now, just ignore limits. TODO: Implement Opaque operators for these
+    // A limit on top of a sort only needs the first rows in sort order. Since the rule is applied
+    // bottom-up, LocalLimit sees the converted sort and GlobalLimit then sees the top-K. Rules have
+    // no SQL conf, so EncryptedTopKExec falls back to a full sort if the limit is too large.
+    case p @ LocalLimit(IntegerLiteral(limit), EncryptedSort(order, child)) =>
+      EncryptedTopK(limit, order, child)
+    case p @ GlobalLimit(IntegerLiteral(limit), EncryptedSort(order, child)) =>
+      EncryptedTopK(limit, order, child)
+    case p @ GlobalLimit(IntegerLiteral(limit), t @ EncryptedTopK(topKLimit, _, _))
+        if topKLimit <= limit =>
+      t
+
+    // For now, just ignore other limits. TODO: Implement Opaque operators for these
     case p @ GlobalLimit(_, child) if isEncrypted(p) => child
     case p @ LocalLimit(_, child) if isEncrypted(p) => child
 
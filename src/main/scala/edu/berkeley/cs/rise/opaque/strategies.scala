@@ -19,13 +19,13 @@ package edu.berkeley.cs.rise.opaque
 
 import org.apache.spark.sql.Strategy
 import org.apache.spark.sql.catalyst.expressions.Alias
-import org.apache.spark.sql.catalyst.expressions.Ascending
 import org.apache.spark.sql.catalyst.expressions.Attribute
 import org.apache.spark.sql.catalyst.expressions.Expression
 import org.apache.spark.sql.catalyst.expressions.Literal
 import org.apache.spark.sql.catalyst.expressions.NamedExpression
-import org.apache.spark.sql.catalyst.expressions.SortOrder
 import org.apache.spark.sql.catalyst.planning.ExtractEquiJoinKeys
+import org.apache.spark.sql.catalyst.plans.LeftAnti
+import org.apache.spark.sql.catalyst.plans.LeftSemi
 import org.apache.spark.sql.catalyst.plans.logical.Join
 import org.apache.spark.sql.catalyst.plans.logical.LogicalPlan
 import org.apache.spark.sql.execution.SparkPlan
@@ -44,24 +44,36 @@ object OpaqueOperators extends Strategy {
     case EncryptedSort(order, child) =>
       EncryptedSortExec(order, planLater(child)) :: Nil
 
-    case EncryptedJoin(left, right, joinType, condition) =>
+    case ObliviousSort(order, child) =>
+      ObliviousSortExec(order, planLater(child)) :: Nil
+
+    case EncryptedTopK(limit, order, child) =>
+      EncryptedTopKExec(limit, order, planLater(child)) :: Nil
+
+    case j @ EncryptedJoin(left, right, joinType, condition) =>
       Join(left, right, joinType, condition) match {
         case ExtractEquiJoinKeys(_, leftKeys, rightKeys, condition, _, _) =>
-          val (leftProjSchema, leftKeysProj, tag) = tagForJoin(leftKeys, left.output, true)
-          val (rightProjSchema, rightKeysProj, _) = tagForJoin(rightKeys, right.output, false)
-          val leftProj = ObliviousProjectExec(leftProjSchema, planLater(left))
-          val rightProj = ObliviousProjectExec(rightProjSchema, planLater(right))
-          val unioned = ObliviousUnionExec(leftProj, rightProj)
-          val sorted = EncryptedSortExec(sortForJoin(leftKeysProj, tag, unioned.output), unioned)
-          val joined = EncryptedSortMergeJoinExec(
+          // The enclave always treats the left side as the primary table. Semi and anti joins
+          // output rows of the left side only, which the enclave does for the foreign table.
+          val swapSides = joinType == LeftSemi || joinType == LeftAnti
+          val (primary, foreign, primaryKeys, foreignKeys) =
+            if (swapSides) (right, left, rightKeys, leftKeys)
+            else (left, right, leftKeys, rightKeys)
+          val (primaryProjSchema, primaryKeysProj, _) =
+            tagForJoin(primaryKeys, primary.output, true)
+          val (foreignProjSchema, foreignKeysProj, _) =
+            tagForJoin(foreignKeys, foreign.output, false)
+          val primaryProj = ObliviousProjectExec(primaryProjSchema, planLater(primary))
+          val foreignProj = ObliviousProjectExec(foreignProjSchema, planLater(foreign))
+          EncryptedHashJoinExec(
             joinType,
-            leftKeysProj,
-            rightKeysProj,
-            leftProjSchema.map(_.toAttribute),
-            rightProjSchema.map(_.toAttribute),
-            (leftProjSchema ++ rightProjSchema).map(_.toAttribute),
-            sorted)
-          ObliviousProjectExec(dropTags(left.output, right.output), joined) :: Nil
+            primaryKeysProj,
+            foreignKeysProj,
+            primaryProjSchema.map(_.toAttribute),
+            foreignProjSchema.map(_.toAttribute),
+            j.output,
+            primaryProj,
+            foreignProj) :: Nil
         case _ => Nil
       }
 
@@ -90,12 +102,4 @@ object OpaqueOperators extends Strategy {
     val tag = Alias(Literal(if (isLeft) 0 else 1), "_tag")()
     (Seq(tag) ++ keysProj ++ input, keysProj.map(_.toAttribute), tag.toAttribute)
   }
-
-  private def sortForJoin(
-      leftKeys: Seq[Expression], tag: Expression, input: Seq[Attribute]): Seq[SortOrder] =
-    leftKeys.map(k => SortOrder(k, Ascending)) :+ SortOrder(tag, Ascending)
-
-  private def dropTags(
-      leftOutput: Seq[Attribute], rightOutput: Seq[Attribute]): Seq[NamedExpression] =
-    leftOutput ++ rightOutput
 }
@@ -33,7 +33,11 @@ import org.scalatest.BeforeAndAfterAll
 import org.scalatest.FunSuite
 
 import edu.berkeley.cs.rise.opaque.benchmark._
+import edu.berkeley.cs.rise.opaque.execution.EncryptedAggregateExec
 import edu.berkeley.cs.rise.opaque.execution.EncryptedBlockRDDScanExec
+import edu.berkeley.cs.rise.opaque.execution.EncryptedHashJoinExec
+import edu.berkeley.cs.rise.opaque.execution.EncryptedSortExec
+import edu.berkeley.cs.rise.opaque.execution.EncryptedTopKExec
 
 trait OpaqueOperatorTests extends FunSuite with BeforeAndAfterAll { self =>
   def spark: SparkSession
@@ -75,6 +79,18 @@ trait OpaqueOperatorTests extends FunSuite with BeforeAndAfterAll { self =>
     }
   }
 
+  /** Run f with the given Spark SQL conf set, restoring its previous value afterwards. */
+  def withConf[A](key: String, value: String)(f: => A): A = {
+    val oldValue = spark.conf.getOption(key)
+    spark.conf.set(key, value)
+    try f finally {
+      oldValue match {
+        case Some(v) => spark.conf.set(key, v)
+        case None => spark.conf.unset(key)
+      }
+    }
+  }
+
   testAgainstSpark("create DataFrame from sequence") { securityLevel =>
     val data = for (i <- 0 until 5) yield ("foo", i)
     makeDF(data, securityLevel, "word", "count").collect
@@ -88,6 +104,15 @@ trait OpaqueOperatorTests extends FunSuite with BeforeAndAfterAll { self =>
     df.filter($"x" > lit(10)).collect
   }
 
+  testAgainstSpark("filter on null values") { securityLevel =>
+    val data = for (i <- 0 until 256) yield (i, if (i % 4 == 0) None else Some(i.toString))
+    val df = makeDF(data, securityLevel, "id", "str")
+    Seq(
+      df.filter($"str".isNotNull).collect.toSet,
+      df.filter($"str".isNotNull && $"id".isNotNull).collect.toSet,
+      df.filter($"str".isNull).collect.toSet)
+  }
+
   testAgainstSpark("select") { securityLevel =>
     val data = for (i <- 0 until 256) yield ("%03d".format(i) * 3, i.toFloat)
     val df = makeDF(data, securityLevel, "str", "x")
@@ -169,6 +194,43 @@ trait OpaqueOperatorTests extends FunSuite with BeforeAndAfterAll { self =>
     df.sort($"x", $"y").collect
   }
 
+  testAgainstSpark("sort with limit") { securityLevel =>
+    val data = Random.shuffle((0 until 256).map(x => (x.toString, x)).toSeq)
+    val df = makeDF(data, securityLevel, "str", "x")
+    df.sort($"x".desc).limit(10).collect
+  }
+
+  testAgainstSpark("sort with limit above the top-K threshold") { securityLevel =>
+    // A limit above the threshold falls back to a full sort. The limit also exceeds the number of
+    // rows, which the fallback returns all of.
+    val data = Random.shuffle((0 until 256).map(x => (x.toString, x)).toSeq)
+    val df = makeDF(data, securityLevel, "str", "x")
+    withConf(EncryptedTopKExec.maxLimitConf, "10") {
+      df.sort($"x".desc).limit(300).collect
+    }
+  }
+
+  testAgainstSpark("sort with multiple threads") { securityLevel =>
+    // Rows padded to over 1 KB fill several encrypted blocks per partition, so that each sort
+    // thread gets its own chunk of blocks to sort before the threads merge their key ranges
+    val padding = "x" * 1000
+    val data = Random.shuffle((0 until 4000).map(x => (padding + x, x)).toSeq)
+    val df = makeDF(data, securityLevel, "str", "x")
+    withConf(EncryptedSortExec.sortThreadsConf, "4") {
+      df.sort($"x").collect
+    }
+  }
+
+  testAgainstSpark("sort with sampled range bounds") { securityLevel =>
+    // With several partitions of over 2000 rows each, every partition contributes a sample of key
+    // rows tagged with a level above 0, and the merged samples choose the range boundaries
+    val data = Random.shuffle((0 until 10000).map(x => (x.toString, x)).toSeq)
+    val df = makeDF(data, securityLevel, "str", "x")
+    withConf(EncryptedSortExec.boundsConf, "sample") {
+      df.sort($"x").collect
+    }
+  }
+
   testAgainstSpark("join") { securityLevel =>
     val p_data = for (i <- 1 to 16) yield (i, i.toString, i * 10)
     val f_data = for (i <- 1 to 256 - 16) yield (i, (i % 16).toString, i * 10)
@@ -185,6 +247,62 @@ trait OpaqueOperatorTests extends FunSuite with BeforeAndAfterAll { self =>
     p.join(f, $"pk" === $"fk").collect.toSet
   }
 
+  testAgainstSpark("join types") { securityLevel =>
+    val p_data = for (i <- 1 to 16) yield (i, (i * 2).toString, i * 10)
+    val f_data = for (i <- 1 to 256 - 16) yield (i, (i % 24).toString, i * 10)
+    val p = makeDF(p_data, securityLevel, "id", "pk", "x")
+    val f = makeDF(f_data, securityLevel, "id", "fk", "x")
+    Seq("left_semi", "left_anti").map { joinType =>
+      f.join(p, $"pk" === $"fk", joinType).collect.toSet
+    } ++ Seq("left_outer", "right_outer", "full_outer").map { joinType =>
+      p.join(f, $"pk" === $"fk", joinType).collect.toSet
+    }
+  }
+
+  testAgainstSpark("join with Bloom filter") { securityLevel =>
+    // A memory budget smaller than the primary table rules out broadcasting it, so inner and semi
+    // joins first drop foreign rows using a Bloom filter over the primary keys
+    val p_data = for (i <- 1 to 1000) yield (i, (i * 2).toString, i * 10)
+    val f_data = for (i <- 1 to 2000) yield (i, (i % 1200).toString, i * 10)
+    val p = makeDF(p_data, securityLevel, "id", "pk", "x")
+    val f = makeDF(f_data, securityLevel, "id", "fk", "x")
+    withConf(EncryptedHashJoinExec.memoryBudgetConf, "10000") {
+      Seq(
+        p.join(f, $"pk" === $"fk").collect.toSet,
+        f.join(p, $"pk" === $"fk", "left_semi").collect.toSet)
+    }
+  }
+
+  testAgainstSpark("hash partitioned join") { securityLevel =>
+    // A memory budget smaller than the primary table makes every join but semi and anti joins hash
+    // partition both tables into several partitions and hash join each co-partitioned pair. Outer
+    // joins must keep and pad the primary rows with a null key, which are spread over partitions.
+    def key(i: Int): Option[String] = if (i % 10 == 0) None else Some(i.toString)
+    val p_data = for (i <- 1 to 1000) yield (i, key(i * 2), i * 10)
+    val f_data = for (i <- 1 to 2000) yield (i, key(i % 1200), i * 10)
+    val p = makeDF(p_data, securityLevel, "id", "pk", "x")
+    val f = makeDF(f_data, securityLevel, "id", "fk", "x")
+    withConf(EncryptedHashJoinExec.memoryBudgetConf, "10000") {
+      Seq("inner", "right_outer", "left_outer", "full_outer").map { joinType =>
+        p.join(f, $"pk" === $"fk", joinType).collect.toSet
+      }
+    }
+  }
+
+  testAgainstSpark("semi and anti join with a heavy key") { securityLevel =>
+    // Most foreign rows share one key, so with several partitions the key spans several range
+    // partitions, and all but one of them must get its primary row from a neighboring partition
+    val p_data = for (i <- 1 to 1000) yield (i, i.toString, i * 10)
+    val f_data = for (i <- 1 to 3000) yield (i, (if (i % 3 == 0) i else 500).toString, i * 10)
+    val p = makeDF(p_data, securityLevel, "id", "pk", "x")
+    val f = makeDF(f_data, securityLevel, "id", "fk", "x")
+    withConf(EncryptedHashJoinExec.memoryBudgetConf, "10000") {
+      Seq("left_semi", "left_anti").map { joinType =>
+        f.join(p, $"pk" === $"fk", joinType).collect.toSet
+      }
+    }
+  }
+
   def abc(i: Int): String = (i % 3) match {
     case 0 => "A"
     case 1 => "B"
@@ -255,6 +373,26 @@ trait OpaqueOperatorTests extends FunSuite with BeforeAndAfterAll { self =>
       .collect.sortBy { case Row(str: String, _, _) => str }
   }
 
+  testAgainstSpark("aggregate with null values") { securityLevel =>
+    val data = for (i <- 0 until 256) yield (abc(i), if (i % 4 == 0) None else Some(i))
+    val words = makeDF(data, securityLevel, "category", "price")
+
+    words.groupBy("category").agg(
+      avg("price"), count("price"), max("price"), min("price"), sum("price"))
+      .collect.sortBy { case Row(category: String, _, _, _, _, _) => category }
+  }
+
+  testAgainstSpark("aggregate with spilling") { securityLevel =>
+    // A memory budget that holds only a few groups makes hash aggregation spill most groups, and
+    // each spill partition still has too many groups, so it spills again
+    val data = for (i <- 0 until 4000) yield (i % 1000, i)
+    val df = makeDF(data, securityLevel, "k", "x")
+    withConf(EncryptedAggregateExec.memoryBudgetConf, "4000") {
+      df.groupBy("k").agg(sum("x"), count("x"))
+        .collect.sortBy { case Row(k: Int, _, _) => k }
+    }
+  }
+
   testOpaqueOnly("global aggregate") { securityLevel =>
     val data = for (i <- 0 until 256) yield (i, abc(i), 1)
     val words = makeDF(data, securityLevel, "id", "word", "count")